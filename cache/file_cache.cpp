@@ -0,0 +1,306 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "file_cache.h"
+#include "../log/log.h"
+
+file_cache::file_cache()
+{
+    m_shard_cap = 0;
+    m_shard_bytes = 0;
+    m_render = NULL;
+    m_inotify_fd = -1;
+    m_close_log = 0;
+    m_hits = 0;
+    m_misses = 0;
+}
+
+file_cache::~file_cache()
+{
+    clear();
+    if (m_inotify_fd >= 0)
+        close(m_inotify_fd);
+}
+
+file_cache *file_cache::get_instance()
+{
+    static file_cache instance;
+    return &instance;
+}
+
+bool file_cache::init(const char *doc_root, int capacity, long resp_budget, render_func render, int close_log)
+{
+    m_root = doc_root;
+    m_close_log = close_log;
+    m_shard_cap = capacity / SHARD_NUM > 0 ? capacity / SHARD_NUM : 1;
+    m_shard_bytes = resp_budget / SHARD_NUM;
+    m_render = render;
+
+    //只监视根目录本身，子目录中的文件不进入缓存
+    m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify_fd < 0)
+        return false;
+    uint32_t mask = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                    IN_DELETE_SELF | IN_MOVE_SELF;
+    if (inotify_add_watch(m_inotify_fd, doc_root, mask) < 0)
+    {
+        close(m_inotify_fd);
+        m_inotify_fd = -1;
+        return false;
+    }
+    warm_up();
+    return true;
+}
+
+bool file_cache::cacheable(const string &path)
+{
+    size_t len = m_root.size();
+    return m_inotify_fd >= 0 && path.size() > len + 1 && path.compare(0, len, m_root) == 0 &&
+           path[len] == '/' && path.find('/', len + 1) == string::npos;
+}
+
+void file_cache::warm_up()
+{
+    DIR *dir = opendir(m_root.c_str());
+    if (!dir)
+        return;
+    int num = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL && num < m_shard_cap * SHARD_NUM)
+    {
+        if (DT_REG != ent->d_type && DT_UNKNOWN != ent->d_type)
+            continue;
+        file_entry *e = acquire((m_root + "/" + ent->d_name).c_str());
+        if (!e)
+            continue;
+        release(e);
+        ++num;
+    }
+    closedir(dir);
+    //预热不计入命中统计
+    m_hits = 0;
+    m_misses = 0;
+    LOG_INFO("file cache warmed up: %d files, %ld response bytes", size(), resp_bytes());
+}
+
+//头部 + 内容，短连接和长连接各一份，状态行、Date和Keep-Alive由连接写在其前
+void file_cache::render_response(file_entry *e)
+{
+    char head[2][RESP_HEAD_SIZE];
+    int head_len[2];
+    off_t size = e->st.st_size;
+    long total = 0;
+    for (int i = 0; i < 2; ++i)
+    {
+        head_len[i] = m_render(e, 1 == i, head[i], RESP_HEAD_SIZE);
+        if (head_len[i] <= 0 || head_len[i] >= RESP_HEAD_SIZE)
+            return;
+        total += head_len[i] + size;
+    }
+    if (total > m_shard_bytes)
+        return;
+
+    char *resp = (char *)malloc(total);
+    if (!resp)
+        return;
+    for (int i = 0; i < 2; ++i)
+    {
+        memcpy(resp, head[i], head_len[i]);
+        memcpy(resp + head_len[i], e->addr, size);
+        e->resp[i] = resp;
+        e->resp_len[i] = head_len[i] + size;
+        resp += e->resp_len[i];
+    }
+}
+
+file_entry *file_cache::open_entry(const char *path, bool render)
+{
+    struct stat st;
+    if (stat(path, &st) < 0)
+        return NULL;
+
+    file_entry *e = new file_entry;
+    e->path = path;
+    e->st = st;
+    e->fd = -1;
+    e->addr = NULL;
+    e->ref = 1;
+    e->cached = false;
+    e->resp[0] = e->resp[1] = NULL;
+    e->resp_len[0] = e->resp_len[1] = 0;
+    //文件被替换或修改后inode、大小或纳秒级修改时间至少一项不同
+    snprintf(e->etag, sizeof(e->etag), "\"%lx-%lx-%lx\"", (unsigned long)st.st_ino, (unsigned long)st.st_size,
+             (unsigned long)st.st_mtim.tv_sec * 1000000000UL + st.st_mtim.tv_nsec);
+    struct tm tm;
+    gmtime_r(&st.st_mtime, &tm);
+    strftime(e->last_modified, sizeof(e->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+    //目录和不可读文件只缓存元数据，由调用者据此返回错误
+    if (S_ISREG(st.st_mode) && (st.st_mode & S_IROTH))
+    {
+        e->fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (e->fd < 0)
+        {
+            delete e;
+            return NULL;
+        }
+        if (st.st_size > 0)
+        {
+            void *addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, e->fd, 0);
+            if (MAP_FAILED != addr)
+                e->addr = (char *)addr;
+        }
+        if (render && e->addr && st.st_size <= RESP_MAX_FILE)
+            render_response(e);
+    }
+    return e;
+}
+
+file_entry *file_cache::acquire(const char *path)
+{
+    string key(path);
+    shard &s = get_shard(key);
+
+    s.lock.lock();
+    unordered_map<string, file_entry *>::iterator it = s.map.find(key);
+    if (it != s.map.end())
+    {
+        file_entry *e = it->second;
+        e->ref++;
+        s.lru.splice(s.lru.begin(), s.lru, e->lru);
+        s.lock.unlock();
+        m_hits++;
+        return e;
+    }
+    s.lock.unlock();
+
+    //stat、open和mmap都在锁外进行
+    m_misses++;
+    //只缓存根目录下的文件，inotify只能看到它们的变化
+    bool cache = cacheable(key);
+    file_entry *e = open_entry(path, cache && m_render && m_shard_bytes > 0);
+    if (!e || !cache)
+        return e;
+
+    s.lock.lock();
+    it = s.map.find(key);
+    if (it != s.map.end())
+    {
+        //其他线程已先插入，改用已有的
+        file_entry *old = it->second;
+        old->ref++;
+        s.lock.unlock();
+        release(e);
+        return old;
+    }
+    e->cached = true;
+    e->ref++;
+    s.lru.push_front(e);
+    e->lru = s.lru.begin();
+    s.map[key] = e;
+    s.bytes += e->resp_len[0] + e->resp_len[1];
+    //超过文件数或响应内存预算时从表尾淘汰，新项单独不会超过预算
+    while ((int)s.map.size() > m_shard_cap || s.bytes > m_shard_bytes)
+        evict(s, s.lru.back());
+    s.lock.unlock();
+    return e;
+}
+
+void file_cache::release(file_entry *e)
+{
+    if (--e->ref > 0)
+        return;
+    free(e->resp[0]);
+    if (e->addr)
+        munmap(e->addr, e->st.st_size);
+    if (e->fd >= 0)
+        close(e->fd);
+    delete e;
+}
+
+void file_cache::evict(shard &s, file_entry *e)
+{
+    s.bytes -= e->resp_len[0] + e->resp_len[1];
+    s.map.erase(e->path);
+    s.lru.erase(e->lru);
+    e->cached = false;
+    release(e);
+}
+
+void file_cache::invalidate(const string &path)
+{
+    shard &s = get_shard(path);
+    s.lock.lock();
+    unordered_map<string, file_entry *>::iterator it = s.map.find(path);
+    if (it != s.map.end())
+        evict(s, it->second);
+    s.lock.unlock();
+}
+
+void file_cache::clear()
+{
+    for (int i = 0; i < SHARD_NUM; ++i)
+    {
+        shard &s = m_shards[i];
+        s.lock.lock();
+        while (!s.lru.empty())
+            evict(s, s.lru.back());
+        s.lock.unlock();
+    }
+}
+
+int file_cache::size()
+{
+    int num = 0;
+    for (int i = 0; i < SHARD_NUM; ++i)
+    {
+        m_shards[i].lock.lock();
+        num += m_shards[i].map.size();
+        m_shards[i].lock.unlock();
+    }
+    return num;
+}
+
+long file_cache::resp_bytes()
+{
+    long bytes = 0;
+    for (int i = 0; i < SHARD_NUM; ++i)
+    {
+        m_shards[i].lock.lock();
+        bytes += m_shards[i].bytes;
+        m_shards[i].lock.unlock();
+    }
+    return bytes;
+}
+
+void file_cache::handle_events()
+{
+    int len;
+    while ((len = read(m_inotify_fd, m_event_buf, EVENT_BUF_SIZE)) > 0)
+        handle_events(len);
+}
+
+void file_cache::handle_events(int len)
+{
+    for (char *p = m_event_buf; p < m_event_buf + len;)
+    {
+        struct inotify_event *event = (struct inotify_event *)p;
+        //事件队列溢出或根目录本身被移动、删除，无法确定哪些文件变了，全部失效
+        if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+        {
+            LOG_INFO("%s", "file cache cleared");
+            clear();
+        }
+        else if (event->len > 0)
+        {
+            LOG_INFO("file cache invalidate %s", event->name);
+            invalidate(m_root + "/" + event->name);
+        }
+        p += sizeof(struct inotify_event) + event->len;
+    }
+}
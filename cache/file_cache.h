@@ -0,0 +1,123 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+/*************************************************************
+*静态文件的描述符和元数据缓存
+*按完整路径缓存stat结果、打开的描述符和只读映射，同一文件不再每次stat/open/mmap/close
+*按路径散列分片，每片一把锁和一条LRU链表，超过容量淘汰最久未用的文件
+*inotify监视网站根目录，文件被修改、替换或删除时立即失效
+*小文件另外预先生成200响应中不随请求变化的头部和内容，短连接和长连接各一份，与状态行等一次writev发出，所有响应共用一个内存预算
+**************************************************************/
+
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <atomic>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include "../lock/locker.h"
+
+using namespace std;
+
+//一个缓存的文件，由缓存和正在发送它的连接共同引用，最后一个引用释放时才关闭和取消映射
+struct file_entry
+{
+    string path;
+    struct stat st;
+    int fd;                 //普通可读文件才打开，否则为-1
+    char *addr;             //整个文件的只读映射，空文件为NULL
+    std::atomic<int> ref;
+    bool cached;            //是否在缓存中，根目录之外的文件不缓存，用完即关闭
+    //预先生成的200响应中不随请求变化的头部和内容，[0]为短连接，[1]为长连接，未生成为NULL
+    //两份在同一块内存中，resp[0]为其起始
+    char *resp[2];
+    int resp_len[2];
+    //由inode、大小和修改时间生成的强ETag(含引号)，以及HTTP日期格式的修改时间
+    char etag[64];
+    char last_modified[32];
+    list<file_entry *>::iterator lru;
+};
+
+//生成e的200响应中不随请求变化的头部(从Connection起，含结束的空行)，linger为是否长连接
+//返回写入的字节数，空间不足返回不小于len的值
+typedef int (*render_func)(const file_entry *e, bool linger, char *buf, int len);
+
+class file_cache
+{
+public:
+    //单例模式
+    static file_cache *get_instance();
+
+    //监视doc_root，capacity为最多缓存的文件数，resp_budget为预生成响应的内存预算(字节)，0为不生成
+    //初始化后扫描根目录预热
+    bool init(const char *doc_root, int capacity, long resp_budget, render_func render, int close_log);
+
+    //取得path的缓存项并增加引用，未命中时stat并打开；文件不存在返回NULL
+    file_entry *acquire(const char *path);
+    //发送完毕后释放引用
+    void release(file_entry *e);
+
+    //inotify描述符，由0号反应堆监听，未初始化时为-1
+    int get_inotify_fd() { return m_inotify_fd; }
+    //epoll模式：读出所有inotify事件并使对应文件失效
+    void handle_events();
+    //io_uring模式：事件已读入event_buf，len为读到的字节数
+    void handle_events(int len);
+    char *event_buf() { return m_event_buf; }
+    int event_buf_size() { return EVENT_BUF_SIZE; }
+
+    long hits() { return m_hits; }
+    long misses() { return m_misses; }
+    int size();
+    //预生成响应占用的字节数
+    long resp_bytes();
+
+private:
+    file_cache();
+    ~file_cache();
+
+    static const int SHARD_NUM = 16;
+    static const int EVENT_BUF_SIZE = 4096;
+    static const int RESP_MAX_FILE = 64 * 1024;    //超过该大小的文件不预生成响应
+    static const int RESP_HEAD_SIZE = 512;
+
+    struct shard
+    {
+        locker lock;
+        unordered_map<string, file_entry *> map;
+        list<file_entry *> lru;     //表头最近使用
+        long bytes;                 //本片预生成响应占用的字节数
+
+        shard() : bytes(0) {}
+    };
+
+    shard &get_shard(const string &path) { return m_shards[hash<string>()(path) % SHARD_NUM]; }
+    //stat并打开文件，不存在返回NULL；render为是否预生成响应
+    file_entry *open_entry(const char *path, bool render);
+    //为小文件生成两种连接方式的响应头部和内容
+    void render_response(file_entry *e);
+    //path是否直接位于根目录下，只有这些文件的变化能被inotify看到
+    bool cacheable(const string &path);
+    //扫描根目录，打开并缓存其中的文件
+    void warm_up();
+    //从所在分片移除并释放缓存持有的引用，调用者持有分片锁
+    void evict(shard &s, file_entry *e);
+    //使path失效
+    void invalidate(const string &path);
+    //清空所有分片
+    void clear();
+
+private:
+    shard m_shards[SHARD_NUM];
+    int m_shard_cap;        //每片容量
+    long m_shard_bytes;     //每片预生成响应的内存预算
+    render_func m_render;
+    string m_root;
+    int m_inotify_fd;
+    int m_close_log;
+    std::atomic<long> m_hits;
+    std::atomic<long> m_misses;
+    char m_event_buf[EVENT_BUF_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+};
+
+#endif
@@ -30,11 +30,66 @@ Config::Config(){
 
     //并发模型,默认是proactor
     actor_model = 0;
+
+    //事件循环线程数量,默认1,即单个主线程事件循环
+    reactor_num = 1;
+
+    //监听队列长度,默认1024,实际值受net.core.somaxconn限制
+    backlog = 1024;
+
+    //TCP_DEFER_ACCEPT,默认关闭
+    defer_accept = 0;
+
+    //定时周期,默认5000毫秒,空闲连接3个周期后关闭
+    timeslot = 5000;
+
+    //请求头长度上限,默认8KB
+    head_limit = 8;
+
+    //消息体长度上限,默认1MB
+    body_limit = 1024;
+
+    //静态文件发送方式,默认mmap + writev
+    zero_copy = 0;
+
+    //预生成响应的内存预算,默认8MB
+    resp_cache = 8192;
+
+    //Cache-Control策略,默认页面每次验证,其余文件缓存1小时
+    cache_policy = "html:no-cache;*:max-age=3600";
+
+    //长连接空闲超时(秒),默认0,即3个定时周期
+    keep_alive = 0;
+
+    //每个长连接最多处理的请求数,默认1000
+    keep_alive_max = 1000;
+
+    //目录索引,默认关闭,请求目录返回400
+    autoindex = 0;
+
+    //上传目录,默认为空,不接受上传
+    upload_dir = "";
+
+    //单个上传的长度上限(MB),默认1024
+    upload_limit = 1024;
+
+    //HTTP/2(h2c),默认关闭
+    http2 = 0;
+
+    //TLS证书链和私钥,默认为空,不启用TLS
+    tls_cert = "";
+    tls_key = "";
+
+    //内核TLS,默认开启
+    ktls = 1;
+
+    //一次写事件最多发送的字节数(KB),默认256,0为不限
+    write_quantum = 256;
 }
 
 void Config::parse_arg(int argc, char*argv[]){
     int opt;
-    const char *str = "p:l:m:o:s:t:c:a:";
+    const char *str = "p:l:m:o:s:t:c:a:r:b:d:T:H:B:z:C:E:k:K:i:U:u:2:S:P:x:w:";
     while ((opt = getopt(argc, argv, str)) != -1)
     {
         switch (opt)
@@ -79,6 +134,101 @@ void Config::parse_arg(int argc, char*argv[]){
             actor_model = atoi(optarg);
             break;
         }
+        case 'r':
+        {
+            reactor_num = atoi(optarg);
+            break;
+        }
+        case 'b':
+        {
+            backlog = atoi(optarg);
+            break;
+        }
+        case 'd':
+        {
+            defer_accept = atoi(optarg);
+            break;
+        }
+        case 'T':
+        {
+            timeslot = atoi(optarg);
+            break;
+        }
+        case 'H':
+        {
+            head_limit = atoi(optarg);
+            break;
+        }
+        case 'B':
+        {
+            body_limit = atoi(optarg);
+            break;
+        }
+        case 'z':
+        {
+            zero_copy = atoi(optarg);
+            break;
+        }
+        case 'C':
+        {
+            resp_cache = atoi(optarg);
+            break;
+        }
+        case 'E':
+        {
+            cache_policy = optarg;
+            break;
+        }
+        case 'k':
+        {
+            keep_alive = atoi(optarg);
+            break;
+        }
+        case 'K':
+        {
+            keep_alive_max = atoi(optarg);
+            break;
+        }
+        case 'i':
+        {
+            autoindex = atoi(optarg);
+            break;
+        }
+        case 'U':
+        {
+            upload_dir = optarg;
+            break;
+        }
+        case 'u':
+        {
+            upload_limit = atoi(optarg);
+            break;
+        }
+        case '2':
+        {
+            http2 = atoi(optarg);
+            break;
+        }
+        case 'S':
+        {
+            tls_cert = optarg;
+            break;
+        }
+        case 'P':
+        {
+            tls_key = optarg;
+            break;
+        }
+        case 'x':
+        {
+            ktls = atoi(optarg);
+            break;
+        }
+        case 'w':
+        {
+            write_quantum = atoi(optarg);
+            break;
+        }
         default:
             break;
         }
@@ -42,6 +42,61 @@ public:
 
     //并发模型选择
     int actor_model;
+
+    //事件循环(反应堆)线程数量
+    int reactor_num;
+
+    //监听队列长度
+    int backlog;
+
+    //TCP_DEFER_ACCEPT秒数，0为关闭
+    int defer_accept;
+
+    //定时周期(毫秒)
+    int timeslot;
+
+    //请求头长度上限(KB)
+    int head_limit;
+
+    //消息体长度上限(KB)
+    int body_limit;
+
+    //静态文件发送方式
+    int zero_copy;
+
+    //预生成响应的内存预算(KB)
+    int resp_cache;
+
+    //按扩展名的Cache-Control策略
+    string cache_policy;
+
+    //长连接空闲超时(秒)，0为3个定时周期
+    int keep_alive;
+
+    //每个长连接最多处理的请求数，0为不限
+    int keep_alive_max;
+
+    //请求目录时是否返回目录索引
+    int autoindex;
+
+    //上传目录，空为不接受上传
+    string upload_dir;
+
+    //单个上传的长度上限(MB)
+    int upload_limit;
+
+    //是否接受HTTP/2(h2c)
+    int http2;
+
+    //TLS证书链和私钥文件，空为不启用TLS
+    string tls_cert;
+    string tls_key;
+
+    //握手后是否把会话密钥交给内核TLS
+    int ktls;
+
+    //一次写事件最多发送的字节数(KB)，0为不限
+    int write_quantum;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,324 @@
+#include <string.h>
+#include "hpack.h"
+#include "http_response.h"
+
+//静态表(RFC 7541 附录A)，索引从1开始
+static const char *const static_table[][2] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"}, {":path", "/index.html"},
+    {":scheme", "http"}, {":scheme", "https"}, {":status", "200"}, {":status", "204"}, {":status", "206"},
+    {":status", "304"}, {":status", "400"}, {":status", "404"}, {":status", "500"}, {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"}, {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""},
+    {"access-control-allow-origin", ""}, {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""}, {"date", ""},
+    {"etag", ""}, {"expect", ""}, {"expires", ""}, {"from", ""}, {"host", ""}, {"if-match", ""},
+    {"if-modified-since", ""}, {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""},
+    {"last-modified", ""}, {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""}, {"retry-after", ""},
+    {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""}, {"transfer-encoding", ""},
+    {"user-agent", ""}, {"vary", ""}, {"via", ""}, {"www-authenticate", ""},
+};
+static const int STATIC_NUM = sizeof(static_table) / sizeof(static_table[0]);
+
+namespace
+{
+//各符号(256为EOS)的Huffman码长(RFC 7541 附录B)
+constexpr unsigned char huffman_len[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5, 6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23, 24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23, 21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25, 19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23, 26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+const int HUFFMAN_MIN = 5;
+const int HUFFMAN_MAX = 30;
+
+//规范编码：同一码长的码字连续，按符号顺序分配；长度为l的码字从first[l]开始，共count[l]个，对应symbols[offset[l]]起的符号
+struct huffman_table
+{
+    unsigned first[HUFFMAN_MAX + 1];
+    unsigned short count[HUFFMAN_MAX + 1];
+    unsigned short offset[HUFFMAN_MAX + 1];
+    unsigned short symbols[257];
+};
+
+constexpr huffman_table build_huffman()
+{
+    huffman_table t = {};
+    for (int s = 0; s < 257; ++s)
+        ++t.count[huffman_len[s]];
+    unsigned code = 0;
+    int k = 0;
+    for (int l = 1; l <= HUFFMAN_MAX; ++l)
+    {
+        code = (code + t.count[l - 1]) << 1;
+        t.first[l] = code;
+        t.offset[l] = k;
+        for (int s = 0; s < 257; ++s)
+        {
+            if (huffman_len[s] == l)
+                t.symbols[k++] = s;
+        }
+    }
+    return t;
+}
+
+constexpr huffman_table HUFFMAN = build_huffman();
+}
+
+//位串左对齐放在64位中，依次尝试5到30位的码长；结尾不足8位的填充须是EOS的前缀，即全1
+static int huffman_decode(const unsigned char *p, int len, char *dst, int cap)
+{
+    const unsigned char *end = p + len;
+    unsigned long long bits = 0;
+    int nbits = 0;
+    int n = 0;
+    while (true)
+    {
+        for (; nbits <= 56 && p < end; nbits += 8)
+            bits |= (unsigned long long)*p++ << (56 - nbits);
+        if (0 == nbits)
+            return n;
+        int l = HUFFMAN_MIN;
+        unsigned code = 0;
+        for (; l <= HUFFMAN_MAX && l <= nbits; ++l)
+        {
+            code = bits >> (64 - l);
+            if (code - HUFFMAN.first[l] < HUFFMAN.count[l])
+                break;
+        }
+        if (l > HUFFMAN_MAX || l > nbits)
+        {
+            if (nbits >= 8 || bits >> (64 - nbits) != (1ull << nbits) - 1)
+                return -1;
+            return n;
+        }
+        int sym = HUFFMAN.symbols[HUFFMAN.offset[l] + code - HUFFMAN.first[l]];
+        if (256 == sym || n >= cap)
+            return -1;
+        dst[n++] = sym;
+        bits <<= l;
+        nbits -= l;
+    }
+}
+
+//prefix位前缀的整数，超过2^28的不会是合法的长度或索引
+static bool read_int(const unsigned char *&p, const unsigned char *end, int prefix, int &v)
+{
+    int mask = (1 << prefix) - 1;
+    v = *p++ & mask;
+    if (v < mask)
+        return true;
+    for (int shift = 0; p < end && shift <= 21; shift += 7)
+    {
+        unsigned char b = *p++;
+        v += (b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+//字符串字面值拷入dst并以'\0'结尾，dst随之后移
+static bool read_string(const unsigned char *&p, const unsigned char *end, char *&dst, char *dst_end, int &len)
+{
+    if (p >= end)
+        return false;
+    bool huffman = *p & 0x80;
+    int n = 0;
+    if (!read_int(p, end, 7, n) || n > end - p)
+        return false;
+    if (huffman)
+        len = huffman_decode(p, n, dst, dst_end - dst - 1);
+    else
+        len = n < dst_end - dst ? n : -1;
+    if (len < 0)
+        return false;
+    if (!huffman)
+        memcpy(dst, p, n);
+    p += n;
+    dst[len] = '\0';
+    dst += len + 1;
+    return true;
+}
+
+hpack_decoder::hpack_decoder() : m_first(0), m_count(0), m_size(0), m_max(TABLE_SIZE), m_write(0)
+{
+}
+
+void hpack_decoder::copy_out(int off, int len, char *dst)
+{
+    int first = len < TABLE_SIZE - off ? len : TABLE_SIZE - off;
+    memcpy(dst, m_ring + off, first);
+    memcpy(dst + first, m_ring, len - first);
+}
+
+bool hpack_decoder::lookup(int index, char *&dst, char *end, hpack_field *f)
+{
+    //静态表的名字和值直接引用，不拷贝
+    if (index >= 1 && index <= STATIC_NUM)
+    {
+        f->name = static_table[index - 1][0];
+        f->value = static_table[index - 1][1];
+        f->name_len = strlen(f->name);
+        f->value_len = strlen(f->value);
+        return true;
+    }
+    index -= STATIC_NUM + 1;
+    if (index < 0 || index >= m_count)
+        return false;
+    const entry &e = m_entries[(m_first + m_count - 1 - index) % (TABLE_SIZE / 32)];
+    if (e.name_len + e.value_len + 2 > end - dst)
+        return false;
+    copy_out(e.off, e.name_len, dst);
+    dst[e.name_len] = '\0';
+    f->name = dst;
+    f->name_len = e.name_len;
+    dst += e.name_len + 1;
+    copy_out((e.off + e.name_len) % TABLE_SIZE, e.value_len, dst);
+    dst[e.value_len] = '\0';
+    f->value = dst;
+    f->value_len = e.value_len;
+    dst += e.value_len + 1;
+    return true;
+}
+
+void hpack_decoder::evict(int size)
+{
+    while (m_count > 0 && m_size + size > m_max)
+    {
+        const entry &e = m_entries[m_first];
+        m_size -= e.name_len + e.value_len + 32;
+        m_first = (m_first + 1) % (TABLE_SIZE / 32);
+        --m_count;
+    }
+}
+
+//比上限还大的表项不加入，但会清空动态表
+void hpack_decoder::add(const hpack_field *f)
+{
+    int size = f->name_len + f->value_len + 32;
+    evict(size);
+    if (size > m_max)
+        return;
+    entry &e = m_entries[(m_first + m_count) % (TABLE_SIZE / 32)];
+    e.off = m_write;
+    e.name_len = f->name_len;
+    e.value_len = f->value_len;
+    for (int i = 0; i < 2; ++i)
+    {
+        const char *s = i ? f->value : f->name;
+        int len = i ? f->value_len : f->name_len;
+        int first = len < TABLE_SIZE - m_write ? len : TABLE_SIZE - m_write;
+        memcpy(m_ring + m_write, s, first);
+        memcpy(m_ring, s + first, len - first);
+        m_write = (m_write + len) % TABLE_SIZE;
+    }
+    m_size += size;
+    ++m_count;
+}
+
+int hpack_decoder::decode(const unsigned char *p, int len, char *buf, int cap, hpack_field *fields, int max)
+{
+    const unsigned char *end = p + len;
+    char *dst = buf;
+    char *dst_end = buf + cap;
+    int n = 0;
+    while (p < end)
+    {
+        unsigned char b = *p;
+        int index = 0;
+        //动态表大小更新，只能出现在头部块的开头
+        if (0x20 == (b & 0xe0))
+        {
+            if (n > 0 || !read_int(p, end, 5, index) || index > TABLE_SIZE)
+                return -1;
+            m_max = index;
+            evict(0);
+            continue;
+        }
+        if (n >= max)
+            return -1;
+        hpack_field *f = &fields[n];
+        //索引的头部
+        if (b & 0x80)
+        {
+            if (!read_int(p, end, 7, index) || !lookup(index, dst, dst_end, f))
+                return -1;
+            ++n;
+            continue;
+        }
+        //字面值：01加入动态表，0000不加索引，0001永不索引；名字为索引或字面值
+        bool indexing = b & 0x40;
+        if (!read_int(p, end, indexing ? 6 : 4, index))
+            return -1;
+        if (index > 0)
+        {
+            if (!lookup(index, dst, dst_end, f))
+                return -1;
+        }
+        else
+        {
+            f->name = dst;
+            if (!read_string(p, end, dst, dst_end, f->name_len))
+                return -1;
+        }
+        f->value = dst;
+        if (!read_string(p, end, dst, dst_end, f->value_len))
+            return -1;
+        if (indexing)
+            add(f);
+        ++n;
+    }
+    return n;
+}
+
+//prefix位前缀的整数，first为首字节中前缀之外的位
+static int write_int(int v, int prefix, unsigned char first, char *out)
+{
+    int mask = (1 << prefix) - 1;
+    if (v < mask)
+    {
+        out[0] = first | v;
+        return 1;
+    }
+    out[0] = first | mask;
+    int n = 1;
+    for (v -= mask; v >= 0x80; v >>= 7)
+        out[n++] = 0x80 | (v & 0x7f);
+    out[n++] = v;
+    return n;
+}
+
+int hpack_encoder::status(int code, char *out)
+{
+    static const int codes[] = {200, 204, 206, 304, 400, 404, 500};
+    for (int i = 0; i < 7; ++i)
+    {
+        if (codes[i] == code)
+        {
+            out[0] = 0x80 | (8 + i);
+            return 1;
+        }
+    }
+    //其余状态码：名字取:status的索引，值为三位数字
+    char digits[20];
+    int len = http_response::itoa(code, digits);
+    int n = write_int(8, 4, 0, out);
+    n += write_int(len, 7, 0, out + n);
+    memcpy(out + n, digits, len);
+    return n + len;
+}
+
+int hpack_encoder::field(NAME name, const char *value, int len, char *out)
+{
+    int n = write_int(name, 4, 0, out);
+    n += write_int(len, 7, 0, out + n);
+    memcpy(out + n, value, len);
+    return n + len;
+}
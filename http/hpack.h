@@ -0,0 +1,74 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+/*************************************************************
+*HTTP/2的头部压缩(HPACK, RFC 7541)
+*解码支持静态表、动态表和Huffman编码，动态表是固定大小的环形缓冲区，解码时不分配内存
+*Huffman编码是规范编码，只需各符号的码长，解码用的表在编译期生成
+*编码只用于响应头部：名字取静态表的索引，值按不加索引的字面值写出，不维护动态表，也不做Huffman编码
+**************************************************************/
+
+//解码出的一个头部，名字和值都以'\0'结尾
+struct hpack_field
+{
+    const char *name;
+    const char *value;
+    int name_len;
+    int value_len;
+};
+
+class hpack_decoder
+{
+public:
+    //动态表的上限，即SETTINGS_HEADER_TABLE_SIZE的默认值，不向对方公布更大的值
+    static const int TABLE_SIZE = 4096;
+
+    hpack_decoder();
+    //解码一个完整的头部块，名字和值依次拷入buf；返回头部个数，压缩错误或buf、fields放不下时返回-1
+    //出错后动态表与对方不再一致，连接只能关闭
+    int decode(const unsigned char *p, int len, char *buf, int cap, hpack_field *fields, int max);
+
+private:
+    //动态表项在环形缓冲区中的位置，名字和值相接
+    struct entry
+    {
+        int off;
+        int name_len;
+        int value_len;
+    };
+    //索引index(从1开始，静态表之后是动态表)的名字和值拷入dst，返回是否存在
+    bool lookup(int index, char *&dst, char *end, hpack_field *f);
+    void add(const hpack_field *f);
+    //淘汰最旧的表项，直到表大小加上size不超过上限
+    void evict(int size);
+    void copy_out(int off, int len, char *dst);
+
+    char m_ring[TABLE_SIZE];
+    entry m_entries[TABLE_SIZE / 32]; //每项至少占32字节，表项数不超过此数
+    int m_first;    //最旧的表项在m_entries中的位置
+    int m_count;
+    int m_size;     //按RFC计算的表大小，每项为名字、值的长度加32
+    int m_max;      //对方用动态表大小更新指令设置的上限，不超过TABLE_SIZE
+    int m_write;    //环形缓冲区的下一个写入位置
+};
+
+class hpack_encoder
+{
+public:
+    //响应用到的静态表索引
+    enum NAME
+    {
+        CACHE_CONTROL = 24,
+        CONTENT_LENGTH = 28,
+        CONTENT_TYPE = 31,
+        DATE = 33,
+        ETAG = 34,
+        LAST_MODIFIED = 44
+    };
+    //:status，静态表中的状态码只占一个字节；返回写入的字节数
+    static int status(int code, char *out);
+    //静态表第name项的名字加不加索引的字面值，out至少要有len + 8字节
+    static int field(NAME name, const char *value, int len, char *out);
+};
+
+#endif
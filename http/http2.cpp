@@ -0,0 +1,932 @@
+#include "http2.h"
+
+//帧类型
+enum FRAME_TYPE
+{
+    FRAME_DATA = 0,
+    FRAME_HEADERS,
+    FRAME_PRIORITY,
+    FRAME_RST_STREAM,
+    FRAME_SETTINGS,
+    FRAME_PUSH_PROMISE,
+    FRAME_PING,
+    FRAME_GOAWAY,
+    FRAME_WINDOW_UPDATE,
+    FRAME_CONTINUATION
+};
+//帧标志
+enum FRAME_FLAG
+{
+    FLAG_END_STREAM = 0x1,
+    FLAG_ACK = 0x1,
+    FLAG_END_HEADERS = 0x4,
+    FLAG_PADDED = 0x8,
+    FLAG_PRIORITY = 0x20
+};
+//错误码
+enum H2_ERROR
+{
+    H2_NO_ERROR = 0,
+    H2_PROTOCOL_ERROR = 0x1,
+    H2_INTERNAL_ERROR = 0x2,
+    H2_FLOW_CONTROL_ERROR = 0x3,
+    H2_STREAM_CLOSED = 0x5,
+    H2_FRAME_SIZE_ERROR = 0x6,
+    H2_REFUSED_STREAM = 0x7,
+    H2_COMPRESSION_ERROR = 0x9,
+    H2_ENHANCE_YOUR_CALM = 0xb
+};
+//SETTINGS参数
+enum SETTING
+{
+    SETTINGS_ENABLE_PUSH = 0x2,
+    SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+    SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+    SETTINGS_MAX_FRAME_SIZE = 0x5,
+    SETTINGS_MAX_HEADER_LIST_SIZE = 0x6
+};
+
+static const char PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const int PREFACE_LEN = sizeof(PREFACE) - 1;
+//prior knowledge时HTTP/1已解析的第一行
+static const int PREFACE_LINE = 16;
+//流量控制窗口的上限和初始值
+static const long MAX_WINDOW = 0x7fffffff;
+static const long INIT_WINDOW = 65535;
+
+static unsigned get32(const unsigned char *p)
+{
+    return (unsigned)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void put32(char *p, unsigned v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+//HTTP2-Settings头部的base64url解码，可带或不带填充，出错返回-1
+static int base64url_decode(const char *s, unsigned char *out, int cap)
+{
+    int n = 0, bits = 0;
+    unsigned acc = 0;
+    for (; *s && '=' != *s; ++s)
+    {
+        int v;
+        if (*s >= 'A' && *s <= 'Z')
+            v = *s - 'A';
+        else if (*s >= 'a' && *s <= 'z')
+            v = *s - 'a' + 26;
+        else if (*s >= '0' && *s <= '9')
+            v = *s - '0' + 52;
+        else if ('-' == *s || '+' == *s)
+            v = 62;
+        else if ('_' == *s || '/' == *s)
+            v = 63;
+        else
+            return -1;
+        acc = acc << 6 | v;
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            if (n >= cap)
+                return -1;
+            out[n++] = acc >> bits;
+        }
+    }
+    return n;
+}
+
+http2_session::http2_session(http_conn *conn)
+    : m_conn(conn), m_active(0), m_last_id(0), m_headers_id(0), m_next(0), m_window(INIT_WINDOW), m_init_window(INIT_WINDOW),
+      m_frame_size(MAX_FRAME), m_preface(0), m_settings(false), m_cont_id(0), m_cont_end(false), m_goaway(false),
+      m_closing(false), m_full(false), m_upgrade(false), m_block_len(0), m_in_len(0), m_out_len(0), m_covered(0), m_iov_count(0),
+      m_pending(0)
+{
+    memset(m_streams, 0, sizeof(m_streams));
+}
+
+http2_session::~http2_session()
+{
+    for (int i = 0; i < MAX_STREAMS; ++i)
+    {
+        if (m_streams[i].id)
+            close_stream(&m_streams[i]);
+    }
+}
+
+bool http2_session::start(bool upgrade, const char *settings, const char *data, int len)
+{
+    static const char switching[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+    if (upgrade)
+    {
+        memcpy(m_out, switching, sizeof(switching) - 1);
+        m_out_len = sizeof(switching) - 1;
+        m_upgrade = true;
+    }
+    //服务器的前言：公布并发流数和头部列表的上限，其余取默认值
+    char s[12];
+    s[0] = 0;
+    s[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+    put32(s + 2, MAX_STREAMS);
+    s[6] = 0;
+    s[7] = SETTINGS_MAX_HEADER_LIST_SIZE;
+    put32(s + 8, BLOCK_SIZE);
+    frame(FRAME_SETTINGS, 0, 0, s, sizeof(s));
+
+    if (upgrade)
+    {
+        //HTTP2-Settings的内容视同对方发来的SETTINGS帧，不必确认
+        unsigned char payload[64];
+        int n = settings ? base64url_decode(settings, payload, sizeof(payload)) : -1;
+        if (n < 0 || n % 6 || !apply_settings(payload, n))
+            return false;
+        //升级的请求是流1，对方已发完，头部仍在HTTP/1的头部索引中
+        stream *st = new_stream(1);
+        m_last_id = 1;
+        m_headers_id = 1;
+        st->method = m_conn->m_method;
+        if (strlen(m_conn->m_url) >= sizeof(st->path))
+            reply(st, http_conn::NO_RESOURCE);
+        else
+        {
+            strcpy(st->path, m_conn->m_url);
+            st->state = STREAM_BODY;
+            dispatch(st);
+        }
+    }
+    else
+        m_preface = PREFACE_LINE;
+    return read_data(data, len);
+}
+
+bool http2_session::read_data(const char *buf, int len)
+{
+    if (len > IN_SIZE - m_in_len)
+        return false;
+    memcpy(m_in + m_in_len, buf, len);
+    m_in_len += len;
+    m_full = IN_SIZE == m_in_len;
+    return true;
+}
+
+int http2_session::recv_more()
+{
+    int total = 0;
+    m_full = false;
+    while (m_in_len < IN_SIZE)
+    {
+        ssize_t n = recv(m_conn->m_sockfd, m_in + m_in_len, IN_SIZE - m_in_len, MSG_DONTWAIT);
+        if (n > 0)
+        {
+            m_in_len += n;
+            total += n;
+            continue;
+        }
+        if (n < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
+            return total;
+        return -1;
+    }
+    m_full = true;
+    return total;
+}
+
+bool http2_session::read_once()
+{
+    return recv_more() >= 0;
+}
+
+//输入缓冲区读满时处理完其中的帧再接着读，ET模式下不会再有读事件提示剩下的数据
+void http2_session::process()
+{
+    bool ok = parse();
+    while (ok && m_full)
+    {
+        int n = recv_more();
+        if (n < 0)
+        {
+            m_conn->notify(completion_queue::CLOSE);
+            return;
+        }
+        if (0 == n)
+            break;
+        ok = parse();
+    }
+    //平滑升级的排空期间不再接受新的流，已有的流发完后关闭
+    if (http_conn::m_draining && !m_goaway)
+        goaway(H2_NO_ERROR);
+    build_batch();
+    if (m_pending > 0)
+        m_conn->rearm(EPOLLOUT);
+    else if (finished())
+        m_conn->notify(completion_queue::CLOSE);
+    else
+        m_conn->rearm(EPOLLIN);
+}
+
+bool http2_session::parse()
+{
+    int pos = 0;
+    //前言逐字节比较，可能分几次到达
+    if (m_preface < PREFACE_LEN)
+    {
+        int n = m_in_len < PREFACE_LEN - m_preface ? m_in_len : PREFACE_LEN - m_preface;
+        if (memcmp(m_in, PREFACE + m_preface, n) != 0)
+            return goaway(H2_PROTOCOL_ERROR);
+        m_preface += n;
+        pos = n;
+    }
+    bool ok = true;
+    while (ok && PREFACE_LEN == m_preface && m_in_len - pos >= 9)
+    {
+        const unsigned char *h = reinterpret_cast<const unsigned char *>(m_in + pos);
+        int len = h[0] << 16 | h[1] << 8 | h[2];
+        if (len > MAX_FRAME)
+        {
+            ok = goaway(H2_FRAME_SIZE_ERROR);
+            break;
+        }
+        if (m_in_len - pos - 9 < len)
+            break;
+        //前言之后的第一帧必须是SETTINGS
+        if (!m_settings && FRAME_SETTINGS != h[3])
+            ok = goaway(H2_PROTOCOL_ERROR);
+        else
+            ok = on_frame(h[3], h[4], get32(h + 5) & 0x7fffffff, h + 9, len);
+        pos += 9 + len;
+    }
+    memmove(m_in, m_in + pos, m_in_len - pos);
+    m_in_len -= pos;
+    return ok;
+}
+
+bool http2_session::on_frame(int type, int flags, int id, const unsigned char *p, int len)
+{
+    //头部块必须连续，其间不能插入其他帧
+    if ((m_cont_id && (FRAME_CONTINUATION != type || id != m_cont_id)) || (!m_cont_id && FRAME_CONTINUATION == type))
+        return goaway(H2_PROTOCOL_ERROR);
+    switch (type)
+    {
+    case FRAME_DATA:
+        return on_data(flags, id, p, len);
+    case FRAME_HEADERS:
+    case FRAME_CONTINUATION:
+        return on_headers(type, flags, id, p, len);
+    case FRAME_PRIORITY:
+        //不按优先级调度，只检查格式
+        if (0 == id)
+            return goaway(H2_PROTOCOL_ERROR);
+        return 5 == len || reset(id, H2_FRAME_SIZE_ERROR);
+    case FRAME_RST_STREAM:
+    {
+        if (0 == id || id > m_last_id)
+            return goaway(H2_PROTOCOL_ERROR);
+        if (4 != len)
+            return goaway(H2_FRAME_SIZE_ERROR);
+        stream *s = find(id);
+        if (s)
+            close_stream(s);
+        return true;
+    }
+    case FRAME_SETTINGS:
+        return on_settings(flags, id, p, len);
+    case FRAME_PUSH_PROMISE:
+        //客户端不能推送
+        return goaway(H2_PROTOCOL_ERROR);
+    case FRAME_PING:
+        if (0 != id)
+            return goaway(H2_PROTOCOL_ERROR);
+        if (8 != len)
+            return goaway(H2_FRAME_SIZE_ERROR);
+        return (flags & FLAG_ACK) || frame(FRAME_PING, FLAG_ACK, 0, p, 8) || goaway(H2_ENHANCE_YOUR_CALM);
+    case FRAME_GOAWAY:
+        if (0 != id)
+            return goaway(H2_PROTOCOL_ERROR);
+        m_goaway = true;
+        return true;
+    case FRAME_WINDOW_UPDATE:
+        return on_window_update(id, p, len);
+    default:
+        //未知类型的帧忽略
+        return true;
+    }
+}
+
+bool http2_session::on_settings(int flags, int id, const unsigned char *p, int len)
+{
+    if (0 != id)
+        return goaway(H2_PROTOCOL_ERROR);
+    if (flags & FLAG_ACK)
+        return 0 == len || goaway(H2_FRAME_SIZE_ERROR);
+    if (len % 6)
+        return goaway(H2_FRAME_SIZE_ERROR);
+    m_settings = true;
+    return apply_settings(p, len) && (frame(FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0) || goaway(H2_ENHANCE_YOUR_CALM));
+}
+
+//只有初始窗口和帧长影响发送；动态表大小不影响，响应的头部不使用动态表
+bool http2_session::apply_settings(const unsigned char *p, int len)
+{
+    for (int i = 0; i < len; i += 6)
+    {
+        int key = p[i] << 8 | p[i + 1];
+        unsigned value = get32(p + i + 2);
+        switch (key)
+        {
+        case SETTINGS_ENABLE_PUSH:
+            if (value > 1)
+                return goaway(H2_PROTOCOL_ERROR);
+            break;
+        case SETTINGS_INITIAL_WINDOW_SIZE:
+        {
+            //已打开的流的窗口按新旧初始值之差调整，可能变为负数
+            if (value > MAX_WINDOW)
+                return goaway(H2_FLOW_CONTROL_ERROR);
+            long delta = (long)value - m_init_window;
+            for (int k = 0; k < MAX_STREAMS; ++k)
+            {
+                if (m_streams[k].id && (m_streams[k].window += delta) > MAX_WINDOW)
+                    return goaway(H2_FLOW_CONTROL_ERROR);
+            }
+            m_init_window = value;
+            break;
+        }
+        case SETTINGS_MAX_FRAME_SIZE:
+            if (value < MAX_FRAME || value > 0xffffff)
+                return goaway(H2_PROTOCOL_ERROR);
+            m_frame_size = value;
+            break;
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+bool http2_session::on_window_update(int id, const unsigned char *p, int len)
+{
+    if (4 != len)
+        return goaway(H2_FRAME_SIZE_ERROR);
+    long inc = get32(p) & 0x7fffffff;
+    if (0 == id)
+    {
+        if (0 == inc)
+            return goaway(H2_PROTOCOL_ERROR);
+        m_window += inc;
+        return m_window <= MAX_WINDOW || goaway(H2_FLOW_CONTROL_ERROR);
+    }
+    stream *s = find(id);
+    //已关闭的流可能还会收到
+    if (!s)
+        return id <= m_last_id || goaway(H2_PROTOCOL_ERROR);
+    if (0 == inc)
+        return reset(id, H2_PROTOCOL_ERROR);
+    s->window += inc;
+    return s->window <= MAX_WINDOW || reset(id, H2_FLOW_CONTROL_ERROR);
+}
+
+bool http2_session::on_headers(int type, int flags, int id, const unsigned char *p, int len)
+{
+    if (FRAME_HEADERS == type)
+    {
+        //客户端的流为奇数
+        if (0 == id || 0 == (id & 1))
+            return goaway(H2_PROTOCOL_ERROR);
+        int pad = 0;
+        if (flags & FLAG_PADDED)
+        {
+            if (len < 1)
+                return goaway(H2_PROTOCOL_ERROR);
+            pad = p[0];
+            ++p;
+            --len;
+        }
+        //优先级不使用
+        if (flags & FLAG_PRIORITY)
+        {
+            if (len < 5)
+                return goaway(H2_PROTOCOL_ERROR);
+            p += 5;
+            len -= 5;
+        }
+        if (pad > len)
+            return goaway(H2_PROTOCOL_ERROR);
+        len -= pad;
+        m_block_len = 0;
+        m_cont_end = flags & FLAG_END_STREAM;
+    }
+    //头部块压缩后就超过上限，解码后只会更长
+    if (m_block_len + len > BLOCK_SIZE)
+        return goaway(H2_ENHANCE_YOUR_CALM);
+    memcpy(m_block + m_block_len, p, len);
+    m_block_len += len;
+    if (!(flags & FLAG_END_HEADERS))
+    {
+        m_cont_id = id;
+        return true;
+    }
+    m_cont_id = 0;
+    return on_request(id, m_cont_end);
+}
+
+bool http2_session::on_request(int id, bool end_stream)
+{
+    //拒绝的流的头部块也要解码，动态表才能与对方保持一致
+    int n = m_decoder.decode(reinterpret_cast<const unsigned char *>(m_block), m_block_len, m_decoded, BLOCK_SIZE,
+                             m_fields, header_index::MAX_HEADERS);
+    if (n < 0)
+        return goaway(H2_COMPRESSION_ERROR);
+    m_headers_id = 0;
+    stream *s = find(id);
+    if (s)
+    {
+        //消息体之后的尾部头部，忽略其内容
+        if (STREAM_BODY != s->state || !end_stream)
+            return reset(id, H2_PROTOCOL_ERROR);
+        return dispatch(s);
+    }
+    if (id <= m_last_id)
+        return goaway(H2_STREAM_CLOSED);
+    m_last_id = id;
+    //已通知对方不再接受新的流
+    if (m_goaway)
+        return true;
+    s = new_stream(id);
+    if (!s)
+        return reset(id, H2_REFUSED_STREAM);
+
+    //伪头部取出方法和路径，其余头部记入http_conn的头部索引，:authority作为Host
+    const char *method = NULL;
+    const char *path = NULL;
+    const hpack_field *authority = NULL;
+    header_index *h = m_conn->h2_headers();
+    for (int i = 0; i < n; ++i)
+    {
+        const hpack_field *f = &m_fields[i];
+        if (':' != f->name[0])
+        {
+            if (!h->add(f->name, f->name_len, f->value, f->value_len))
+                return reset(id, H2_PROTOCOL_ERROR);
+        }
+        else if (0 == strcmp(f->name, ":method"))
+            method = f->value;
+        else if (0 == strcmp(f->name, ":path"))
+            path = f->value;
+        else if (0 == strcmp(f->name, ":authority"))
+            authority = f;
+    }
+    if (!method || !path)
+        return reset(id, H2_PROTOCOL_ERROR);
+    if (authority && !h->get(HDR_HOST))
+        h->add("host", 4, authority->value, authority->value_len);
+    m_headers_id = id;
+
+    //HEAD按GET处理，只是不发内容；不支持的方法返回400
+    s->head = 0 == strcmp(method, "HEAD");
+    if (0 == strcmp(method, "GET") || s->head)
+        s->method = http_conn::GET;
+    else if (0 == strcmp(method, "POST"))
+        s->method = http_conn::POST;
+    else if (0 == strcmp(method, "PUT"))
+        s->method = http_conn::PUT;
+    else
+    {
+        reply(s, http_conn::BAD_REQUEST);
+        return true;
+    }
+    if ('/' != path[0] || strlen(path) >= sizeof(s->path))
+    {
+        reply(s, http_conn::NO_RESOURCE);
+        return true;
+    }
+    strcpy(s->path, path);
+    const route *r = http_router::match(s->path, strlen(s->path), 1u << s->method);
+    s->keep = r && r->read_body;
+    s->limit = r && r->body_limit > 0 ? r->body_limit : http_conn::m_max_body;
+    s->state = STREAM_BODY;
+    return !end_stream || dispatch(s);
+}
+
+bool http2_session::on_data(int flags, int id, const unsigned char *p, int len)
+{
+    if (0 == id)
+        return goaway(H2_PROTOCOL_ERROR);
+    int total = len;
+    if (flags & FLAG_PADDED)
+    {
+        if (len < 1 || p[0] >= len)
+            return goaway(H2_PROTOCOL_ERROR);
+        len -= 1 + p[0];
+        ++p;
+    }
+    //连接的接收窗口按帧长(含填充)归还
+    if (total > 0 && !window_update(0, total))
+        return goaway(H2_ENHANCE_YOUR_CALM);
+    stream *s = find(id);
+    if (!s)
+        return id <= m_last_id ? reset(id, H2_STREAM_CLOSED) : goaway(H2_PROTOCOL_ERROR);
+    //请求出错时收完头部就已响应，其后的消息体丢弃
+    if (STREAM_BODY != s->state)
+        return true;
+    //处理函数读取的消息体按段保存，其余只计数，超过路由的上限时返回400
+    if (s->keep && s->body_len + len <= s->limit)
+        save_body(s, p, len);
+    s->body_len += len;
+    if (flags & FLAG_END_STREAM)
+        return dispatch(s);
+    return 0 == total || window_update(id, total) || goaway(H2_ENHANCE_YOUR_CALM);
+}
+
+void http2_session::save_body(stream *s, const unsigned char *p, int len)
+{
+    while (len > 0)
+    {
+        http_conn::read_seg *t = s->body_tail;
+        if (!t || t->end == t->size)
+        {
+            http_conn::read_seg *seg = http_conn::get_read_seg(http_conn::READ_BUFFER_SIZE);
+            seg->prev = t;
+            if (t)
+                t->next = seg;
+            else
+                s->body = seg;
+            s->body_tail = t = seg;
+        }
+        int n = len < t->size - t->end ? len : t->size - t->end;
+        memcpy(t->buf + t->end, p, n);
+        t->end += n;
+        p += n;
+        len -= n;
+    }
+}
+
+void http2_session::release_body(stream *s)
+{
+    while (s->body)
+    {
+        http_conn::read_seg *next = s->body->next;
+        http_conn::put_read_seg(s->body);
+        s->body = next;
+    }
+    s->body_tail = NULL;
+}
+
+bool http2_session::dispatch(stream *s)
+{
+    int ret = http_conn::BAD_REQUEST;
+    if (s->body_len <= s->limit)
+    {
+        //等待消息体期间头部索引可能已被其他流覆盖，这样的请求只用路径和消息体
+        if (m_headers_id != s->id)
+            m_conn->h2_headers();
+        ret = m_conn->h2_request(s->method, s->path, s->body, s->body_len, s->file);
+    }
+    release_body(s);
+    reply(s, ret);
+    return true;
+}
+
+void http2_session::reply(stream *s, int ret)
+{
+    s->state = STREAM_REPLY;
+    s->headers_sent = false;
+    s->data = NULL;
+    s->left = 0;
+    s->length = -1;
+    switch (ret)
+    {
+    case http_conn::FILE_REQUEST:
+        s->status = 200;
+        s->data = s->file->addr;
+        s->length = s->file->st.st_size;
+        break;
+    case http_conn::NOT_MODIFIED:
+        s->status = 304;
+        break;
+    default:
+    {
+        //错误响应的内容是预生成的静态文本
+        s->status = http_conn::BAD_REQUEST == ret ? 400 : http_conn::NO_RESOURCE == ret ? 404 :
+                    http_conn::FORBIDDEN_REQUEST == ret ? 403 : 500;
+        const http_status *st = http_response::status(s->status);
+        s->data = st->body;
+        s->length = st->body_len;
+        if (s->file)
+        {
+            file_cache::get_instance()->release(s->file);
+            s->file = NULL;
+        }
+        break;
+    }
+    }
+    if (!s->head && s->length > 0)
+        s->left = s->length;
+}
+
+http2_session::stream *http2_session::find(int id)
+{
+    for (int i = 0; i < MAX_STREAMS; ++i)
+    {
+        if (id == m_streams[i].id)
+            return &m_streams[i];
+    }
+    return NULL;
+}
+
+http2_session::stream *http2_session::new_stream(int id)
+{
+    for (int i = 0; i < MAX_STREAMS; ++i)
+    {
+        stream *s = &m_streams[i];
+        if (0 == s->id)
+        {
+            s->id = id;
+            s->state = STREAM_BODY;
+            s->window = m_init_window;
+            s->body_len = 0;
+            s->head = false;
+            s->keep = false;
+            s->limit = http_conn::m_max_body;
+            ++m_active;
+            return s;
+        }
+    }
+    return NULL;
+}
+
+void http2_session::close_stream(stream *s)
+{
+    if (s->file)
+        file_cache::get_instance()->release(s->file);
+    release_body(s);
+    memset(s, 0, sizeof(*s));
+    --m_active;
+}
+
+bool http2_session::reset(int id, int error)
+{
+    stream *s = find(id);
+    if (s)
+        close_stream(s);
+    char payload[4];
+    put32(payload, error);
+    return frame(FRAME_RST_STREAM, 0, id, payload, 4) || goaway(H2_ENHANCE_YOUR_CALM);
+}
+
+bool http2_session::goaway(int error)
+{
+    if (m_closing)
+        return false;
+    m_goaway = true;
+    if (H2_NO_ERROR != error)
+        m_closing = true;
+    char payload[8];
+    put32(payload, m_last_id);
+    put32(payload + 4, error);
+    frame(FRAME_GOAWAY, 0, 0, payload, 8);
+    return H2_NO_ERROR == error;
+}
+
+void http2_session::frame_header(char *out, int len, int type, int flags, int id)
+{
+    out[0] = len >> 16;
+    out[1] = len >> 8;
+    out[2] = len;
+    out[3] = type;
+    out[4] = flags;
+    put32(out + 5, id);
+}
+
+bool http2_session::frame(int type, int flags, int id, const void *payload, int len)
+{
+    if (m_out_len + 9 + len > OUT_SIZE)
+        return false;
+    frame_header(m_out + m_out_len, len, type, flags, id);
+    if (len > 0)
+        memcpy(m_out + m_out_len + 9, payload, len);
+    m_out_len += 9 + len;
+    return true;
+}
+
+bool http2_session::window_update(int id, int inc)
+{
+    char payload[4];
+    put32(payload, inc);
+    return frame(FRAME_WINDOW_UPDATE, 0, id, payload, 4);
+}
+
+//:status、Date和内容相关的头部，文件响应另有ETag、Last-Modified和Cache-Control
+bool http2_session::send_headers(stream *s)
+{
+    const file_entry *f = s->file;
+    const char *type = f ? http_response::content_type(f->path.c_str()) : "text/plain";
+    const char *cc = f ? http_conn::cache_control(f->path.c_str()) : NULL;
+    int need = 9 + 8 + http_response::DATE_LEN + 8 + strlen(type) + 8 + 20;
+    if (f)
+        need += 8 + strlen(f->etag) + 8 + strlen(f->last_modified) + (cc ? 8 + strlen(cc) : 0);
+    if (m_out_len + need > OUT_SIZE || m_iov_count + 1 > MAX_IOV)
+        return false;
+
+    char *out = m_out + m_out_len;
+    char *p = out + 9;
+    p += hpack_encoder::status(s->status, p);
+    //Date头部去掉"Date:"和结尾的\r\n
+    p += hpack_encoder::field(hpack_encoder::DATE, http_response::date() + 5, http_response::DATE_LEN - 7, p);
+    if (f)
+    {
+        p += hpack_encoder::field(hpack_encoder::ETAG, f->etag, strlen(f->etag), p);
+        p += hpack_encoder::field(hpack_encoder::LAST_MODIFIED, f->last_modified, strlen(f->last_modified), p);
+        if (cc)
+            p += hpack_encoder::field(hpack_encoder::CACHE_CONTROL, cc, strlen(cc), p);
+    }
+    if (s->length >= 0)
+    {
+        char digits[20];
+        int len = http_response::itoa(s->length, digits);
+        p += hpack_encoder::field(hpack_encoder::CONTENT_TYPE, type, strlen(type), p);
+        p += hpack_encoder::field(hpack_encoder::CONTENT_LENGTH, digits, len, p);
+    }
+    frame_header(out, p - out - 9, FRAME_HEADERS, FLAG_END_HEADERS | (s->left > 0 ? 0 : FLAG_END_STREAM), s->id);
+    m_out_len = p - m_out;
+    s->headers_sent = true;
+    if (0 == s->left)
+        s->state = STREAM_DONE;
+    return true;
+}
+
+void http2_session::flush_out()
+{
+    if (m_out_len > m_covered)
+    {
+        int len = m_out_len - m_covered;
+        m_covered = m_out_len;
+        queue(m_out + m_covered - len, len);
+    }
+}
+
+void http2_session::queue(const char *base, long len)
+{
+    m_pending += len;
+    struct iovec *last = m_iov_count > 0 ? &m_iov[m_iov_count - 1] : NULL;
+    if (last && (char *)last->iov_base + last->iov_len == base)
+    {
+        last->iov_len += len;
+        return;
+    }
+    m_iov[m_iov_count].iov_base = (void *)base;
+    m_iov[m_iov_count].iov_len = len;
+    ++m_iov_count;
+}
+
+void http2_session::build_batch()
+{
+    m_iov_count = 0;
+    m_covered = 0;
+    m_pending = 0;
+    long budget = BATCH_BYTES;
+    bool progress = !m_closing && !m_upgrade;
+    m_upgrade = false;
+    while (progress && budget > 0)
+    {
+        progress = false;
+        for (int k = 0; k < MAX_STREAMS && budget > 0; ++k)
+        {
+            stream *s = &m_streams[(m_next + k) % MAX_STREAMS];
+            if (STREAM_REPLY != s->state)
+                continue;
+            if (!s->headers_sent)
+            {
+                if (!send_headers(s))
+                    budget = 0;
+                progress = true;
+                continue;
+            }
+            long n = s->left;
+            if (n > s->window)
+                n = s->window;
+            if (n > m_window)
+                n = m_window;
+            if (n > m_frame_size)
+                n = m_frame_size;
+            if (n > budget)
+                n = budget;
+            if (n <= 0)
+                continue;
+            //帧头在输出缓冲区中，内容另占一个iovec
+            if (m_out_len + 9 > OUT_SIZE || m_iov_count + 2 > MAX_IOV)
+            {
+                budget = 0;
+                break;
+            }
+            bool last = n == s->left;
+            frame_header(m_out + m_out_len, n, FRAME_DATA, last ? FLAG_END_STREAM : 0, s->id);
+            m_out_len += 9;
+            flush_out();
+            queue(s->data, n);
+            s->data += n;
+            s->left -= n;
+            s->window -= n;
+            m_window -= n;
+            budget -= n;
+            if (last)
+                s->state = STREAM_DONE;
+            progress = true;
+        }
+        m_next = (m_next + 1) % MAX_STREAMS;
+    }
+    flush_out();
+}
+
+void http2_session::advance(long n)
+{
+    m_pending -= n;
+    for (int i = 0; i < m_iov_count && n > 0; ++i)
+    {
+        if ((size_t)n >= m_iov[i].iov_len)
+        {
+            n -= m_iov[i].iov_len;
+            m_iov[i].iov_len = 0;
+        }
+        else
+        {
+            m_iov[i].iov_base = (char *)m_iov[i].iov_base + n;
+            m_iov[i].iov_len -= n;
+            n = 0;
+        }
+    }
+}
+
+int http2_session::finish_batch()
+{
+    for (int i = 0; i < MAX_STREAMS; ++i)
+    {
+        if (STREAM_DONE == m_streams[i].state)
+            close_stream(&m_streams[i]);
+    }
+    m_out_len = 0;
+    m_covered = 0;
+    m_iov_count = 0;
+    if (finished())
+        return -1;
+    int n = recv_more();
+    if (n < 0)
+        return -1;
+    if (n > 0)
+        return 2;
+    build_batch();
+    return m_pending > 0 ? 1 : 0;
+}
+
+int http2_session::write()
+{
+    long sent = 0;
+    while (m_pending > 0)
+    {
+        //发满配额后让出，一次writev不截断，最多超出一批(128KB)
+        if (http_conn::m_write_quantum > 0 && sent >= http_conn::m_write_quantum)
+        {
+            m_conn->rearm(EPOLLOUT);
+            return 1;
+        }
+        ssize_t n = writev(m_conn->m_sockfd, m_iov, m_iov_count);
+        if (n < 0)
+        {
+            if (EAGAIN == errno)
+            {
+                m_conn->rearm(EPOLLOUT);
+                return 1;
+            }
+            return 0;
+        }
+        advance(n);
+        sent += n;
+        if (m_pending > 0)
+            continue;
+        int ret = finish_batch();
+        if (ret < 0)
+            return 0;
+        if (2 == ret)
+            return 2;
+    }
+    m_conn->rearm(EPOLLIN);
+    return 1;
+}
+
+struct msghdr *http2_session::get_msghdr()
+{
+    memset(&m_msg, 0, sizeof(m_msg));
+    m_msg.msg_iov = m_iov;
+    m_msg.msg_iovlen = m_iov_count;
+    return &m_msg;
+}
+
+int http2_session::after_send(int n)
+{
+    advance(n);
+    if (m_pending > 0)
+        return 1;
+    return finish_batch();
+}
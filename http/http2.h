@@ -0,0 +1,153 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+/*************************************************************
+*HTTP/2明文连接(h2c)
+*连接以前言开头(prior knowledge)或HTTP/1.1请求带Upgrade: h2c时转为HTTP/2，此后由http2_session收发帧
+*每个流的请求仍交给http_conn::do_request，静态文件、登录和注册与HTTP/1共用同一套处理
+*多个流的DATA帧轮流发送，受连接和流两级流量控制约束，内容直接指向文件缓存中的映射，不拷贝
+*与HTTP/1一样收发交替：读到的帧处理完后生成一批帧发送，一批发完先非阻塞地读对方新发来的帧，再生成下一批；
+*一批的DATA字节数有上限，大文件不会让之后到达的请求久等
+**************************************************************/
+
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include "hpack.h"
+#include "http_conn.h"
+
+class http2_session
+{
+public:
+    static const int MAX_STREAMS = 32;          //同时处理的流数，即公布的SETTINGS_MAX_CONCURRENT_STREAMS
+    static const int MAX_FRAME = 16384;         //接收的帧长上限，即SETTINGS_MAX_FRAME_SIZE的默认值
+    static const int IN_SIZE = MAX_FRAME + 9;   //输入缓冲区正好放下一个最长的帧
+    static const int OUT_SIZE = 16384;          //控制帧、HEADERS帧和DATA帧头，DATA的内容不拷贝
+    static const int BLOCK_SIZE = 8192;         //头部块压缩后和解码后的上限，即公布的SETTINGS_MAX_HEADER_LIST_SIZE
+    static const int BATCH_BYTES = 128 * 1024;  //一批最多发送的DATA字节数
+    static const int MAX_IOV = 64;
+
+    explicit http2_session(http_conn *conn);
+    ~http2_session();
+
+    //进入HTTP/2：upgrade为false时前言的第一行已由HTTP/1解析；否则先发101，当前的HTTP/1请求作为流1响应，
+    //settings为HTTP2-Settings头部；data为HTTP/1读缓冲区中其后已到达的字节
+    bool start(bool upgrade, const char *settings, const char *data, int len);
+
+    /*以下与http_conn的同名函数对应，连接进入HTTP/2后由其转调*/
+    bool read_once();
+    int prepare_read() { return IN_SIZE - m_in_len; }
+    bool read_data(const char *buf, int len);
+    void process();
+    int write();
+    struct msghdr *get_msghdr();
+    int after_send(int n);
+
+private:
+    enum STREAM_STATE
+    {
+        STREAM_IDLE = 0,    //空闲的槽
+        STREAM_BODY,        //头部已收到，等待消息体
+        STREAM_REPLY,       //响应尚未全部进入待发送的一批
+        STREAM_DONE         //最后一帧已在本批中，本批发完后释放
+    };
+    struct stream
+    {
+        int id;
+        STREAM_STATE state;
+        http_conn::METHOD method;
+        bool head;          //HEAD请求只发头部
+        bool keep;          //路由的处理函数读取消息体，需要保存
+        bool headers_sent;
+        int status;
+        long window;        //发送窗口
+        long length;        //Content-Length，304没有
+        file_entry *file;   //响应的文件，发完前一直持有引用
+        const char *data;   //待发送的内容：文件映射或预生成的错误内容
+        long left;
+        http_conn::read_seg *body;  //需要保存的消息体存放在从读缓冲池借用的段中，由next串起
+        http_conn::read_seg *body_tail;
+        long body_len;      //已收到的消息体长度，不保存的只计数
+        long limit;         //路由允许的消息体上限
+        char path[http_conn::FILENAME_LEN];
+    };
+
+    /*解析收到的帧，出错时发出GOAWAY并返回false*/
+    bool parse();
+    bool on_frame(int type, int flags, int id, const unsigned char *p, int len);
+    bool on_settings(int flags, int id, const unsigned char *p, int len);
+    bool apply_settings(const unsigned char *p, int len);
+    bool on_window_update(int id, const unsigned char *p, int len);
+    bool on_headers(int type, int flags, int id, const unsigned char *p, int len);
+    bool on_data(int flags, int id, const unsigned char *p, int len);
+    //一个完整的头部块：新的请求或消息体之后的尾部头部
+    bool on_request(int id, bool end_stream);
+    //请求收完，交给http_conn处理，按结果准备响应
+    bool dispatch(stream *s);
+    //把一帧的消息体追加到流的读缓冲段，当前段满时再借一段
+    void save_body(stream *s, const unsigned char *p, int len);
+    void release_body(stream *s);
+    void reply(stream *s, int ret);
+
+    stream *find(int id);
+    stream *new_stream(int id);
+    void close_stream(stream *s);
+    //流错误：发出RST_STREAM并关闭流
+    bool reset(int id, int error);
+    //连接错误：发出GOAWAY，本批发完后关闭连接；NO_ERROR只是不再接受新的流
+    bool goaway(int error);
+
+    /*生成和发送*/
+    //控制帧追加到输出缓冲区，放不下时返回false
+    bool frame(int type, int flags, int id, const void *payload, int len);
+    void frame_header(char *out, int len, int type, int flags, int id);
+    bool window_update(int id, int inc);
+    bool send_headers(stream *s);
+    //各流轮流取一帧，直到一批的字节数、iovec或输出缓冲区用完，或都被流量控制挡住
+    void build_batch();
+    //输出缓冲区中尚未加入iovec的部分加入iovec
+    void flush_out();
+    void queue(const char *base, long len);
+    void advance(long n);
+    //一批发完：1又生成了一批，2读到了新的帧需要process，0没有可发的，-1需要关闭连接
+    int finish_batch();
+    //非阻塞地读入对方已发来的字节，返回读到的字节数，对方关闭或出错返回-1
+    int recv_more();
+    bool finished() const { return m_closing || (m_goaway && 0 == m_active); }
+
+    http_conn *m_conn;
+    hpack_decoder m_decoder;
+    stream m_streams[MAX_STREAMS];
+    int m_active;       //使用中的流数
+    int m_last_id;      //对方最后打开的流
+    int m_headers_id;   //http_conn的头部索引中是哪个流的头部
+    int m_next;         //轮流发送的起点
+    long m_window;      //连接的发送窗口
+    long m_init_window; //对方的SETTINGS_INITIAL_WINDOW_SIZE
+    int m_frame_size;   //对方的SETTINGS_MAX_FRAME_SIZE
+    int m_preface;      //前言中已收到的字节数
+    bool m_settings;    //已收到对方的第一个SETTINGS帧
+    int m_cont_id;      //头部块未结束、等待CONTINUATION的流，0为没有
+    bool m_cont_end;    //该头部块的HEADERS帧带END_STREAM
+    bool m_goaway;      //已收到或发出GOAWAY，不再接受新的流
+    bool m_closing;     //连接错误，本批发完后关闭
+    bool m_full;        //上次读满了输入缓冲区，其后可能还有数据
+    bool m_upgrade;     //101和SETTINGS单独作为第一批，有的客户端不能在101的同一次读取中收下更多数据
+
+    int m_block_len;
+    char m_block[BLOCK_SIZE];
+    char m_decoded[BLOCK_SIZE];
+    hpack_field m_fields[header_index::MAX_HEADERS];
+
+    int m_in_len;
+    char m_in[IN_SIZE];
+    //输出缓冲区中m_covered之前的字节已加入本批的iovec
+    int m_out_len;
+    int m_covered;
+    char m_out[OUT_SIZE];
+    struct iovec m_iov[MAX_IOV];
+    int m_iov_count;
+    long m_pending;     //本批尚未发出的字节数
+    struct msghdr m_msg;
+};
+
+#endif
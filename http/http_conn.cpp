@@ -1,25 +1,25 @@
 #include "http_conn.h"
+#include "http2.h"
 
 #include <mysql/mysql.h>
 #include <fstream>
 
-//定义http响应的一些状态信息
-const char *ok_200_title = "OK";
-const char *error_400_title = "Bad Request";
-const char *error_400_form = "Your request has bad syntax or is inherently impossible to staisfy.\n";
-const char *error_403_title = "Forbidden";
-const char *error_403_form = "You do not have permission to get file form this server.\n";
-const char *error_404_title = "Not Found";
-const char *error_404_form = "The requested file was not found on this server.\n";
-const char *error_500_title = "Internal Error";
-const char *error_500_form = "There was an unusual problem serving the request file.\n";
-
 locker m_lock;
 map<string, string> users;//用户名和密码
+vector<pair<string, string> > cache_policy;//扩展名和对应的Cache-Control
+//长连接的Keep-Alive头部，max另按剩余请求数追加
+char keep_alive_head[64] = "Keep-Alive:timeout=15";
+int keep_alive_len = strlen(keep_alive_head);
+int keep_alive_max = 0;
+//上传目录和单个上传的长度上限，见set_upload
+string upload_dir;
+long upload_limit = 0;
 
 //初始化数据库连接
-void http_conn::initmysql_result(connection_pool *connPool)
+void http_conn::initmysql_result(connection_pool *connPool, int close_log)
 {
+    int m_close_log = close_log;//供LOG宏使用
+
     //先从连接池中取一个连接
     MYSQL *mysql = NULL;
     connectionRAII mysqlcon(&mysql, connPool);
@@ -58,6 +58,7 @@ int setnonblocking(int fd)
 }
 
 //将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
+//连接由accept4直接创建为非阻塞，这里不再fcntl
 void addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
 {
     epoll_event event;
@@ -71,7 +72,6 @@ void addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
     if (one_shot)//若是ET触发
         event.events |= EPOLLONESHOT;
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    setnonblocking(fd);
 }
 
 //从内核时间表删除描述符
@@ -96,8 +96,14 @@ void modfd(int epollfd, int fd, int ev, int TRIGMode)
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
-int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
+std::atomic<int> http_conn::m_user_count(0);
+std::atomic<bool> http_conn::m_draining(false);
+int http_conn::m_max_head = 8 * 1024;
+int http_conn::m_max_body = 1024 * 1024;
+bool http_conn::m_sendfile = false;
+bool http_conn::m_autoindex = false;
+bool http_conn::m_http2 = false;
+int http_conn::m_write_quantum = 0;
 
 //关闭连接，关闭一个连接，客户总量减一
 void http_conn::close_conn(bool real_close)
@@ -111,27 +117,62 @@ void http_conn::close_conn(bool real_close)
     }
 }
 
+//先取出通知所需的字段：计数减到0后反应堆可能立即释放本对象
+void http_conn::leave_worker()
+{
+    completion_queue *cq = m_cq;
+    int sockfd = m_sockfd;
+    unsigned int gen = m_timer_data.gen;
+    if (m_timer_data.inflight.fetch_sub(1) == (CLOSED_BIT | 1))
+        cq->push(sockfd, gen, completion_queue::CLOSE);
+}
+
+bool http_conn::defer_close()
+{
+    int v = m_timer_data.inflight.load();
+    while (v & ~CLOSED_BIT)
+    {
+        if (m_timer_data.inflight.compare_exchange_weak(v, v | CLOSED_BIT))
+            return true;
+    }
+    return false;
+}
+
 //初始化连接,外部调用初始化套接字地址
-void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMode,
-                     int close_log, string user, string passwd, string sqlname)
+void http_conn::init(int sockfd, const sockaddr_in &addr, int epollfd, completion_queue *cq, char *root, int TRIGMode,
+                     int close_log)
 {
     m_sockfd = sockfd;
     m_address = addr;
+    m_epollfd = epollfd;
+    m_cq = cq;
+    m_TRIGMode = TRIGMode;
+
+    //流水线上的响应超过写缓冲区时分几次writev发出，Nagle会让后面不满一个段的部分等待对方的延迟确认(约40ms)
+    //报文头与sendfile的文件开头仍由MSG_MORE合并
+    int one = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 
     //把新来的连接套接字加入到epoll内核事件表，True：一个连接生命周期由一个线程处理 ，m_TRIGMode表示触发方式，默认LT
-    addfd(m_epollfd, sockfd, true, m_TRIGMode);
+    //io_uring模式没有epoll内核事件表，连接由accept直接设为非阻塞
+    if (m_epollfd >= 0)
+        addfd(m_epollfd, sockfd, true, m_TRIGMode);
     m_user_count++;
 
     //当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
     doc_root = root;
-    m_TRIGMode = TRIGMode;
     m_close_log = close_log;
 
-    strcpy(sql_user, user.c_str());
-    strcpy(sql_passwd, passwd.c_str());
-    strcpy(sql_name, sqlname.c_str());
-
     init();
+    //TLS连接在此创建SSL对象，握手在第一次可读时由工作线程进行
+    if (tls_context::get_instance()->enabled())
+    {
+        SSL *ssl = tls_context::get_instance()->accept(sockfd);
+        if (ssl)
+            aux()->ssl = ssl;
+        else
+            LOG_ERROR("%s", "tls: SSL_new failure");
+    }
 }
 
 //初始化新接受的连接
@@ -142,87 +183,364 @@ void http_conn::init()
     mysql = NULL;
     bytes_to_send = 0;
     bytes_have_send = 0;
+    m_read_idx = 0;
+    m_write_idx = 0;
+    m_iv_count = 0;
+    m_resp_linger = false;
+    m_http11 = false;
+    m_stream = false;
+    m_state = 0;
+    m_requests = 0;
+    reset_request();
+
+    //上一个请求的文件引用在发送完时已释放，这里兜底
+    unmap();
+    //连接转为空闲，读写缓冲区还给缓冲池，下次收到数据再借
+    release_buffers();
+}
+
+void http_conn::reset_request()
+{
+    //上传出错时请求以错误响应结束，临时文件删除
+    if (uploading())
+        end_upload(false);
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
     m_method = GET;
     m_url = 0;
-    m_version = 0;
     m_content_length = 0;
-    m_host = 0;
+    if (m_headers)
+        m_headers->clear();
     m_start_line = 0;
     m_checked_idx = 0;
-    m_read_idx = 0;
+    m_body = NULL;
+    m_head_len = 0;
+    m_body_read = 0;
+    m_chunk_state = CHUNK_NONE;
+    m_chunk_left = 0;
+    m_route = NULL;
+}
+
+//请求在当前段中结束于m_checked_idx之后尚未计入的消息体末尾，其后是流水线上下一个请求已到达的部分
+//块编码的消息体已解码到m_checked_idx为止
+//较早的段只存放已处理完的请求，一并归还
+void http_conn::finish_request()
+{
+    int end = CHUNK_NONE != m_chunk_state ? m_checked_idx : m_checked_idx + m_content_length - m_body_read;
+    int left = end < m_read_idx ? m_read_idx - end : 0;
+    if (left > 0)
+        memmove(m_read_buf, m_read_buf + end, left);
+    m_read_idx = left;
+    if (m_read_seg)
+    {
+        m_read_buf[m_read_idx] = '\0';
+        read_seg *prev = m_read_seg->prev;
+        m_read_seg->prev = NULL;
+        while (prev)
+        {
+            read_seg *seg = prev;
+            prev = seg->prev;
+            put_read_seg(seg);
+        }
+    }
+    reset_request();
+}
+
+//写缓冲区留出一个响应头的空间，iovec留出一个多区间响应的空间
+bool http_conn::can_batch()
+{
+    int files = m_batch ? m_batch->nfiles : 0;
+    return m_resp_linger && !m_stream && m_read_idx > 0 && m_file_fd < 0 && files + 1 < PIPELINE_DEPTH &&
+           m_iv_count + 2 * MAX_RANGES + 1 <= 2 * PIPELINE_DEPTH + 2 * MAX_RANGES + 1 &&
+           m_write_idx + WRITE_BUFFER_SIZE / 2 <= WRITE_BUFFER_SIZE;
+}
+
+void http_conn::stash_file()
+{
+    if (!m_file)
+        return;
+    use_batch();
+    m_batch->files[m_batch->nfiles++] = m_file;
+    m_file = NULL;
+    m_file_address = 0;
+}
+
+void http_conn::use_batch()
+{
+    if (m_batch)
+        return;
+    m_batch = reinterpret_cast<resp_batch *>(batch_pool::get());
+    m_batch->nfiles = 0;
+    memcpy(m_batch->iov, m_iv, m_iv_count * sizeof(struct iovec));
+}
+
+void http_conn::finish_write()
+{
+    unmap();
+    bytes_to_send = 0;
+    bytes_have_send = 0;
     m_write_idx = 0;
-    cgi = 0;
-    m_state = 0;
-    timer_flag = 0;
-    improv = 0;
+    if (m_write_buf)
+    {
+        write_pool::put(m_write_buf);
+        m_write_buf = NULL;
+    }
+    //没有流水线上的后续数据，连接转为空闲，读缓冲区和头部索引也归还
+    if (0 == m_read_idx)
+    {
+        release_read_segs();
+        release_headers();
+    }
+}
+
+void http_conn::release_headers()
+{
+    if (m_headers)
+    {
+        header_pool::put(reinterpret_cast<char *>(m_headers));
+        m_headers = NULL;
+    }
+}
 
-    //初始化读缓冲区、写缓冲区、文件读缓冲区
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
-    memset(m_real_file, '\0', FILENAME_LEN);
+//连接关闭时未完成的上传一并放弃，HTTP/2的会话及其中各流持有的文件引用一并释放
+void http_conn::release_buffers()
+{
+    if (uploading())
+        end_upload(false);
+    if (http2())
+    {
+        delete m_aux->h2;
+        m_aux->h2 = NULL;
+        release_aux();
+    }
+    if (tls())
+    {
+        tls_context::release(m_aux->ssl);
+        m_aux->ssl = NULL;
+        release_aux();
+    }
+    release_read_segs();
+    release_headers();
+    if (m_write_buf)
+    {
+        write_pool::put(m_write_buf);
+        m_write_buf = NULL;
+    }
 }
 
 //从状态机，用于分析出一行内容
 //返回值为行的读取状态，有LINE_OK,LINE_BAD,LINE_OPEN
 /*m_checked_idx表示读缓冲区正在分析的字节，m_read_idx指向缓冲区尾部的下一个字节，其中0～m_checked_idx的字节已分析完毕，第
-m_checked_idx～（m_read_idx-1）有下面逐个分析*/
+m_checked_idx～（m_read_idx-1）由http_scan成组查找第一个\r或\n，其前的字节不再逐个分析*/
 http_conn::LINE_STATUS http_conn::parse_line()
 {
-    char temp;
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx)
+    m_checked_idx = http_scan::find2(m_read_buf + m_checked_idx, m_read_buf + m_read_idx, '\r', '\n') - m_read_buf;
+    if (m_checked_idx == m_read_idx)
+        return LINE_OPEN;
+
+    char temp = m_read_buf[m_checked_idx];
+    if (temp == '\r')
     {
-        temp = m_read_buf[m_checked_idx];
-        if (temp == '\r')
+        if ((m_checked_idx + 1) == m_read_idx)
+            return LINE_OPEN;
+        else if (m_read_buf[m_checked_idx + 1] == '\n')
         {
-            if ((m_checked_idx + 1) == m_read_idx)
-                return LINE_OPEN;
-            else if (m_read_buf[m_checked_idx + 1] == '\n')
-            {
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
+            m_read_buf[m_checked_idx++] = '\0';
+            m_read_buf[m_checked_idx++] = '\0';
+            return LINE_OK;
+        }
+        return LINE_BAD;
+    }
+    //temp为'\n'
+    if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r')
+    {
+        m_read_buf[m_checked_idx - 1] = '\0';
+        m_read_buf[m_checked_idx++] = '\0';
+        return LINE_OK;
+    }
+    return LINE_BAD;
+}
+
+http_conn::read_seg *http_conn::get_read_seg(int size)
+{
+    read_seg *seg;
+    if (READ_BUFFER_SIZE == size)
+        seg = reinterpret_cast<read_seg *>(read_pool::get());
+    else
+    {
+        seg = static_cast<read_seg *>(malloc(offsetof(read_seg, buf) + size));
+        if (!seg)
+            throw std::bad_alloc();
+    }
+    seg->prev = NULL;
+    seg->next = NULL;
+    seg->size = size;
+    seg->start = 0;
+    seg->end = 0;
+    return seg;
+}
+
+void http_conn::put_read_seg(read_seg *seg)
+{
+    if (READ_BUFFER_SIZE == seg->size)
+        read_pool::put(reinterpret_cast<char *>(seg));
+    else
+        free(seg);
+}
+
+void http_conn::new_read_seg(int size)
+{
+    read_seg *seg = get_read_seg(size);
+    seg->prev = m_read_seg;
+    if (m_read_seg)
+        m_read_seg->next = seg;
+    m_read_seg = seg;
+    m_read_buf = seg->buf;
+}
+
+void http_conn::release_read_segs()
+{
+    while (m_read_seg)
+    {
+        read_seg *prev = m_read_seg->prev;
+        put_read_seg(m_read_seg);
+        m_read_seg = prev;
+    }
+    m_read_buf = NULL;
+}
+
+//当前段中消息体的部分记下结束位置计入m_body_read，新段从头开始都是消息体
+//块编码时当前段末尾还有未解码的半个块大小行或刚到的块内容，拷到新段开头，已解码的内容都留在原段
+int http_conn::next_body_seg()
+{
+    const char *old = m_read_buf;
+    int raw = 0, next = m_checked_idx;
+    if (CHUNK_NONE != m_chunk_state)
+    {
+        raw = m_read_idx - m_checked_idx;
+        m_read_seg->end = m_start_line + m_content_length - m_body_read;
+        m_body_read = m_content_length;
+    }
+    else
+    {
+        m_read_seg->end = m_read_idx;
+        m_body_read += m_read_idx - m_start_line;
+    }
+    if (raw >= READ_BUFFER_SIZE - 1)
+        return 0;
+    new_read_seg(READ_BUFFER_SIZE);
+    memcpy(m_read_buf, old + next, raw);
+    m_start_line = 0;
+    m_checked_idx = 0;
+    m_read_idx = raw;
+    return read_room();
+}
+
+//读缓冲区剩余空间，当前段读满且请求仍不完整时借入新段
+//已解析完的行留在原段不动，m_url等指针仍然有效；请求头的索引指向读缓冲区，要求每行连续，
+//未解析完的半行拷到新段开头，单行超过一段时换加倍的大段，拷贝量不超过请求头上限
+//消息体由处理函数读取时留在各段中不拷贝，否则只计数，收到的部分直接丢弃
+int http_conn::prepare_read()
+{
+    if (http2())
+        return http2()->prepare_read();
+    //还未借用读缓冲区，数据到达时再借
+    if (!m_read_seg || read_room() > 0)
+        return read_room();
+
+    int carry = m_read_idx - m_start_line;
+    int size = READ_BUFFER_SIZE;
+    if (CHECK_STATE_CONTENT == m_check_state && read_body())
+        return next_body_seg();
+    if (CHECK_STATE_CONTENT == m_check_state && CHUNK_NONE != m_chunk_state)
+    {
+        //块编码：已解码的内容计入m_body_read后丢弃，未解码的只是半个块大小行或刚到的块内容，拷到段首
+        m_body_read = m_content_length;
+        m_body = NULL;
+        int raw = m_read_idx - m_checked_idx;
+        if (raw >= READ_BUFFER_SIZE - 1)
+            return 0;
+        if (0 == m_start_line)
+            memmove(m_read_buf, m_read_buf + m_checked_idx, raw);
+        else
+        {
+            const char *old = m_read_buf;
+            int next = m_checked_idx;
+            new_read_seg(READ_BUFFER_SIZE);
+            memcpy(m_read_buf, old + next, raw);
         }
-        else if (temp == '\n')
+        m_start_line = 0;
+        m_checked_idx = 0;
+        m_read_idx = raw;
+        return read_room();
+    }
+    if (CHECK_STATE_CONTENT == m_check_state)
+    {
+        //不保存的消息体只计数，已收到的部分直接丢弃
+        m_body_read += carry;
+        m_body = NULL;
+        carry = 0;
+        //当前段只有消息体，原地复用
+        if (0 == m_start_line)
         {
-            if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r')
-            {
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
+            m_read_idx = 0;
+            return read_room();
         }
     }
-    return LINE_OPEN;
+    else
+    {
+        //一行占满了整段，换一个加倍的大段，总长度受请求头上限约束
+        if (carry >= m_read_seg->size - 1)
+            size = 2 * m_read_seg->size;
+        m_head_len += m_start_line;
+        if (m_head_len + carry >= m_max_head)
+            return 0;
+    }
+
+    const char *old = m_read_buf + m_start_line;
+    new_read_seg(size);
+    memcpy(m_read_buf, old, carry);
+    m_checked_idx -= m_start_line;
+    m_start_line = 0;
+    m_read_idx = carry;
+    return read_room();
 }
 
 //非阻塞读取客户数据，直到无数据可读或对方关闭连接，当为proactor，由主线程调用；当为reactor时，由工作线程完成
-//LT触发下，没读完，等下一次读；ET工作模式下，需要一次性将数据读完。
+//LT触发下，没读完，等下一次读；ET工作模式下，需要一次性将数据读完，当前段读满时先交给状态机解析，解析后再借新段接着读
 bool http_conn::read_once()
 {
-    //报文长度超过读缓冲区
-    if (m_read_idx >= READ_BUFFER_SIZE)
+    //上传的消息体由工作线程从socket直接splice到文件，不读入读缓冲区
+    if (uploading())
+        return true;
+    if (http2())
+        return http2()->read_once();
+    //TLS握手由工作线程在process中进行，这里不读
+    if (tls() && !SSL_is_init_finished(tls()))
+        return true;
+    //报文长度超过上限
+    if (prepare_read() <= 0)
     {
         return false;
     }
+    //有数据到达才借用读缓冲区
+    if (!m_read_seg)
+        new_read_seg(READ_BUFFER_SIZE);
     int bytes_read = 0;
 
     //LT读取数据
     if (0 == m_TRIGMode)
     {
         //sockfd是非阻塞读，返回实际读到的字节数
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        bytes_read = sock_recv(m_read_buf + m_read_idx, read_room());
 
-        m_read_idx += bytes_read;
-        //bytes_read =0标识对方已经关闭连接
+        //bytes_read =0标识对方已经关闭连接；TLS的可读事件可能只是非应用数据的记录
         if (bytes_read <= 0)
         {
-            return false;
+            return bytes_read < 0 && tls() && EAGAIN == errno;
         }
+        m_read_idx += bytes_read;
+        m_read_buf[m_read_idx] = '\0';
 
         return true;
     }
@@ -230,10 +548,10 @@ bool http_conn::read_once()
     else
     {
         //ET需要多次调用
-        while (true)
+        while (read_room() > 0)
         {
              //sockfd是非阻塞读
-            bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+            bytes_read = sock_recv(m_read_buf + m_read_idx, read_room());
             //若为-1，
             if (bytes_read == -1)
             {
@@ -250,16 +568,31 @@ bool http_conn::read_once()
             }
             m_read_idx += bytes_read;
         }
+        //虚假唤醒，没有读到任何数据，缓冲区立即归还
+        if (0 == m_read_idx && !m_read_seg->prev && CHECK_STATE_REQUESTLINE == m_check_state)
+        {
+            release_read_segs();
+            return true;
+        }
+        m_read_buf[m_read_idx] = '\0';
         return true;
     }
 }
 
+//路由按1 << m_method检查请求方法
+static_assert(ROUTE_GET == 1 << http_conn::GET && ROUTE_POST == 1 << http_conn::POST &&
+                  ROUTE_PUT == 1 << http_conn::PUT,
+              "route methods out of sync");
+
 //解析http请求行，获得请求方法，目标url及http版本号
-http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
+http_conn::HTTP_CODE http_conn::parse_request_line(char *text, int len)
 {
-    //
-    m_url = strpbrk(text, " \t");
-    if (!m_url)
+    //HTTP/2前言的第一行，只能是连接上的第一个请求
+    if (m_http2 && !tls() && 14 == len && 0 == memcmp(text, "PRI * HTTP/2.0", 14))
+        return 0 == m_requests ? UPGRADE_REQUEST : BAD_REQUEST;
+    char *end = text + len;
+    m_url = const_cast<char *>(http_scan::find2(text, end, ' ', '\t'));
+    if (m_url == end)
     {
         return BAD_REQUEST;
     }
@@ -271,25 +604,30 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     if (strcasecmp(method, "GET") == 0)
         m_method = GET;
     else if (strcasecmp(method, "POST") == 0)
-    {
         m_method = POST;
-        cgi = 1;
-    }
+    else if (strcasecmp(method, "PUT") == 0)
+        m_method = PUT;
     else
         return BAD_REQUEST;
 
     //客户请求的目标文件的文件名    
     m_url += strspn(m_url, " \t");
     //HTTP版本号
-    m_version = strpbrk(m_url, " \t");
+    char *version = const_cast<char *>(http_scan::find2(m_url, end, ' ', '\t'));
     
-    if (!m_version)
+    if (version == end)
         return BAD_REQUEST;
-    *m_version++ = '\0';
-    m_version += strspn(m_version, " \t");
-    //若不是HTTP/1.1版本，则为BAD_REQUEST
-    if (strcasecmp(m_version, "HTTP/1.1") != 0)
+    *version++ = '\0';
+    version += strspn(version, " \t");
+    //HTTP/1.1默认长连接，HTTP/1.0默认短连接，由Connection头部改变
+    //m_http11不随请求重置，流式响应在请求处理完之后仍要按版本决定是否分块
+    if (strcasecmp(version, "HTTP/1.1") == 0)
+        m_linger = true;
+    else if (strcasecmp(version, "HTTP/1.0") == 0)
+        m_linger = false;
+    else
         return BAD_REQUEST;
+    m_http11 = m_linger;
 
     if (strncasecmp(m_url, "http://", 7) == 0)
     {
@@ -306,49 +644,109 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     if (!m_url || m_url[0] != '/')
         return BAD_REQUEST;
 
-    //当url为/时，显示判断界面，否则url制定了需要请求文件的路径
-    if (strlen(m_url) == 1)
-        strcat(m_url, "judge.html");
+    //url为/时显示判断界面，由路由改写；没有路由的url即请求文件的路径
+    m_route = http_router::match(m_url, strlen(m_url), 1u << m_method);
+    //请求行有效才借用头部索引，随读缓冲区一起归还
+    if (!m_headers)
+    {
+        m_headers = reinterpret_cast<header_index *>(header_pool::get());
+        m_headers->clear();
+    }
     m_check_state = CHECK_STATE_HEADER;
     return NO_REQUEST;
 }
+//逗号分隔的列表中是否有token，不区分大小写
+static bool has_token(const char *list, const char *token)
+{
+    size_t len = strlen(token);
+    while (*list)
+    {
+        list += strspn(list, " \t,");
+        size_t n = strcspn(list, " \t,");
+        if (n == len && strncasecmp(list, token, len) == 0)
+            return true;
+        list += n;
+    }
+    return false;
+}
+
 //解析http请求的一个头部信息
-http_conn::HTTP_CODE http_conn::parse_headers(char *text)
+http_conn::HTTP_CODE http_conn::parse_headers(char *text, int len)
 {
     //
     if (text[0] == '\0')
     {
-        if (m_content_length != 0)
+        //上传的消息体不受body_limit约束，另有上限
+        if (m_route && ROUTE_UPLOAD == m_route->handler)
+            return start_upload();
+        if (m_content_length < 0 || m_content_length > body_limit())
+            return BAD_REQUEST;
+        //同时有Content-Length和块编码时两者给出的消息体边界可能不同，拒绝
+        if (CHUNK_NONE != m_chunk_state && m_headers->get(HDR_CONTENT_LENGTH))
+            return BAD_REQUEST;
+        if (m_content_length != 0 || CHUNK_NONE != m_chunk_state)
         {
+            //消息体从空行之后开始
+            m_body = m_read_seg;
+            m_body->start = m_checked_idx;
             m_check_state = CHECK_STATE_CONTENT;
             return NO_REQUEST;
         }
+        //Upgrade: h2c只接受没有消息体的请求，且之前的响应都已发出，101之后直接是HTTP/2的帧
+        if (m_http2 && !tls() && m_http11 && 0 == bytes_to_send && header(HDR_HTTP2_SETTINGS) && header(HDR_UPGRADE) &&
+            header(HDR_CONNECTION) && has_token(header(HDR_UPGRADE), "h2c") &&
+            has_token(header(HDR_CONNECTION), "upgrade") && has_token(header(HDR_CONNECTION), "http2-settings"))
+            return UPGRADE_REQUEST;
         return GET_REQUEST;
     }
-    else if (strncasecmp(text, "Connection:", 11) == 0)
+    //头部名到冒号为止，值去掉两端的空白后原地以'\0'结尾，没有冒号的行忽略
+    char *end = text + len;
+    char *colon = const_cast<char *>(http_scan::find(text, end, ':'));
+    if (colon == end)
+        return NO_REQUEST;
+    char *value = colon + 1;
+    value += strspn(value, " \t");
+    while (end > value && (' ' == end[-1] || '\t' == end[-1]))
+        --end;
+    *end = '\0';
+    //头部过多
+    header_field *f = m_headers->add(text, colon - text, value, end - value);
+    if (!f)
+        return BAD_REQUEST;
+
+    //其余头部留在索引中，由用到的地方按编号取值
+    switch (f->id)
     {
-        text += 11;
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0)  //
-        {
+    case HDR_CONNECTION:
+    {
+        //值是逗号分隔的选项列表，如"keep-alive, Upgrade"
+        if (has_token(value, "close"))
+            m_linger = false;
+        else if (has_token(value, "keep-alive"))
             m_linger = true;
-        }
+        break;
     }
-    else if (strncasecmp(text, "Content-length:", 15) == 0)
+    case HDR_CONTENT_LENGTH:
     {
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
+        //多个不同的Content-Length无法确定消息体的边界
+        long length = atol(value);
+        if (length < 0 || length > INT_MAX)
+            return BAD_REQUEST;
+        if (m_headers->get(HDR_CONTENT_LENGTH) != f && length != m_content_length)
+            return BAD_REQUEST;
+        m_content_length = length;
+        break;
     }
-    else if (strncasecmp(text, "Host:", 5) == 0)
+    case HDR_TRANSFER_ENCODING:
     {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
+        //只支持单独的chunked，其他编码无法解码；HTTP/1.0没有块编码
+        if (!m_http11 || CHUNK_NONE != m_chunk_state || strcasecmp(value, "chunked") != 0)
+            return BAD_REQUEST;
+        m_chunk_state = CHUNK_SIZE;
+        break;
     }
-    else
-    {
-        LOG_INFO("oop!unknow header: %s", text);
+    default:
+        break;
     }
     return NO_REQUEST;
 }
@@ -356,17 +754,257 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
 //http请求报文中的内容段，只有post才有
 http_conn::HTTP_CODE http_conn::parse_content(char *text)
 {
-    //缓冲区
-    if (m_read_idx >= (m_content_length + m_checked_idx))
+    //之前各段中的消息体也计入
+    if (m_body_read + m_read_idx >= (m_content_length + m_checked_idx))
     {
-        text[m_content_length] = '\0';
-        //POST请求中最后为输入的用户名和密码
-        m_string = text;
+        //POST请求中最后为输入的用户名和密码，由处理函数经body()读取
+        //不在消息体末尾写'\0'，那里可能是流水线上下一个请求的开头，由m_content_length截止
         return GET_REQUEST;
     }
     return NO_REQUEST;
 }
 
+//块编码的消息体：块大小行和块尾的\r\n在读缓冲区中原地去掉，块内容依次接在已解码的内容之后
+//已解码的内容从m_start_line开始，当前段读满时由prepare_read留在原段或丢弃，长度始终受body_limit约束
+//块大小行的扩展和尾部头部都忽略
+http_conn::HTTP_CODE http_conn::parse_chunked()
+{
+    while (true)
+    {
+        char *p = m_read_buf + m_checked_idx;
+        char *end = m_read_buf + m_read_idx;
+        switch (m_chunk_state)
+        {
+        case CHUNK_SIZE:
+        case CHUNK_TRAILER:
+        {
+            char *eol = const_cast<char *>(http_scan::find(p, end, '\n'));
+            if (eol == end)
+                return NO_REQUEST;
+            int len = eol - p;
+            if (0 == len || '\r' != eol[-1])
+                return BAD_REQUEST;
+            m_checked_idx += len + 1;
+            if (CHUNK_TRAILER == m_chunk_state)
+            {
+                //空行结束消息体
+                if (1 == len)
+                    return GET_REQUEST;
+                break;
+            }
+            //十六进制的块大小，之后可以有";扩展"
+            long size = 0;
+            int digits = 0;
+            for (; digits < len - 1 && isxdigit((unsigned char)p[digits]); ++digits)
+            {
+                size = size * 16 + (isdigit((unsigned char)p[digits]) ? p[digits] - '0' : (p[digits] | 0x20) - 'a' + 10);
+                if (m_content_length + size > body_limit())
+                    return BAD_REQUEST;
+            }
+            if (0 == digits || (digits < len - 1 && ';' != p[digits] && ' ' != p[digits] && '\t' != p[digits]))
+                return BAD_REQUEST;
+            m_chunk_left = size;
+            m_chunk_state = 0 == size ? CHUNK_TRAILER : CHUNK_DATA;
+            break;
+        }
+        case CHUNK_DATA:
+        {
+            int n = end - p < m_chunk_left ? end - p : m_chunk_left;
+            if (0 == n)
+                return NO_REQUEST;
+            char *dst = m_read_buf + m_start_line + (m_content_length - m_body_read);
+            if (dst != p)
+                memmove(dst, p, n);
+            m_checked_idx += n;
+            m_content_length += n;
+            m_chunk_left -= n;
+            if (0 == m_chunk_left)
+                m_chunk_state = CHUNK_DATA_END;
+            break;
+        }
+        case CHUNK_DATA_END:
+        {
+            if (end - p < 2)
+                return NO_REQUEST;
+            if ('\r' != p[0] || '\n' != p[1])
+                return BAD_REQUEST;
+            m_checked_idx += 2;
+            m_chunk_state = CHUNK_SIZE;
+            break;
+        }
+        default:
+            return INTERNAL_ERROR;
+        }
+    }
+}
+
+//上传的文件名只允许字母、数字和._-，不以.开头，不能含路径
+static bool valid_upload_name(const char *name)
+{
+    if ('\0' == name[0] || '.' == name[0])
+        return false;
+    for (const char *p = name; *p; ++p)
+    {
+        if (!isalnum((unsigned char)*p) && '.' != *p && '_' != *p && '-' != *p)
+            return false;
+    }
+    return true;
+}
+
+//上传只接受带Content-Length的消息体，先写入以连接区分的临时文件，收完后改名，中途断开时删除
+//消息体不经读缓冲区，由save_body从socket经管道splice到文件
+http_conn::HTTP_CODE http_conn::start_upload()
+{
+    if (upload_dir.empty())
+        return FORBIDDEN_REQUEST;
+    //splice移出的是socket上的密文
+    if (tls())
+        return BAD_REQUEST;
+    if (CHUNK_NONE != m_chunk_state || !m_headers->get(HDR_CONTENT_LENGTH))
+        return LENGTH_REQUIRED;
+    if (m_content_length > upload_limit)
+        return TOO_LARGE;
+    const char *name = m_url + strlen(m_route->path);
+    if (!valid_upload_name(name))
+        return BAD_REQUEST;
+
+    aux_state *a = aux();
+    int n = snprintf(a->part, sizeof(a->part), "%s/.%s.%d.part", upload_dir.c_str(), name, m_sockfd);
+    if (n >= (int)sizeof(a->part))
+    {
+        release_aux();
+        return BAD_REQUEST;
+    }
+    if (pipe2(a->pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        release_aux();
+        return INTERNAL_ERROR;
+    }
+    a->upload_fd = open(a->part, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (a->upload_fd < 0)
+    {
+        close(a->pipe[0]);
+        close(a->pipe[1]);
+        a->pipe[0] = a->pipe[1] = -1;
+        release_aux();
+        return INTERNAL_ERROR;
+    }
+    //预先分配磁盘空间，减少边写边分配的碎片，文件系统不支持时忽略
+    if (m_content_length > 0)
+        fallocate(a->upload_fd, 0, 0, m_content_length);
+
+    //客户端等待100 Continue才发送消息体；之前的响应还没发完时不插入，客户端超时后也会发送
+    const char *expect = header(HDR_EXPECT);
+    if (expect && strcasecmp(expect, "100-continue") == 0 && 0 == bytes_to_send)
+        send(m_sockfd, "HTTP/1.1 100 Continue\r\n\r\n", 25, MSG_NOSIGNAL | MSG_DONTWAIT);
+    m_check_state = CHECK_STATE_CONTENT;
+    return NO_REQUEST;
+}
+
+//先写出已读入读缓冲区的部分，流水线上其后的请求前移接上；其余从socket经管道splice到文件，直到EAGAIN
+//一次最多移入m_write_quantum字节，用完后返回NO_REQUEST，由process重新注册EPOLLIN，
+//socket仍可读时连接排到其他就绪连接之后，反应堆每次分发时延长定时器
+http_conn::HTTP_CODE http_conn::save_body()
+{
+    aux_state *a = m_aux;
+    int left = m_content_length - m_body_read;
+    int n = m_read_idx - m_checked_idx < left ? m_read_idx - m_checked_idx : left;
+    if (n > 0)
+    {
+        for (int done = 0; done < n;)
+        {
+            ssize_t w = ::write(a->upload_fd, m_read_buf + m_checked_idx + done, n - done);
+            if (w < 0)
+                return INTERNAL_ERROR;
+            done += w;
+        }
+        memmove(m_read_buf + m_checked_idx, m_read_buf + m_checked_idx + n, m_read_idx - m_checked_idx - n);
+        m_read_idx -= n;
+        m_read_buf[m_read_idx] = '\0';
+        m_body_read += n;
+        left -= n;
+    }
+    int quantum = m_write_quantum > 0 ? m_write_quantum : INT_MAX;
+    while (left > 0)
+    {
+        if (quantum <= 0)
+            return NO_REQUEST;
+        int len = left < UPLOAD_PIPE_SIZE ? left : UPLOAD_PIPE_SIZE;
+        ssize_t got = splice(m_sockfd, NULL, a->pipe[1], NULL, len < quantum ? len : quantum,
+                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (got < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
+            return NO_REQUEST;
+        if (got <= 0)
+            return CLOSED_CONNECTION;
+        //管道中的数据全部移入文件，下一次splice时管道为空
+        for (ssize_t moved = 0; moved < got;)
+        {
+            ssize_t w = splice(a->pipe[0], NULL, a->upload_fd, NULL, got - moved, SPLICE_F_MOVE);
+            if (w <= 0)
+                return INTERNAL_ERROR;
+            moved += w;
+        }
+        m_body_read += got;
+        left -= got;
+        quantum -= got;
+    }
+    return GET_REQUEST;
+}
+
+//上传的状态与目录索引共用m_aux
+http_conn::aux_state *http_conn::aux()
+{
+    if (!m_aux)
+    {
+        m_aux = new aux_state;
+        m_aux->dir = NULL;
+        m_aux->pending = NULL;
+        m_aux->upload_fd = -1;
+        m_aux->pipe[0] = m_aux->pipe[1] = -1;
+        m_aux->h2 = NULL;
+        m_aux->ssl = NULL;
+    }
+    return m_aux;
+}
+
+void http_conn::release_aux()
+{
+    if (m_aux && !m_aux->dir && m_aux->upload_fd < 0 && !m_aux->h2 && !m_aux->ssl)
+    {
+        delete m_aux;
+        m_aux = NULL;
+    }
+}
+
+bool http_conn::end_upload(bool keep)
+{
+    aux_state *a = m_aux;
+    close(a->pipe[0]);
+    close(a->pipe[1]);
+    a->pipe[0] = a->pipe[1] = -1;
+    //close失败说明数据可能没有写到磁盘，不当作上传成功
+    bool ok = 0 == close(a->upload_fd) && keep;
+    a->upload_fd = -1;
+    if (ok)
+    {
+        char path[sizeof(a->part)];
+        snprintf(path, sizeof(path), "%s/%s", upload_dir.c_str(), m_url + strlen(m_route->path));
+        ok = 0 == rename(a->part, path);
+    }
+    if (!ok)
+        unlink(a->part);
+    release_aux();
+    return ok;
+}
+
+//路由表中设定了上限的路由按其设定，其余请求使用启动参数设定的上限
+int http_conn::body_limit()
+{
+    if (m_route && m_route->body_limit > 0)
+        return m_route->body_limit;
+    return m_max_body;
+}
+
 //分析读取的请求报文，得到相应信息：http处理请求结果、url
 http_conn::HTTP_CODE http_conn::process_read()
 {
@@ -379,44 +1017,64 @@ http_conn::HTTP_CODE http_conn::process_read()
     {
         //获取报文一行的首部的
         text = get_line();
-        m_start_line = m_checked_idx;
-        LOG_INFO("%s", text);
+        //请求行和头部的长度，行尾的\r\n已被parse_line置为'\0'
+        //消息体从空行之后开始，m_start_line停在消息体开头，块编码在其后拼接解码的内容
+        int len = m_checked_idx - m_start_line - 2;
+        if (CHECK_STATE_CONTENT != m_check_state)
+            m_start_line = m_checked_idx;
         switch (m_check_state)
         {
         //主状态处于CHECK_STATE_REQUESTLINE：正在分析请求行
         case CHECK_STATE_REQUESTLINE:
         {
             //解析请求行：获取请求方法、url、 HTTP版本号，并将主状态设置为CHECK_STATE_HEADER
-            ret = parse_request_line(text);
+            //只记录请求行，头部都在索引中，不再逐行写日志
+            LOG_INFO("%s", text);
+            ret = parse_request_line(text, len);
+            //报文格式错误时无法确定请求的边界，响应后关闭连接
             if (ret == BAD_REQUEST)
+            {
+                m_linger = false;
                 return BAD_REQUEST;
+            }
+            if (ret == UPGRADE_REQUEST)
+                return ret;
             break;
         }
         //主状态处于CHECK_STATE_HEADER：正在分析头部字段
         case CHECK_STATE_HEADER:
         {
-            //解析头部字段：得出"Connection:", "keep-alive" "Content-length:"   "Host:"等相关信息，并并将主状态设置为CHECK_STATE_CONTENT
-            ret = parse_headers(text);
-            if (ret == BAD_REQUEST)
-                return BAD_REQUEST;
-
+            //解析头部字段：加入头部索引，得出Connection、Content-Length等相关信息，并将主状态设置为CHECK_STATE_CONTENT
+            ret = parse_headers(text, len);
             //已经分析得到一个完整HTTP请求，处理请求
-            else if (ret == GET_REQUEST)
-            {
+            if (ret == GET_REQUEST)
                 return do_request();
+            //其余结果都是错误，消息体未读，无法确定请求的边界，响应后关闭连接
+            if (ret != NO_REQUEST)
+            {
+                m_linger = false;
+                return ret;
             }
             break;
         }
         //主状态处于CHECK_STATE_CONTENT：正在分析报文内容
         case CHECK_STATE_CONTENT:
         {
-            //解析报文内容段：获取用户名和密码
-            ret = parse_content(text);
+            //解析报文内容段：获取用户名和密码，上传的消息体写入文件
+            if (uploading())
+                ret = save_body();
+            else
+                ret = CHUNK_NONE == m_chunk_state ? parse_content(text) : parse_chunked();
             //已经分析得到一个完整HTTP请求，处理请求
             if (ret == GET_REQUEST)
                 return do_request();
-            line_status = LINE_OPEN;
-            break;
+            if (ret != NO_REQUEST)
+            {
+                m_linger = false;
+                return ret;
+            }
+            //消息体未收全，直接等待更多数据，不能再用parse_line扫描消息体，否则m_checked_idx越过消息体起点
+            return NO_REQUEST;
         }
         default:
             return INTERNAL_ERROR;
@@ -425,352 +1083,1173 @@ http_conn::HTTP_CODE http_conn::process_read()
     return NO_REQUEST;
 }
 
-//
-http_conn::HTTP_CODE http_conn::do_request()
+//消息体之后可能是流水线上的下一个请求，读到消息体长度为止
+http_conn::body_reader http_conn::body() const
 {
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    //printf("m_url:%s\n", m_url);
-    const char *p = strrchr(m_url, '/');
-
-    //处理（cgi =1） post请求，要么是请求注册要么是登陆
-    if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))
-    {
-
-        //根据标志判断是登录检测还是注册检测
-        char flag = m_url[1];
-
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
-
-        //将用户名和密码提取出来
-        //user=123&passwd=123
-        char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
-
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
-
-        //注册请求
-        if (*(p + 1) == '3')
-        {
-            //如果是注册，先检测数据库中是否有重名的
-            //没有重名的，进行增加数据
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            if (users.find(name) == users.end())
-            {
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, password));
-                m_lock.unlock();
-
-                if (!res)
-                    strcpy(m_url, "/log.html");
-                else
-                    strcpy(m_url, "/registerError.html");
-            }
-            else
-                strcpy(m_url, "/registerError.html");
-        }
-        //如果是登录，直接判断
-        //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
-        else if (*(p + 1) == '2')
-        {
-            if (users.find(name) != users.end() && users[name] == password)
-                strcpy(m_url, "/welcome.html");
-            else
-                strcpy(m_url, "/logError.html");
-        }
-    }
+    body_reader r = {m_body, m_body ? m_content_length : 0};
+    return r;
+}
 
-    //请求主页
-    if (*(p + 1) == '0')
+//较早的段到end为止，最后一段的内容按剩余长度截止；请求头正好填满一段时消息体的第一段为空，跳过
+int http_conn::body_next(body_reader &r, const char *&data)
+{
+    int len = 0;
+    while (0 == len && r.seg && r.left > 0)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/register.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        len = r.seg->next && r.seg->end - r.seg->start < r.left ? r.seg->end - r.seg->start : r.left;
+        data = r.seg->buf + r.seg->start;
+        r.seg = r.seg->next;
+        r.left -= len;
     }
-    //请求登陆页
-    else if (*(p + 1) == '1')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+    return len;
+}
 
-        free(m_url_real);
-    }
-    //请求图片
-    else if (*(p + 1) == '5')
+//从消息体user=123&passwd=123中取出用户名和密码
+//消息体可能跨多段，逐段扫描：跳过"user="，用户名到'&'为止，密码从'&'之后第10个字节开始，各不超过99字节
+bool http_conn::parse_user(char *name, char *password)
+{
+    body_reader r = body();
+    if (!r.seg)
+        return false;
+    int i = 0, j = 0, amp = -1;
+    const char *data;
+    for (int n; (n = body_next(r, data)) > 0;)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        for (int k = 0; k < n; ++k, ++i)
+        {
+            if (i < 5)
+                continue;
+            if (amp < 0)
+            {
+                if (data[k] != '&' && i - 5 < 99)
+                {
+                    name[i - 5] = data[k];
+                    continue;
+                }
+                amp = i;
+            }
+            if (i >= amp + 10 && j < 99)
+                password[j++] = data[k];
+        }
     }
-    //请求视频
-    else if (*(p + 1) == '6')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+    name[(amp < 0 ? (i > 5 ? i : 5) : amp) - 5] = '\0';
+    password[j] = '\0';
+    return true;
+}
 
-        free(m_url_real);
-    }
+//登录：用户名和密码在表中可以查找到时进入欢迎页
+const char *http_conn::do_login()
+{
+    char name[100], password[100];
+    if (!parse_user(name, password))
+        return NULL;
+    if (users.find(name) != users.end() && users[name] == password)
+        return "/welcome.html";
+    return "/logError.html";
+}
 
-    else if (*(p + 1) == '7')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+//注册：先检测数据库中是否有重名的，没有重名的，进行增加数据
+const char *http_conn::do_register()
+{
+    char name[100], password[100];
+    if (!parse_user(name, password))
+        return NULL;
+    if (users.find(name) != users.end())
+        return "/registerError.html";
+
+    char sql_insert[256];
+    snprintf(sql_insert, sizeof(sql_insert), "INSERT INTO user(username, passwd) VALUES('%s', '%s')", name, password);
+    m_lock.lock();
+    int res = mysql_query(mysql, sql_insert);
+    users.insert(pair<string, string>(name, password));
+    m_lock.unlock();
+
+    return res ? "/registerError.html" : "/log.html";
+}
 
-        free(m_url_real);
+http_conn::HTTP_CODE http_conn::do_request()
+{
+    //要显示的页面：路由改写的或处理函数给出的，没有路由时即请求的url
+    const char *page = m_url;
+    if (m_route)
+    {
+        switch (m_route->handler)
+        {
+        case ROUTE_LOGIN:
+            page = do_login();
+            break;
+        case ROUTE_REGISTER:
+            page = do_register();
+            break;
+        case ROUTE_UPLOAD:
+            return end_upload(true) ? UPLOADED : INTERNAL_ERROR;
+        default:
+            page = m_route->rewrite;
+            break;
+        }
+        if (!page)
+            return NO_RESOURCE;
     }
-    else
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
+    //PUT只用于上传
+    if (PUT == m_method)
+        return BAD_REQUEST;
+    //目标文件的完整路径，其内容等于doc_root+page,doc_root是网站根目录
+    char real_file[FILENAME_LEN];
+    if (strlen(doc_root) + strlen(page) >= (size_t)FILENAME_LEN)
+        return NO_RESOURCE;
+    strcpy(stpcpy(real_file, doc_root), page);
 
-    //根据m_real_file判断文件存在与否、权限和是不是目录
-    if (stat(m_real_file, &m_file_stat) < 0)
+    //从文件缓存取得stat结果、描述符和映射，命中时不再stat/open/mmap
+    m_file = file_cache::get_instance()->acquire(real_file);
+    if (!m_file)
         return NO_RESOURCE;
 
-    if (!(m_file_stat.st_mode & S_IROTH))
+    if (!(m_file->st.st_mode & S_IROTH))
         return FORBIDDEN_REQUEST;
 
-    if (S_ISDIR(m_file_stat.st_mode))
-        return BAD_REQUEST;
+    if (S_ISDIR(m_file->st.st_mode))
+    {
+        //目录索引分段生成，不经文件缓存；url含..时拒绝，以免列出根目录之外的目录
+        if (!m_autoindex || GET != m_method)
+            return BAD_REQUEST;
+        if (strstr(page, "/.."))
+            return FORBIDDEN_REQUEST;
+        release_file();
+        DIR *dir = opendir(real_file);
+        if (!dir)
+            return NO_RESOURCE;
+        aux()->dir = dir;
+        return STREAM_REQUEST;
+    }
+
+    //客户端缓存的版本未变，不必打开或发送内容
+    if (GET == m_method && m_file->fd >= 0 && not_modified())
+        return NOT_MODIFIED;
 
     /***************************************************************************************************/
-    //m_real_file是完整路径名，打开该文件
-    int fd = open(m_real_file, O_RDONLY);
-    //将fd文件映射内存m_file_address地址处,只读
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
+    if (m_file->fd < 0)
+        return NO_RESOURCE;
+    //小文件已有预生成的头部和内容(两种连接方式同时生成)，由process_write直接发送；带Range的请求另行生成
+    if (m_file->resp[0] && !header(HDR_RANGE))
+        return FILE_REQUEST;
+    //sendfile模式使用缓存的文件描述符，由内核直接从页缓存发送，不映射到用户空间
+    //io_uring没有sendfile操作，仍走mmap + SENDMSG
+    //sendfile只能作为一批中的第一个响应，流水线上之后的响应仍用映射，与之前的响应一起writev
+    if (m_sendfile && m_epollfd >= 0 && 0 == bytes_to_send && !http2() && plain_send())
+    {
+        m_file_fd = m_file->fd;
+        m_file_offset = 0;
+        return FILE_REQUEST;
+    }
+    //缓存中的只读映射
+    m_file_address = m_file->addr;
+    if (!m_file_address && file_size() != 0)
+        return INTERNAL_ERROR;
     return FILE_REQUEST;
 }
+//HTTP/1的读缓冲区中前言第一行或Upgrade请求之后的字节交给会话，此后连接只收发帧
+void http_conn::start_http2(bool upgrade)
+{
+    http2_session *s = new http2_session(this);
+    aux()->h2 = s;
+    bool ok = s->start(upgrade, header(HDR_HTTP2_SETTINGS), m_read_buf + m_checked_idx, m_read_idx - m_checked_idx);
+    reset_request();
+    m_read_idx = 0;
+    release_read_segs();
+    if (!ok)
+    {
+        notify(completion_queue::CLOSE);
+        return;
+    }
+    s->process();
+}
+
+//目录索引需要流式响应，上传需要从socket直接splice，HTTP/2都不提供
+http_conn::HTTP_CODE http_conn::h2_request(METHOD method, char *url, read_seg *body, int body_len, file_entry *&file)
+{
+    LOG_INFO("h2 %s", url);
+    m_method = method;
+    m_url = url;
+    m_body = body;
+    m_content_length = body_len;
+    m_body_read = body ? 0 : body_len;
+    m_route = http_router::match(url, strlen(url), 1u << method);
+    HTTP_CODE ret = m_route && ROUTE_UPLOAD == m_route->handler ? BAD_REQUEST : do_request();
+    if (STREAM_REQUEST == ret)
+    {
+        end_stream();
+        ret = BAD_REQUEST;
+    }
+    //预生成响应的文件不检查映射，这里补上
+    if (FILE_REQUEST == ret && !m_file->addr && file_size() != 0)
+        ret = INTERNAL_ERROR;
+    if (FILE_REQUEST != ret && NOT_MODIFIED != ret)
+        release_file();
+    file = m_file;
+    m_file = NULL;
+    m_file_address = NULL;
+    m_route = NULL;
+    m_body = NULL;
+    return ret;
+}
+
+header_index *http_conn::h2_headers()
+{
+    if (!m_headers)
+        m_headers = reinterpret_cast<header_index *>(header_pool::get());
+    m_headers->clear();
+    return m_headers;
+}
+
+//描述符和映射归文件缓存所有，这里只释放引用
+void http_conn::release_file()
+{
+    if (m_file)
+    {
+        file_cache::get_instance()->release(m_file);
+        m_file = NULL;
+    }
+    m_file_address = 0;
+    m_file_fd = -1;
+}
+
 void http_conn::unmap()
 {
-    if (m_file_address)
+    release_file();
+    release_batch();
+    end_stream();
+}
+
+//待发送的iovec可能在响应批中，一并清空
+void http_conn::release_batch()
+{
+    if (m_batch)
+    {
+        for (int i = 0; i < m_batch->nfiles; ++i)
+            file_cache::get_instance()->release(m_batch->files[i]);
+        batch_pool::put(reinterpret_cast<char *>(m_batch));
+        m_batch = NULL;
+    }
+    m_iv_count = 0;
+}
+
+//报文头未发完时带MSG_MORE，内核把报文头和随后sendfile的文件开头合并成满长度的TCP段，省去TCP_CORK的两次setsockopt
+//sendfile自行推进m_file_offset，EAGAIN后再次调用即从断点继续
+ssize_t http_conn::send_file(size_t limit)
+{
+    if (bytes_have_send < m_write_idx)
     {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+        int head = m_write_idx - bytes_have_send;
+        return send(m_sockfd, m_write_buf + bytes_have_send, head, MSG_NOSIGNAL | (bytes_to_send > head ? MSG_MORE : 0));
     }
+    return sendfile(m_sockfd, m_file_fd, &m_file_offset, limit < (size_t)bytes_to_send ? limit : bytes_to_send);
 }
 
-//
-bool http_conn::write()
+ssize_t http_conn::sock_recv(char *buf, int len)
+{
+    if (tls())
+        return tls_context::read(tls(), buf, len);
+    return recv(m_sockfd, buf, len, 0);
+}
+
+//超出limit的iovec本次不交给内核，跨过limit的一个临时截短，发送后恢复
+ssize_t http_conn::send_iov(size_t limit)
+{
+    struct iovec *v = iov();
+    int cnt = m_iv_count;
+    size_t cut = 0;
+    if (limit < (size_t)bytes_to_send)
+    {
+        size_t len = 0;
+        for (cnt = 0; cnt < m_iv_count && len + v[cnt].iov_len < limit; ++cnt)
+            len += v[cnt].iov_len;
+        cut = v[cnt].iov_len;
+        v[cnt++].iov_len = limit - len;
+    }
+    ssize_t n = plain_send() ? writev(m_sockfd, v, cnt) : tls_context::writev(tls(), v, cnt);
+    if (cut)
+        v[cnt - 1].iov_len = cut;
+    return n;
+}
+
+//读缓冲区中还有流水线上的请求时不注册读事件，由调用者再次process，其结果注册后续事件
+//TLS握手中socket写满时返回2，由工作线程继续握手
+//一次最多发送m_write_quantum字节，未发完时重新注册EPOLLOUT，socket仍可写时连接排到其他就绪连接之后
+int http_conn::write()
 {
     int temp = 0;
+    size_t quantum = m_write_quantum > 0 ? m_write_quantum : SIZE_MAX;
+    if (http2())
+        return http2()->write();
+    if (tls() && !SSL_is_init_finished(tls()))
+        return 2;
 
     if (bytes_to_send == 0)
     {
+        //先重置再注册读事件，注册后连接可能立即被其他工作线程处理
+        finish_write();
+        if (m_read_idx > 0)
+            return 2;
         modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
-        init();
-        return true;
+        return 1;
     }
 
     while (1)
     {
         //将几块内存写进m_sockfd发送缓冲区，集中写,temp为实际写入的字节数
         //由于m_sockfd为非阻塞，所以或立即返回
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        if (m_file_fd >= 0)
+            temp = send_file(quantum);
+        else
+            temp = send_iov(quantum);
         //返回-1
         if (temp < 0)
         {
             if (errno == EAGAIN)//返回-1且errno=EAGIN，标识socket写缓冲区满了,需要将fd重新加入为可写事件，下次接着写
             {
                 modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
-                return true;
+                return 1;
             }
             //否则-1表示对方已经关闭了连接，则取消映射，关闭连接
             unmap();
-            return false;
+            return 0;
         }
 
-        //更新待发送、已发送计数
-        bytes_have_send += temp;
-        bytes_to_send -= temp;
-
-        //当大文件一次性没传完，下次传输文件需要更新iovec，
-        if (bytes_have_send >= m_iv[0].iov_len)
-        {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        }
-        else
+        //更新待发送、已发送计数和iovec
+        update_iov(temp);
+        //流式响应发完一段，生成下一段接着发送
+        if (bytes_to_send <= 0 && m_stream && !next_stream())
         {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
+            unmap();
+            return 0;
         }
-        //当待发送数据为0，则取消映射，把epoll 中m_sockfd监听事件类型改为读
+
+        //当待发送数据为0，则取消映射，长连接把epoll 中m_sockfd监听事件类型改为读
+        //短连接不再注册事件，由反应堆关闭，避免关闭前又触发事件
         if (bytes_to_send <= 0)
         {
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
-
-            if (m_linger)
+            if (!m_resp_linger)
             {
-                init();
-                return true;
-            }
-            else
-            {
-                return false;
+                unmap();
+                return 0;
             }
+            finish_write();
+            if (m_read_idx > 0)
+                return 2;
+            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+            return 1;
+        }
+        //本次的配额用完，让出
+        quantum -= temp;
+        if (0 == quantum)
+        {
+            modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+            return 1;
         }
     }
 }
 
-bool http_conn::add_response(const char *format, ...)
+//更新待发送、已发送计数
+//当大文件一次性没传完，下次传输文件需要更新iovec，
+void http_conn::update_iov(int temp)
 {
-    if (m_write_idx >= WRITE_BUFFER_SIZE)
-        return false;
-    va_list arg_list;
-    va_start(arg_list, format);
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx))
+    bytes_have_send += temp;
+    bytes_to_send -= temp;
+    //sendfile模式不使用iovec
+    if (m_file_fd >= 0)
+        return;
+
+    //已发完的iovec长度置0，发了一部分的从断点继续
+    struct iovec *v = iov();
+    for (int i = 0; i < m_iv_count && temp > 0; ++i)
     {
-        va_end(arg_list);
+        if ((size_t)temp >= v[i].iov_len)
+        {
+            temp -= v[i].iov_len;
+            v[i].iov_len = 0;
+        }
+        else
+        {
+            v[i].iov_base = (char *)v[i].iov_base + temp;
+            v[i].iov_len -= temp;
+            temp = 0;
+        }
+    }
+}
+
+//io_uring模式：数据已由内核写入接收缓冲区，拷入读缓冲区供状态机解析
+bool http_conn::read_data(const char *buf, int len)
+{
+    if (http2())
+        return http2()->read_data(buf, len);
+    //提交接收前已由prepare_read备好空间
+    if (len > read_room())
         return false;
+    if (!m_read_seg)
+        new_read_seg(READ_BUFFER_SIZE);
+    memcpy(m_read_buf + m_read_idx, buf, len);
+    m_read_idx += len;
+    m_read_buf[m_read_idx] = '\0';
+    return true;
+}
+
+//io_uring模式：内核在提交时拷贝msghdr，iovec仍指向本连接的m_iv或响应批
+struct msghdr *http_conn::get_msghdr()
+{
+    if (http2())
+        return http2()->get_msghdr();
+    memset(&m_msg, 0, sizeof(m_msg));
+    m_msg.msg_iov = iov();
+    m_msg.msg_iovlen = m_iv_count;
+    return &m_msg;
+}
+
+//io_uring模式：SENDMSG完成后更新进度，决定继续发送、继续接收或关闭
+int http_conn::after_send(int n)
+{
+    if (http2())
+        return http2()->after_send(n);
+    update_iov(n);
+    if (bytes_to_send <= 0 && m_stream && !next_stream())
+    {
+        unmap();
+        return -1;
     }
-    m_write_idx += len;
-    va_end(arg_list);
+    if (bytes_to_send > 0)
+        return 1;
 
-    LOG_INFO("request:%s", m_write_buf);
+    if (!m_resp_linger)
+    {
+        unmap();
+        return -1;
+    }
+    finish_write();
+    return m_read_idx > 0 ? 2 : 0;
+}
 
+bool http_conn::add_fragment(const char *str, int len)
+{
+    if (len >= WRITE_BUFFER_SIZE - 1 - m_write_idx)
+        return false;
+    memcpy(m_write_buf + m_write_idx, str, len);
+    m_write_idx += len;
     return true;
 }
+bool http_conn::add_number(unsigned long v)
+{
+    char buf[20];
+    return add_fragment(buf, http_response::itoa(v, buf));
+}
 
 //以下一组函数功能：填充响应报文的各个部分
-bool http_conn::add_status_line(int status, const char *title)
+bool http_conn::add_status_line(int status)
+{
+    const http_status *s = http_response::status(status);
+    return add_fragment(s->line, s->line_len) && add_date() && add_linger();
+}
+bool http_conn::add_headers(off_t content_len)
 {
-    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+    return add_content_length(content_len) && add_blank_line();
 }
-bool http_conn::add_headers(int content_len)
+bool http_conn::add_content_length(off_t content_len)
 {
-    return add_content_length(content_len) && add_linger() &&
-           add_blank_line();
+    return add_fragment("Content-Length:", 15) && add_number(content_len) && add_fragment("\r\n", 2);
 }
-bool http_conn::add_content_length(int content_len)
+bool http_conn::add_content_type(const char *type)
 {
-    return add_response("Content-Length:%d\r\n", content_len);
+    return add_fragment("Content-Type:", 13) && add_fragment(type, strlen(type)) && add_fragment("\r\n", 2);
 }
-bool http_conn::add_content_type()
+bool http_conn::add_date()
 {
-    return add_response("Content-Type:%s\r\n", "text/html");
+    return add_fragment(http_response::date(), http_response::DATE_LEN);
 }
 bool http_conn::add_linger()
 {
-    return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
+    if (!m_linger)
+        return add_fragment("Connection:close\r\n", 18);
+    return add_fragment("Connection:keep-alive\r\n", 23) && add_keep_alive();
+}
+bool http_conn::add_keep_alive()
+{
+    if (!add_fragment(keep_alive_head, keep_alive_len))
+        return false;
+    if (keep_alive_max > 0 && (!add_fragment(", max=", 6) || !add_number(keep_alive_max - m_requests)))
+        return false;
+    return add_fragment("\r\n", 2);
 }
 bool http_conn::add_blank_line()
 {
-    return add_response("%s", "\r\n");
+    return add_fragment("\r\n", 2);
 }
-bool http_conn::add_content(const char *content)
+bool http_conn::add_content(const char *content, int len)
 {
-    return add_response("%s", content);
+    return add_fragment(content, len);
 }
+bool http_conn::add_content_range(off_t start, off_t end)
+{
+    return add_fragment("Content-Range:bytes ", 20) && add_number(start) && add_fragment("-", 1) &&
+           add_number(end) && add_fragment("/", 1) && add_number(file_size()) && add_fragment("\r\n", 2);
+}
+bool http_conn::add_error(int status)
+{
+    const http_status *s = http_response::status(status);
+    return add_status_line(status) && add_fragment(s->head, s->head_len) && add_blank_line() &&
+           add_content(s->body, s->body_len);
+}
+
+//解析Range头部的值，可满足的区间按出现顺序存入ranges，end已截到文件末尾
+//返回区间个数，没有可满足的区间返回0；单位不是bytes、格式错误或区间超过max个返回-1，忽略该头部
+static int parse_range(const char *text, off_t size, off_t ranges[][2], int max)
+{
+    if (strncasecmp(text, "bytes=", 6) != 0)
+        return -1;
+    text += 6;
+
+    int num = 0, specs = 0;
+    while (*text)
+    {
+        text += strspn(text, " \t,");
+        if ('\0' == *text)
+            break;
+        ++specs;
+
+        off_t start, end;
+        char *p;
+        if ('-' == *text)
+        {
+            //后缀区间：最后n个字节
+            if (!isdigit(text[1]))
+                return -1;
+            off_t n = strtoll(text + 1, &p, 10);
+            start = n >= size ? 0 : size - n;
+            end = n > 0 ? size - 1 : -1;
+        }
+        else
+        {
+            if (!isdigit(*text))
+                return -1;
+            start = strtoll(text, &p, 10);
+            if (*p++ != '-')
+                return -1;
+            end = size - 1;
+            if (isdigit(*p))
+            {
+                off_t last = strtoll(p, &p, 10);
+                if (last < start)
+                    return -1;
+                if (last < end)
+                    end = last;
+            }
+        }
+        p += strspn(p, " \t");
+        if (*p != '\0' && *p != ',')
+            return -1;
+        text = p;
+
+        //起点超出文件或空的后缀区间不可满足
+        if (start > end)
+            continue;
+        if (num == max)
+            return -1;
+        ranges[num][0] = start;
+        ranges[num][1] = end;
+        ++num;
+    }
+    return specs > 0 ? num : -1;
+}
+
+//单区间：206 + Content-Range，只发送该区间；sendfile从区间起点开始，mmap模式iovec指向区间
+//本响应的头部从写缓冲区的start处开始
+bool http_conn::add_ranges(int start)
+{
+    off_t ranges[MAX_RANGES][2];
+    int num = parse_range(header(HDR_RANGE), file_size(), ranges, MAX_RANGES);
+    if (num < 0)
+        return false;
+    if (0 == num)
+    {
+        //不发送文件，只发送写缓冲区中的416响应
+        const http_status *s = http_response::status(416);
+        if (!add_status_line(416) || !add_fragment("Content-Range:bytes */", 22) || !add_number(file_size()) ||
+            !add_fragment("\r\n", 2) || !add_fragment(s->head, s->head_len) || !add_blank_line() ||
+            !add_content(s->body, s->body_len))
+            return false;
+        release_file();
+        queue(m_write_buf + start, m_write_idx - start);
+        return true;
+    }
+    if (num > 1)
+        return add_multipart(ranges, num, start);
 
+    off_t len = ranges[0][1] - ranges[0][0] + 1;
+    if (!add_status_line(206) || !add_validators() || !add_content_type(http_response::content_type(m_file->path.c_str())) ||
+        !add_content_range(ranges[0][0], ranges[0][1]) || !add_headers(len))
+        return false;
+    if (m_file_fd >= 0)
+        m_file_offset = ranges[0][0];
+    else
+        m_file_address += ranges[0][0];
+    queue(m_write_buf + start, m_write_idx - start);
+    queue_file(len);
+    return true;
+}
+
+//多区间：multipart/byteranges，各部分的头部依次写入写缓冲区，与文件映射中的区间交替组成iovec
+//sendfile模式也改用映射，由writev一次发送；写缓冲区不够时返回false，已写入的部分由调用者丢弃
+bool http_conn::add_multipart(off_t ranges[][2], int num, int start)
+{
+    static std::atomic<unsigned long> boundary_seq(0);
+    const int BOUNDARY_LEN = 20;
+    if (!m_file->addr)
+        return false;
+
+    char boundary[BOUNDARY_LEN];
+    char seq[20];
+    int n = http_response::itoa(++boundary_seq, seq);
+    memset(boundary, '0', BOUNDARY_LEN - n);
+    memcpy(boundary + BOUNDARY_LEN - n, seq, n);
+    const char *type = http_response::content_type(m_file->path.c_str());
+    int type_len = strlen(type);
+    //先算出消息体长度：每部分的分隔行、Content-Type、Content-Range和空行 + 区间内容，最后是结束分隔行
+    long body = 4 + BOUNDARY_LEN + 4;
+    for (int i = 0; i < num; ++i)
+        body += 4 + BOUNDARY_LEN + 2 + 13 + type_len + 2 + 20 + http_response::itoa(ranges[i][0], seq) + 1 +
+                http_response::itoa(ranges[i][1], seq) + 1 + http_response::itoa(file_size(), seq) + 4 +
+                ranges[i][1] - ranges[i][0] + 1;
+
+    if (!add_status_line(206) || !add_validators() ||
+        !add_fragment("Content-Type:multipart/byteranges; boundary=", 44) || !add_fragment(boundary, BOUNDARY_LEN) ||
+        !add_fragment("\r\n", 2) || !add_headers(body))
+        return false;
+
+    //各部分的头部都写入后才加入iovec，中途失败时不留下一半
+    int part[MAX_RANGES + 1];
+    for (int i = 0; i < num; ++i)
+    {
+        part[i] = m_write_idx;
+        if (!add_fragment("\r\n--", 4) || !add_fragment(boundary, BOUNDARY_LEN) || !add_fragment("\r\n", 2) ||
+            !add_content_type(type) || !add_content_range(ranges[i][0], ranges[i][1]) || !add_blank_line())
+            return false;
+    }
+    part[num] = m_write_idx;
+    if (!add_fragment("\r\n--", 4) || !add_fragment(boundary, BOUNDARY_LEN) || !add_fragment("--\r\n", 4))
+        return false;
+
+    m_file_fd = -1;
+    for (int i = 0; i < num; ++i)
+    {
+        queue(m_write_buf + start, part[i + 1] - start);
+        queue(m_file->addr + ranges[i][0], ranges[i][1] - ranges[i][0] + 1);
+        start = part[i + 1];
+    }
+    queue(m_write_buf + start, m_write_idx - start);
+    return true;
+}
+
+//相邻的两段合并为一个iovec，如流水线上连续几个响应的头部
+void http_conn::queue(const char *base, size_t len)
+{
+    bytes_to_send += len;
+    if (0 == len)
+        return;
+    struct iovec *v = iov();
+    if (m_iv_count > 0 && (char *)v[m_iv_count - 1].iov_base + v[m_iv_count - 1].iov_len == base)
+    {
+        v[m_iv_count - 1].iov_len += len;
+        return;
+    }
+    if (2 == m_iv_count)
+    {
+        use_batch();
+        v = m_batch->iov;
+    }
+    v[m_iv_count].iov_base = (void *)base;
+    v[m_iv_count].iov_len = len;
+    ++m_iv_count;
+}
+
+void http_conn::queue_file(off_t len)
+{
+    if (m_file_fd >= 0)
+        bytes_to_send += len;
+    else
+        queue(m_file_address, len);
+}
+
+
+//为文件缓存生成200响应中Date之后的头部，与process_write逐项生成的一致
+//状态行、Date和长连接的Keep-Alive(带剩余请求数)由process_write写在其前
+int http_conn::render_head(const file_entry *e, bool linger, char *buf, int len)
+{
+    const char *cc = cache_control(e->path.c_str());
+    return snprintf(buf, len, "%s\r\nETag:%s\r\nLast-Modified:%s\r\n%s%s%sContent-Type:%s\r\nContent-Length:%ld\r\n\r\n",
+                    linger ? "Connection:keep-alive" : "Connection:close", e->etag, e->last_modified, cc ? "Cache-Control:" : "",
+                    cc ? cc : "", cc ? "\r\n" : "",
+                    http_response::content_type(e->path.c_str()), (long)e->st.st_size);
+}
+
+void http_conn::set_keep_alive(int timeout, int max)
+{
+    keep_alive_len = snprintf(keep_alive_head, sizeof(keep_alive_head), "Keep-Alive:timeout=%d",
+                              timeout > 0 ? timeout : 1);
+    keep_alive_max = max > 0 ? max : 0;
+}
+
+bool http_conn::set_upload(const char *dir, int limit, int close_log)
+{
+    int m_close_log = close_log;//供LOG宏使用
+    upload_dir = dir;
+    while (upload_dir.size() > 1 && '/' == upload_dir[upload_dir.size() - 1])
+        upload_dir.erase(upload_dir.size() - 1);
+    upload_limit = (long)(limit > 0 ? limit : 0) * 1024 * 1024;
+    if (upload_limit > INT_MAX)
+        upload_limit = INT_MAX;
+    if (!upload_dir.empty() && mkdir(upload_dir.c_str(), 0755) < 0 && EEXIST != errno)
+    {
+        LOG_ERROR("upload dir %s: %s", upload_dir.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void http_conn::set_cache_policy(const char *spec)
+{
+    cache_policy.clear();
+    string rules(spec);
+    size_t pos = 0;
+    while (pos < rules.size())
+    {
+        size_t end = rules.find(';', pos);
+        if (string::npos == end)
+            end = rules.size();
+        string rule = rules.substr(pos, end - pos);
+        size_t colon = rule.find(':');
+        if (colon != string::npos && colon > 0)
+            cache_policy.push_back(make_pair(rule.substr(0, colon), rule.substr(colon + 1)));
+        pos = end + 1;
+    }
+}
+
+const char *http_conn::cache_control(const char *path)
+{
+    const char *name = strrchr(path, '/');
+    const char *ext = strrchr(name ? name : path, '.');
+    const char *value = NULL;
+    for (size_t i = 0; i < cache_policy.size(); ++i)
+    {
+        if (ext && strcasecmp(cache_policy[i].first.c_str(), ext + 1) == 0)
+        {
+            value = cache_policy[i].second.c_str();
+            break;
+        }
+        if ("*" == cache_policy[i].first)
+            value = cache_policy[i].second.c_str();
+    }
+    return value && *value ? value : NULL;
+}
+
+bool http_conn::add_validators()
+{
+    const char *cc = cache_control(m_file->path.c_str());
+    return add_fragment("ETag:", 5) && add_fragment(m_file->etag, strlen(m_file->etag)) &&
+           add_fragment("\r\nLast-Modified:", 16) && add_fragment(m_file->last_modified, strlen(m_file->last_modified)) &&
+           add_fragment("\r\n", 2) &&
+           (!cc || (add_fragment("Cache-Control:", 14) && add_fragment(cc, strlen(cc)) && add_fragment("\r\n", 2)));
+}
+
+//If-None-Match按弱比较匹配列表中任一ETag，*匹配任何存在的文件
+static bool etag_match(const char *list, const char *etag)
+{
+    size_t len = strlen(etag);
+    while (*list)
+    {
+        list += strspn(list, " \t,");
+        if ('*' == *list)
+            return true;
+        if (strncmp(list, "W/", 2) == 0)
+            list += 2;
+        size_t n = strcspn(list, " \t,");
+        if (n == len && strncmp(list, etag, len) == 0)
+            return true;
+        list += n;
+    }
+    return false;
+}
+
+//有If-None-Match时忽略If-Modified-Since
+bool http_conn::not_modified()
+{
+    const char *if_none_match = header(HDR_IF_NONE_MATCH);
+    const char *if_modified_since = header(HDR_IF_MODIFIED_SINCE);
+    if (if_none_match)
+        return etag_match(if_none_match, m_file->etag);
+    if (if_modified_since)
+    {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        if (!strptime(if_modified_since, "%a, %d %b %Y %H:%M:%S GMT", &tm))
+            return false;
+        return m_file->st.st_mtime <= timegm(&tm);
+    }
+    return false;
+}
 
 //根据http请求结果ret去填充响应报文：状态行+头部字段+请求内容
+//响应追加在流水线上之前的响应之后，头部从写缓冲区的当前位置开始
 bool http_conn::process_write(HTTP_CODE ret)
 {
+    //排空期间通知客户端关闭，下一个请求会发到新进程
+    if (m_draining)
+        m_linger = false;
+    //达到每个连接的请求数上限后关闭；不设上限时也计数，HTTP/2前言只接受为第一个请求
+    if (++m_requests >= keep_alive_max && keep_alive_max > 0)
+        m_linger = false;
+    m_resp_linger = m_linger;
+    //生成响应时才借用写缓冲区
+    if (!m_write_buf)
+        m_write_buf = write_pool::get();
+    int start = m_write_idx;
     switch (ret)
     {
     case INTERNAL_ERROR:
-    {
-        add_status_line(500, error_500_title);
-        add_headers(strlen(error_500_form));
-        if (!add_content(error_500_form))
-            return false;
-        break;
-    }
     case BAD_REQUEST:
+    case NO_RESOURCE:
+    case FORBIDDEN_REQUEST:
+    case LENGTH_REQUIRED:
+    case TOO_LARGE:
+    case UPLOADED:
     {
-        add_status_line(404, error_404_title);
-        add_headers(strlen(error_404_form));
-        if (!add_content(error_404_form))
+        //错误响应和201的头部和内容都是预生成的，不发送文件
+        release_file();
+        int status = INTERNAL_ERROR == ret ? 500 : BAD_REQUEST == ret ? 400 : NO_RESOURCE == ret ? 404 :
+                     FORBIDDEN_REQUEST == ret ? 403 : LENGTH_REQUIRED == ret ? 411 : TOO_LARGE == ret ? 413 : 201;
+        if (!add_error(status))
             return false;
         break;
     }
-    case FORBIDDEN_REQUEST:
+    case NOT_MODIFIED:
     {
-        add_status_line(403, error_403_title);
-        add_headers(strlen(error_403_form));
-        if (!add_content(error_403_form))
+        //304没有消息体，不发送文件
+        if (!add_status_line(304) || !add_validators() || !add_blank_line())
             return false;
+        release_file();
         break;
     }
     case FILE_REQUEST:
     {
-        //将响应状态行加入到写缓存区
-        add_status_line(200, ok_200_title);
-        if (m_file_stat.st_size != 0)
-        {   
+        //预生成的响应只在写缓冲区中写状态行、Date和长连接的Keep-Alive，其余头部和内容按连接方式选一份直接发送
+        if (m_file->resp[0] && !header(HDR_RANGE))
+        {
+            const http_status *s = http_response::status(200);
+            if (!add_fragment(s->line, s->line_len) || !add_date() || (m_linger && !add_keep_alive()))
+                return false;
+            queue(m_write_buf + start, m_write_idx - start);
+            queue(m_file->resp[m_linger], m_file->resp_len[m_linger]);
+            return true;
+        }
+        //GET请求带Range时只发送请求的区间，无法按区间响应时丢弃已写入的部分，改为发送整个文件
+        if (header(HDR_RANGE) && GET == m_method && file_size() != 0)
+        {
+            if (add_ranges(start))
+                return true;
+            m_write_idx = start;
+        }
+        if (file_size() != 0)
+        {
             //将响应报文头部字段加入写缓存区
-            add_headers(m_file_stat.st_size);
+            if (!add_status_line(200) || !add_validators() ||
+                !add_content_type(http_response::content_type(m_file->path.c_str())) || !add_headers(file_size()))
+                return false;
             //将两块内存：写缓存区、文件映射区加入数组
-            m_iv[0].iov_base = m_write_buf;
-            m_iv[0].iov_len = m_write_idx;
-            m_iv[1].iov_base = m_file_address;
-            m_iv[1].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
+            queue(m_write_buf + start, m_write_idx - start);
+            queue_file(file_size());
             return true;
         }
         else
         {
             const char *ok_string = "<html><body></body></html>";
-            add_headers(strlen(ok_string));
-            if (!add_content(ok_string))
+            if (!add_status_line(200) || !add_content_type("text/html; charset=utf-8") ||
+                !add_headers(strlen(ok_string)) || !add_content(ok_string, strlen(ok_string)))
                 return false;
         }
+        break;
+    }
+    case STREAM_REQUEST:
+    {
+        //目前只有目录索引，由fill_stream分段生成
+        return add_stream("text/html; charset=utf-8");
     }
     default:
         return false;
     }
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    queue(m_write_buf + start, m_write_idx - start);
+    return true;
+}
+
+//写缓冲区末尾为当前块的\r\n和最后一块"0\r\n\r\n"留出的空间
+static const int STREAM_TAIL = 8;
+
+//内容长度事先未知：HTTP/1.1按块编码发送，HTTP/1.0以关闭连接标志内容结束
+//头部和第一段一起发出，不必等整个内容生成
+bool http_conn::add_stream(const char *type)
+{
+    if (!m_http11)
+        m_linger = m_resp_linger = false;
+    int start = m_write_idx;
+    if (!add_status_line(200) || !add_content_type(type) ||
+        (m_http11 && !add_fragment("Transfer-Encoding:chunked\r\n", 27)) || !add_blank_line())
+        return false;
+    queue(m_write_buf + start, m_write_idx - start);
+    m_stream = true;
+    return fill_stream(true);
+}
+
+//块大小固定占4个十六进制数字，先占位，处理函数写完内容后再填，前导的0是允许的
+//没有内容时不发空块，空块表示内容结束
+bool http_conn::fill_stream(bool first)
+{
+    int start = m_write_idx;
+    if (m_http11 && !add_fragment("0000\r\n", 6))
+        return false;
+    int body = m_write_idx;
+    int ret = stream_index(first);
+    if (ret < 0)
+        return false;
+    if (m_http11)
+    {
+        int len = m_write_idx - body;
+        if (0 == len)
+            m_write_idx = start;
+        else
+        {
+            static const char hex[] = "0123456789abcdef";
+            for (int i = 3; i >= 0; --i, len >>= 4)
+                m_write_buf[start + i] = hex[len & 15];
+            memcpy(m_write_buf + m_write_idx, "\r\n", 2);
+            m_write_idx += 2;
+        }
+        if (0 == ret)
+        {
+            memcpy(m_write_buf + m_write_idx, "0\r\n\r\n", 5);
+            m_write_idx += 5;
+        }
+    }
+    if (0 == ret)
+        end_stream();
+    queue(m_write_buf + start, m_write_idx - start);
+    return true;
+}
+
+//上一段连同同一批中之前的响应都已发完，写缓冲区从头使用
+bool http_conn::next_stream()
+{
+    release_batch();
+    bytes_have_send = 0;
+    m_write_idx = 0;
+    //跳过了放不下的目录项时这一段可能为空，接着生成
+    while (m_stream && 0 == bytes_to_send)
+    {
+        if (!fill_stream(false))
+            return false;
+    }
     return true;
 }
 
+void http_conn::end_stream()
+{
+    m_stream = false;
+    if (m_aux && m_aux->dir)
+    {
+        closedir(m_aux->dir);
+        m_aux->dir = NULL;
+        m_aux->pending = NULL;
+        release_aux();
+    }
+}
+
+bool http_conn::add_stream_text(const char *str, int len)
+{
+    if (len > WRITE_BUFFER_SIZE - STREAM_TAIL - m_write_idx)
+        return false;
+    memcpy(m_write_buf + m_write_idx, str, len);
+    m_write_idx += len;
+    return true;
+}
+
+//url为true时除不保留字符外都按%XX编码，否则转义HTML的特殊字符
+bool http_conn::add_stream_escaped(const char *str, bool url)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    for (; *str; ++str)
+    {
+        unsigned char c = *str;
+        bool ok;
+        if (url)
+        {
+            if (isalnum(c) || strchr("-._~", c))
+                ok = add_stream_text(str, 1);
+            else
+            {
+                char esc[3] = {'%', hex[c >> 4], hex[c & 15]};
+                ok = add_stream_text(esc, 3);
+            }
+        }
+        else
+        {
+            switch (c)
+            {
+            case '&':
+                ok = add_stream_text("&amp;", 5);
+                break;
+            case '<':
+                ok = add_stream_text("&lt;", 4);
+                break;
+            case '>':
+                ok = add_stream_text("&gt;", 4);
+                break;
+            case '"':
+                ok = add_stream_text("&quot;", 6);
+                break;
+            default:
+                ok = add_stream_text(str, 1);
+                break;
+            }
+        }
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+//url在请求处理完后失效，标题只能在第一段写出；url不以/结尾时用base使相对链接指向目录内
+//目录项放不下时留到下一段，不用seekdir退回，seekdir会丢弃已读入的一批目录项；空段也放不下的超长文件名跳过
+//以.开头的文件不列出
+int http_conn::stream_index(bool first)
+{
+    bool wrote = first;
+    if (first)
+    {
+        bool slash = '/' == m_url[strlen(m_url) - 1];
+        if (!add_stream_text("<html><head><meta charset=\"utf-8\"><title>Index of ", 50) ||
+            !add_stream_escaped(m_url, false) || !add_stream_text("</title>", 8) ||
+            (!slash && (!add_stream_text("<base href=\"", 12) || !add_stream_escaped(m_url, false) ||
+                        !add_stream_text("/\">", 3))) ||
+            !add_stream_text("</head><body><h1>Index of ", 26) || !add_stream_escaped(m_url, false) ||
+            !add_stream_text("</h1><hr><pre><a href=\"../\">../</a>\n", 36))
+            return -1;
+    }
+    while (true)
+    {
+        struct dirent *ent = m_aux->pending;
+        m_aux->pending = NULL;
+        if (!ent)
+        {
+            errno = 0;
+            ent = readdir(m_aux->dir);
+        }
+        if (!ent)
+        {
+            if (errno)
+                return -1;
+            return add_stream_text("</pre><hr></body></html>\n", 25) ? 0 : 1;
+        }
+        if ('.' == ent->d_name[0])
+            continue;
+        bool dir = DT_DIR == ent->d_type;
+        int mark = m_write_idx;
+        if (add_stream_text("<a href=\"", 9) && add_stream_escaped(ent->d_name, true) &&
+            (!dir || add_stream_text("/", 1)) && add_stream_text("\">", 2) &&
+            add_stream_escaped(ent->d_name, false) && (!dir || add_stream_text("/", 1)) &&
+            add_stream_text("</a>\n", 5))
+        {
+            wrote = true;
+            continue;
+        }
+        m_write_idx = mark;
+        if (!wrote)
+            continue;
+        m_aux->pending = ent;
+        return 1;
+    }
+}
+
 //由线程池工作线程调用，这是处理HTTP请求的入口函数
+//流水线：读缓冲区中已有后续请求时接着处理，各响应依次追加，由一次writev发出
 void http_conn::process()
 {
+    if (http2())
+    {
+        http2()->process();
+        return;
+    }
+    //TLS握手在工作线程中进行，完成后读入随握手一起到达的请求
+    if (tls() && !SSL_is_init_finished(tls()))
+    {
+        int ret = tls_context::get_instance()->handshake(tls());
+        if (ret < 0 || (ret > 0 && !read_once()))
+        {
+            notify(completion_queue::CLOSE);
+            return;
+        }
+        if (0 == ret)
+        {
+            rearm(SSL_want_write(tls()) ? EPOLLOUT : EPOLLIN);
+            return;
+        }
+    }
     //分析整个请求报文的结果ret
     HTTP_CODE read_ret = process_read();
+    //已解密但读缓冲区放不下的数据留在OpenSSL中，epoll看不到，在这里接着读
+    while (read_ret == NO_REQUEST && tls() && SSL_pending(tls()) > 0)
+    {
+        if (!read_once())
+        {
+            notify(completion_queue::CLOSE);
+            return;
+        }
+        read_ret = process_read();
+    }
     //请求不完整，需要继续读取
     if (read_ret == NO_REQUEST)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+        rearm(EPOLLIN);
+        return;
+    }
+    //前言的第一行在请求行阶段识别，Upgrade在头部解析完后识别
+    if (read_ret == UPGRADE_REQUEST)
+    {
+        start_http2(CHECK_STATE_HEADER == m_check_state);
         return;
     }
 
-    //根据请求的结果，写内容
-    bool write_ret = process_write(read_ret);
-    if (!write_ret)
+    while (true)
     {
-        close_conn();
+        //根据请求的结果，写内容
+        bool write_ret = process_write(read_ret);
+        if (!write_ret)
+        {
+            //不在工作线程直接关闭，交由反应堆关闭连接并移除定时器
+            notify(completion_queue::CLOSE);
+            return;
+        }
+        finish_request();
+        if (!can_batch())
+            break;
+        stash_file();
+        //下一个请求不完整时先发送已生成的响应，发完后接着读
+        read_ret = process_read();
+        if (read_ret == NO_REQUEST)
+            break;
     }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+    rearm(EPOLLOUT);
+}
+
+//重新注册EPOLLONESHOT事件
+//io_uring模式下没有epoll内核事件表，由所属反应堆提交下一次接收或发送
+void http_conn::rearm(int ev)
+{
+    if (m_epollfd < 0)
+        notify(EPOLLOUT == ev ? completion_queue::WRITE : completion_queue::READ);
+    else
+        modfd(m_epollfd, m_sockfd, ev, m_TRIGMode);
 }
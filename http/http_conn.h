@@ -7,33 +7,64 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <assert.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <ctype.h>
+#include <time.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <sys/mman.h>
 #include <stdarg.h>
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
+#include <stdint.h>
+#include <sys/sendfile.h>
+#include <dirent.h>
 #include <map>
+#include <vector>
+#include <atomic>
 
 #include "../lock/locker.h"
+#include "../lock/completion_queue.h"
 #include "../CGImysql/sql_connection_pool.h"
 #include "../timer/lst_timer.h"
 #include "../log/log.h"
+#include "../cache/file_cache.h"
+#include "../slab/buffer_pool.h"
+#include "../tls/tls.h"
+#include "http_scan.h"
+#include "http_header.h"
+#include "http_router.h"
+#include "http_response.h"
 
-class http_conn
+class http2_session;
+
+//按缓存行对齐，热数据不与相邻连接对象共享缓存行
+class alignas(64) http_conn
 {
+    //HTTP/2的会话转调连接的收发，并借用其请求处理
+    friend class http2_session;
+
 public:
     static const int FILENAME_LEN = 200;
-    //读缓冲区
+    static const int MAX_RANGES = 8;    //一个请求最多响应的Range区间数，超过按整个文件响应
+    static const int PIPELINE_DEPTH = 16;   //流水线上一次合并发送的响应数上限
+    //读缓冲段，请求超过一段时再借一段
     static const int READ_BUFFER_SIZE = 2048;
     //写缓冲区
     static const int WRITE_BUFFER_SIZE = 1024;
+    //上传时每次从socket经管道移入文件的字节数，即默认的管道容量
+    static const int UPLOAD_PIPE_SIZE = 65536;
+    static const int CLOSED_BIT = 1 << 30; //client_data::inflight的关闭标记
+    struct aux_state;
+    struct read_seg;
+    struct body_reader;
     //HTTP请求方法
     enum METHOD
     {
@@ -63,9 +94,24 @@ public:
         NO_RESOURCE,//没有访问的资源
         FORBIDDEN_REQUEST,//客户没有访问权限
         FILE_REQUEST,//文件请求
+        NOT_MODIFIED,//客户端缓存的文件仍有效
+        STREAM_REQUEST,//响应内容由处理函数分段生成，长度事先未知
+        UPLOADED,//上传的文件已保存
+        LENGTH_REQUIRED,//上传没有给出Content-Length
+        TOO_LARGE,//上传的消息体超过上限
         INTERNAL_ERROR,//服务器内部错误
+        UPGRADE_REQUEST,//连接转为HTTP/2
         CLOSED_CONNECTION//客户端已经关闭连接
     };
+    //块编码消息体的解码状态，CHUNK_NONE表示消息体不是块编码
+    enum CHUNK_STATE
+    {
+        CHUNK_NONE = 0,
+        CHUNK_SIZE,//块大小行
+        CHUNK_DATA,//块内容
+        CHUNK_DATA_END,//块内容之后的\r\n
+        CHUNK_TRAILER//最后一块之后的尾部头部，空行结束
+    };
     //从状态机：行读取状态
     enum LINE_STATUS
     {
@@ -75,132 +121,373 @@ public:
     };
 
 public:
-    http_conn() {}
-    ~http_conn() {}
+    http_conn() : m_headers(NULL), m_file_address(NULL), m_file_fd(-1), m_batch(NULL), m_aux(NULL), m_file(NULL), m_read_seg(NULL), m_read_buf(NULL), m_write_buf(NULL) {}
+    ~http_conn() { unmap(); release_buffers(); }
 
 public:
-    //初始化新接受的连接
-    void init(int sockfd, const sockaddr_in &addr, char *, int, int, string user, string passwd, string sqlname);
+    //初始化新接受的连接，epollfd、cq为该连接所属反应堆的内核事件表和完成队列
+    void init(int sockfd, const sockaddr_in &addr, int epollfd, completion_queue *cq, char *, int, int);
     //关闭连接
     void close_conn(bool real_close = true);
     //处理客户请求
     void process();
     //非阻塞读操作
     bool read_once();
-    //非阻塞写操作
-    bool write();
+    //非阻塞写操作：0需要关闭连接，1已重新注册事件，2读缓冲区中还有流水线上的请求，需再次process
+    int write();
+    //工作线程向所属反应堆回报事件，如请求关闭连接
+    void notify(int event)
+    {
+        m_cq->push(m_sockfd, m_timer_data.gen, event);
+    }
+    //交给线程池前由反应堆调用，工作线程处理完一次后调用leave_worker
+    void enter_worker() { m_timer_data.inflight.fetch_add(1); }
+    //期间连接已被关闭且这是最后一次处理时，经完成队列通知反应堆释放；返回后不再访问本对象
+    void leave_worker();
+    //反应堆关闭连接时调用：仍有工作线程持有时只做标记，socket和连接对象留到leave_worker通知后再释放
+    bool defer_close();
+    bool closing() const { return m_timer_data.inflight.load() & CLOSED_BIT; }
+
+    /*以下一组函数被io_uring事件循环调用，收发由内核完成，连接只负责缓冲区*/
+    //把内核选取的接收缓冲区中的数据拷入读缓冲区
+    bool read_data(const char *buf, int len);
+    //读缓冲区剩余空间，当前段已满时借入新段，超过请求头或消息体上限时返回0
+    int prepare_read();
+    //指向待发送iovec的msghdr，用于提交SENDMSG
+    struct msghdr *get_msghdr();
+    //SENDMSG发送n字节后更新进度：1仍有数据待发送，0长连接已重置，2读缓冲区中还有流水线上的请求，-1需要关闭连接
+    int after_send(int n);
 
     sockaddr_in *get_address()
     {
         return &m_address;
     }
+    //当前请求的头部值，没有时返回NULL，在请求处理完之前有效
+    const char *header(HEADER_ID id) const
+    {
+        const header_field *f = m_headers ? m_headers->get(id) : NULL;
+        return f ? f->value : NULL;
+    }
+    //当前请求的全部头部，未收到请求行时为NULL
+    const header_index *headers() const { return m_headers; }
+    //连接已转为HTTP/2时的会话，否则为NULL
+    http2_session *http2() const { return m_aux ? m_aux->h2 : NULL; }
+    //TLS连接的SSL对象，明文连接为NULL
+    SSL *tls() const { return m_aux ? m_aux->ssl : NULL; }
     
-    //初始化一个数据库连接
-    void initmysql_result(connection_pool *connPool);
+    //连接关闭时把借用的读写缓冲区和头部索引还给缓冲池
+    void release_buffers();
+    //释放本批响应持有的文件引用和响应批
+    void unmap();
 
-    
-    int timer_flag;
-    int improv;
+    //从数据库读取用户表，结果存入全局map，只在启动时调用一次
+    static void initmysql_result(connection_pool *connPool, int close_log);
 
 
 private:
     //初始化连接
     void init();
+    //重置请求解析状态，准备解析下一个请求
+    void reset_request();
+    //当前请求处理完：读缓冲区中其后的数据移到段首，留给下一个请求
+    void finish_request();
+    //一批响应发完，重置发送状态，归还写缓冲区
+    void finish_write();
+    //当前响应之后能否在同一批中继续处理流水线上的下一个请求
+    bool can_batch();
+    //流水线上继续处理下一个请求前，当前响应的文件引用转入响应批
+    void stash_file();
+    //改用响应批，已有的iovec拷入其中
+    void use_batch();
     //从状态：用以解析HTTP请求
     HTTP_CODE process_read();
     //填充HTTP应答
     bool process_write(HTTP_CODE ret);
+    //重新注册读/写事件，io_uring模式下改为通知反应堆提交收发
+    void rearm(int ev);
+    //发送temp字节后更新计数和iovec
+    void update_iov(int temp);
+    //socket上可直接写明文：没有TLS，或发送方向已交给内核TLS加密
+    bool plain_send() const { return !tls() || tls_context::ktls_send(tls()); }
+    //收发经TLS时由OpenSSL解密、加密，返回值与recv、writev相同；一次最多发送limit字节
+    ssize_t sock_recv(char *buf, int len);
+    ssize_t send_iov(size_t limit);
+    //sendfile模式发送一次：先发报文头，再由内核直接从文件发送，最多limit字节
+    ssize_t send_file(size_t limit);
 
     /*以下一组函数被process_read调用*/
     //分析请求行
-    HTTP_CODE parse_request_line(char *text);
+    HTTP_CODE parse_request_line(char *text, int len);
     //分析头部字段
-    HTTP_CODE parse_headers(char *text);
+    HTTP_CODE parse_headers(char *text, int len);
     //分析HTTP请求的入口函数
     HTTP_CODE parse_content(char *text);
+    //块编码的消息体，边收边解码
+    HTTP_CODE parse_chunked();
+    //上传：检查长度和文件名，打开上传目录下的临时文件，消息体由save_body写入
+    HTTP_CODE start_upload();
+    HTTP_CODE save_body();
+    //关闭临时文件和管道，keep为true时改名为正式文件，否则删除
+    bool end_upload(bool keep);
+    bool uploading() const { return m_aux && m_aux->upload_fd >= 0; }
+    //按需分配m_aux，目录索引、上传、HTTP/2和TLS都结束后释放
+    aux_state *aux();
+    void release_aux();
+    //转为HTTP/2：upgrade为true时是Upgrade: h2c，当前请求作为流1响应；否则读缓冲区以前言开头
+    void start_http2(bool upgrade);
+    //HTTP/2的一个流：借用请求的状态调用do_request，file交给流持有；消息体保存在从body起的段中，未保存时为NULL
+    HTTP_CODE h2_request(METHOD method, char *url, read_seg *body, int body_len, file_entry *&file);
+    //HTTP/2的流借用头部索引，清空后返回
+    header_index *h2_headers();
     //
     HTTP_CODE do_request();
+    //路由的处理函数，返回要显示的页面，消息体未完整保存时返回NULL
+    const char *do_login();
+    const char *do_register();
+    //从消息体user=123&passwd=123中取出用户名和密码
+    bool parse_user(char *name, char *password);
+    //从头读取当前请求的消息体，消息体未保存时没有内容
+    body_reader body() const;
     char *get_line() { return m_read_buf + m_start_line; };
     LINE_STATUS parse_line();
 
     /*下面一组函数被process_write调用*/
 
-    void unmap();
-    bool add_response(const char *format, ...);
-    bool add_content(const char *content);
-    bool add_status_line(int status, const char *title);
-    bool add_headers(int content_length);
-    bool add_content_type();
-    bool add_content_length(int content_length);
+    //写缓冲区空间不足时返回false
+    bool add_fragment(const char *str, int len);
+    bool add_number(unsigned long v);
+    bool add_content(const char *content, int len);
+    //状态行及Date、Connection等通用头部
+    bool add_status_line(int status);
+    //Content-Length和结束头部的空行
+    bool add_headers(off_t content_length);
+    bool add_content_type(const char *type);
+    bool add_content_length(off_t content_length);
+    bool add_date();
+    //Connection，长连接另有Keep-Alive
     bool add_linger();
+    //Keep-Alive，-K限制请求数时带剩余请求数
+    bool add_keep_alive();
     bool add_blank_line();
+    bool add_content_range(off_t start, off_t end);
+    //状态行 + 预生成的头部和内容
+    bool add_error(int status);
+    //文件响应的ETag、Last-Modified和Cache-Control
+    bool add_validators();
+    //按If-None-Match、If-Modified-Since判断客户端缓存是否仍有效
+    bool not_modified();
+    //按Range头部只发送请求的区间，区间无效或过多时返回false，按整个文件响应
+    bool add_ranges(int start);
+    bool add_multipart(off_t ranges[][2], int num, int start);
+    //把一段数据追加到待发送的iovec，iovec超过两个时改用响应批
+    void queue(const char *base, size_t len);
+    //追加文件内容，sendfile模式只计入待发送字节数
+    void queue_file(off_t len);
+    //释放当前响应的目标文件
+    void release_file();
+    //释放响应批及其中的文件引用
+    void release_batch();
+    off_t file_size() const { return m_file->st.st_size; }
+
+    /*流式响应：内容由处理函数分段生成，每段不超过写缓冲区，发完一段再生成下一段
+    HTTP/1.1按块编码发送，HTTP/1.0不分块，发完后关闭连接*/
+    //状态行、Content-Type和Transfer-Encoding，并生成第一段
+    bool add_stream(const char *type);
+    //生成一段追加到写缓冲区并加入待发送的iovec，内容结束时附上最后一块；出错返回false
+    bool fill_stream(bool first);
+    //上一段发完后重置写缓冲区，生成下一段
+    bool next_stream();
+    //结束流式响应，释放处理函数的状态
+    void end_stream();
+    //处理函数向当前段追加内容，写缓冲区末尾留出结束流的空间，放不下时返回false
+    bool add_stream_text(const char *str, int len);
+    //追加HTML转义或URL百分号编码后的文本
+    bool add_stream_escaped(const char *str, bool url);
+    //目录索引的处理函数：第一段先写标题，每段写尽量多的目录项；返回1还有内容，0已写完，-1出错
+    int stream_index(bool first);
+    struct iovec *iov() { return m_batch ? m_batch->iov : m_iv; }
+
+    //当前段剩余空间，末尾留一个字节放'\0'，尚未借用时按一个标准段计算
+    int read_room() { return (m_read_seg ? m_read_seg->size : READ_BUFFER_SIZE) - 1 - m_read_idx; }
+    //借入一个新段挂到链表头，size为数据区大小
+    void new_read_seg(int size);
+    //当前段中的消息体已收满，借入新段接着收，不拷贝；块编码时只把未解码的部分拷到新段开头
+    int next_body_seg();
+    //归还读缓冲段链表
+    void release_read_segs();
+    void release_headers();
+    //当前请求的路由允许的消息体上限
+    int body_limit();
+    //当前请求的消息体由处理函数读取，需要保存
+    bool read_body() const { return m_route && m_route->read_body; }
 
 public:
-    //所有socket上事件被注册到一个epoll内核事件表中
-    static int m_epollfd;
-    //统计用户数量
-    static int m_user_count;
-    //该http关联的mysql连接
-    MYSQL *mysql;
-    int m_state;  //读为0, 写为1
+    //读缓冲段，prev指向较早的段，next指向较晚的段，已解析的行留在原段中直到请求处理完
+    //标准段来自缓冲池；单行超过一段时改用malloc的加倍大段，buf实际长度为size
+    //消息体可以跨多段，在各段中占[start, end)，最后一段的结束位置由消息体长度算出
+    struct read_seg
+    {
+        read_seg *prev;
+        read_seg *next;
+        int size;
+        int start;
+        int end;
+        char buf[READ_BUFFER_SIZE];
+    };
+    //借入一个数据区为size字节的段并归还，标准段来自缓冲池，更大的段malloc
+    static read_seg *get_read_seg(int size);
+    static void put_read_seg(read_seg *seg);
+    //按段依次读取消息体，取出的内容指向读缓冲段，不拷贝
+    struct body_reader
+    {
+        const read_seg *seg;
+        int left;   //尚未取出的字节数
+    };
+    //取出下一块连续的内容，返回长度，读完时返回0
+    static int body_next(body_reader &r, const char *&data);
+    typedef buffer_pool<sizeof(read_seg)> read_pool;
+    typedef buffer_pool<WRITE_BUFFER_SIZE> write_pool;
+    typedef buffer_pool<sizeof(header_index)> header_pool;
+    //流水线上合并发送的一批响应：各响应的iovec依次排列，已处理完的请求的文件引用在发完前一直持有
+    struct resp_batch
+    {
+        int nfiles;
+        file_entry *files[PIPELINE_DEPTH];
+        struct iovec iov[2 * PIPELINE_DEPTH + 2 * MAX_RANGES + 1];
+    };
+    typedef buffer_pool<sizeof(resp_batch)> batch_pool;
+    //按需分配的冷数据：目录索引和上传不会同时进行，各自结束时释放；HTTP/2的连接不再有两者，TLS连接一直持有
+    struct aux_state
+    {
+        //目录索引：打开的目录，以及上一段放不下、留到下一段的目录项(在下一次readdir之前有效)
+        DIR *dir;
+        struct dirent *pending;
+        //上传：临时文件、socket到文件的管道和临时文件的路径，收完后改名为正式文件
+        int upload_fd;
+        int pipe[2];
+        char part[FILENAME_LEN + 16];
+        //HTTP/2：连接转为HTTP/2后一直持有
+        http2_session *h2;
+        //TLS：从接受连接到关闭一直持有
+        SSL *ssl;
+    };
+
+    //统计用户数量，多个反应堆线程并发增减
+    static std::atomic<int> m_user_count;
+    //平滑升级后旧进程排空连接：不再保持长连接，响应发完即关闭
+    static std::atomic<bool> m_draining;
+    //请求头和消息体的长度上限(字节)，启动时设置
+    static int m_max_head;
+    static int m_max_body;
+    //静态文件用sendfile发送，否则mmap后writev，启动时设置
+    static bool m_sendfile;
+    //为文件缓存预生成响应头，见render_func
+    static int render_head(const file_entry *e, bool linger, char *buf, int len);
+    //长连接的空闲超时(秒)和每个连接最多处理的请求数(0为不限)，用于Keep-Alive头部，启动时设置
+    static void set_keep_alive(int timeout, int max);
+    //按扩展名设置Cache-Control，格式为"扩展名:值;扩展名:值"，*匹配其余文件，启动时设置
+    static void set_cache_policy(const char *spec);
+    //path对应的Cache-Control值，没有时返回NULL
+    static const char *cache_control(const char *path);
+    //请求目录时按块编码返回目录索引，否则返回400，启动时设置
+    static bool m_autoindex;
+    //接受HTTP/2(h2c)的前言和Upgrade: h2c，启动时设置
+    static bool m_http2;
+    //一次写事件最多发送的字节数(0为不限)，用完后让出线程并重新注册EPOLLOUT，大文件与小页面轮流发送，启动时设置
+    static int m_write_quantum;
+    //上传目录和单个上传的长度上限(MB)，dir为空时不接受上传，目录不存在时创建，失败返回false；日志初始化后设置
+    static bool set_upload(const char *dir, int limit, int close_log);
 
+    /*成员按访问频率排列：每次事件分发都要访问的热数据集中在对象开头的一条缓存行，
+    其后是定时器节点，请求解析中的指针和文件信息次之，读写缓冲区按需从缓冲池借用*/
+public:
+    int m_state;  //读为0, 写为1
 private:
     //该HTTP连接的socket标识符
     int m_sockfd;
-    //该HTTP连接对方的socket地址
-    sockaddr_in m_address;
-    //读缓冲区
-    char m_read_buf[READ_BUFFER_SIZE];
+    //该连接注册所在的epoll内核事件表，多反应堆下每个事件循环各有一个
+    int m_epollfd;
+    int m_TRIGMode;
+    int m_close_log;
     //标识读缓冲区已经读入的客户数据的最后一个字节的下一个位置
     int m_read_idx;
     //当前正在分析的字符在读缓冲区的位置
     int m_checked_idx;
     //但前正在解析的行的起始位置
     int m_start_line;
-    //写缓冲区
-    char m_write_buf[WRITE_BUFFER_SIZE];
     //写缓冲区待发送的字节数
     int m_write_idx;
-
     //主状态机当前所处的状态
     CHECK_STATE m_check_state;
     //请求方法
     METHOD m_method;
+    //HTTP请求是否保持长连接
+    bool m_linger;
+    //正在发送的这批响应发完后是否保持连接，下一个请求解析时m_linger已被重置
+    bool m_resp_linger;
+    //请求的HTTP版本为1.1，响应可以使用块编码
+    bool m_http11;
+    //正在发送流式响应，一段发完后由fill_stream生成下一段
+    bool m_stream;
+    int bytes_to_send;//剩余发送的字节数
+    int bytes_have_send;//已发送字节数
+    //所属反应堆的完成队列，reactor模式下工作线程经此通知事件循环
+    completion_queue *m_cq;
+
+public:
+    //定时器节点和回调数据嵌在连接对象内，与热数据相邻，随连接一起分配和归还
+    util_timer m_timer;
+    client_data m_timer_data;
+    //该http关联的mysql连接
+    MYSQL *mysql;
 
-    //客户请求的目标文件的完整路径，其内容等于doc_root+m_url,doc_root是网站根目录
-    char m_real_file[FILENAME_LEN];
+private:
     //客户请求的目标文件的文件名
     char *m_url;
-    //HTTP版本
-    char *m_version;
-    //主机名
-    char *m_host;
-    //http请求消息体的长度
+    //请求头部索引，指向读缓冲区，从缓冲池借用，连接空闲时为NULL
+    header_index *m_headers;
+    //请求行匹配的路由，没有时按静态文件处理
+    const route *m_route;
+    //消息体所在的第一个读缓冲段，消息体未保存时为NULL
+    read_seg *m_body;
+    //http请求消息体的长度，块编码时为已解码的长度
     int m_content_length;
-    //HTTP请求是否保持长连接
-    bool m_linger;
-
+    //块编码：当前块尚未收到的字节数
+    int m_chunk_left;
     //客户请求的目标文件被mmap到内存的起始位置
     char *m_file_address;
-    //目标文件的状态：是否存在、是否为目录、是否可读，并获取文件大小等信息
-    struct stat m_file_stat;
+    //sendfile模式下打开的目标文件及下一次发送的偏移，未使用时为-1
+    int m_file_fd;
+    int m_iv_count;     //待发送iovec的个数，与m_file_fd相邻以免留出空隙
+    off_t m_file_offset;
     //集中写：将多个分散的内存数据一起写入文件描述符中
+    //单个响应通常只用m_iv，多区间或流水线上的多个响应改用从缓冲池借的响应批
     struct iovec m_iv[2];
-    int m_iv_count;
+    resp_batch *m_batch;
+    struct msghdr m_msg;
 
-    int cgi;        //是否启用的POST
-    char *m_string; //存储请求头数据
-    int bytes_to_send;//剩余发送的字节数
-    int bytes_have_send;//已发送字节数
+    //以下为冷数据，只在建立连接或打开文件时访问
+    //该HTTP连接对方的socket地址
+    sockaddr_in m_address;
     char *doc_root;
+    //目录索引、上传、HTTP/2或TLS的状态，其间持有
+    aux_state *m_aux;
+    //目标文件在文件缓存中的项，发送期间持有引用
+    file_entry *m_file;
 
-    map<string, string> m_users;//用户名：密码
-    int m_TRIGMode;
-    int m_close_log;
+    //本连接已响应的请求数
+    int m_requests;
+    //之前各段中请求头的字节数
+    int m_head_len;
+    //消息体在之前各段中的字节数，不保存的消息体为已丢弃的字节数
+    int m_body_read;
+    //块编码消息体的解码状态
+    CHUNK_STATE m_chunk_state;
 
-    char sql_user[100];//数据库用户名
-    char sql_passwd[100];//数据库用户密码
-    char sql_name[100];//表名
+    //读写缓冲区从缓冲池借用，连接空闲时为NULL，m_read_buf指向当前段，段长见m_read_seg->size
+    read_seg *m_read_seg;
+    char *m_read_buf;
+    char *m_write_buf;
 };
 
 #endif
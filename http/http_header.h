@@ -0,0 +1,124 @@
+#ifndef HTTP_HEADER_H
+#define HTTP_HEADER_H
+
+/*************************************************************
+*请求头部索引
+*每个头部只记录名字和值在读缓冲区中的位置，不拷贝
+*常用头部由编译期生成的完美哈希表映射为编号，按编号O(1)取值，不必再逐个比较名字
+**************************************************************/
+
+#include <string.h>
+#include <strings.h>
+#include "perfect_hash.h"
+
+//常用头部编号，与header_names中的顺序一致
+enum HEADER_ID
+{
+    HDR_HOST = 0,
+    HDR_CONNECTION,
+    HDR_KEEP_ALIVE,
+    HDR_CONTENT_LENGTH,
+    HDR_CONTENT_TYPE,
+    HDR_TRANSFER_ENCODING,
+    HDR_EXPECT,
+    HDR_UPGRADE,
+    HDR_HTTP2_SETTINGS,
+    HDR_RANGE,
+    HDR_IF_RANGE,
+    HDR_IF_NONE_MATCH,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_ACCEPT,
+    HDR_ACCEPT_ENCODING,
+    HDR_ACCEPT_LANGUAGE,
+    HDR_USER_AGENT,
+    HDR_REFERER,
+    HDR_COOKIE,
+    HDR_AUTHORIZATION,
+    HDR_CACHE_CONTROL,
+    HDR_ORIGIN,
+    HDR_NUM,
+    HDR_OTHER = HDR_NUM //不在表中的头部
+};
+
+namespace header_hash
+{
+constexpr const char *header_names[HDR_NUM] = {
+    "Host", "Connection", "Keep-Alive", "Content-Length", "Content-Type", "Transfer-Encoding", "Expect",
+    "Upgrade", "HTTP2-Settings", "Range", "If-Range", "If-None-Match", "If-Modified-Since", "Accept",
+    "Accept-Encoding", "Accept-Language", "User-Agent", "Referer", "Cookie", "Authorization", "Cache-Control",
+    "Origin",
+};
+
+struct keys
+{
+    static const int num = HDR_NUM;
+    static const bool icase = true;
+    static constexpr const char *key(int i) { return header_names[i]; }
+};
+
+constexpr perfect_hash::table<keys, 6> TABLE = perfect_hash::build<keys, 6>();
+}
+
+//名字为name的头部的编号，不在表中时为HDR_OTHER
+inline HEADER_ID header_id(const char *name, int len)
+{
+    int id = header_hash::TABLE.find(name, len);
+    return id < 0 ? HDR_OTHER : (HEADER_ID)id;
+}
+
+//一个头部：name不以'\0'结尾，value以'\0'结尾，已去掉两端的空白
+struct header_field
+{
+    const char *name;
+    const char *value;
+    int name_len;
+    int value_len;
+    HEADER_ID id;
+};
+
+//一个请求的全部头部，按出现顺序排列，常用头部另按编号记录第一次出现的位置
+struct header_index
+{
+    static const int MAX_HEADERS = 64;
+
+    int num;
+    signed char known[HDR_NUM];
+    header_field fields[MAX_HEADERS];
+
+    void clear()
+    {
+        num = 0;
+        memset(known, -1, sizeof(known));
+    }
+    //头部过多时返回NULL
+    header_field *add(const char *name, int name_len, const char *value, int value_len)
+    {
+        if (num >= MAX_HEADERS)
+            return NULL;
+        header_field *f = &fields[num];
+        f->name = name;
+        f->name_len = name_len;
+        f->value = value;
+        f->value_len = value_len;
+        f->id = header_id(name, name_len);
+        if (HDR_OTHER != f->id && known[f->id] < 0)
+            known[f->id] = num;
+        ++num;
+        return f;
+    }
+    //按编号取常用头部，没有时返回NULL
+    const header_field *get(HEADER_ID id) const { return known[id] < 0 ? NULL : &fields[known[id]]; }
+    //按名字查找任意头部，逐个比较
+    const header_field *find(const char *name) const
+    {
+        int len = strlen(name);
+        for (int i = 0; i < num; ++i)
+        {
+            if (fields[i].name_len == len && 0 == strncasecmp(fields[i].name, name, len))
+                return &fields[i];
+        }
+        return NULL;
+    }
+};
+
+#endif
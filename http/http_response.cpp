@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "http_response.h"
+#include "perfect_hash.h"
+
+#define STATUS(code, line) {code, line, sizeof(line) - 1, NULL, 0, {0}, 0}
+#define TEXT_STATUS(code, line, body) {code, line, sizeof(line) - 1, body, sizeof(body) - 1, {0}, 0}
+
+static http_status statuses[] = {
+    STATUS(200, "HTTP/1.1 200 OK\r\n"),
+    TEXT_STATUS(201, "HTTP/1.1 201 Created\r\n", "The file was uploaded.\n"),
+    STATUS(206, "HTTP/1.1 206 Partial Content\r\n"),
+    STATUS(304, "HTTP/1.1 304 Not Modified\r\n"),
+    TEXT_STATUS(400, "HTTP/1.1 400 Bad Request\r\n",
+                "Your request has bad syntax or is inherently impossible to staisfy.\n"),
+    TEXT_STATUS(403, "HTTP/1.1 403 Forbidden\r\n",
+                "You do not have permission to get file form this server.\n"),
+    TEXT_STATUS(404, "HTTP/1.1 404 Not Found\r\n",
+                "The requested file was not found on this server.\n"),
+    TEXT_STATUS(411, "HTTP/1.1 411 Length Required\r\n",
+                "Uploads need a Content-Length.\n"),
+    TEXT_STATUS(413, "HTTP/1.1 413 Payload Too Large\r\n",
+                "The request body is larger than the server allows.\n"),
+    TEXT_STATUS(416, "HTTP/1.1 416 Range Not Satisfiable\r\n",
+                "The requested range is not satisfiable.\n"),
+    TEXT_STATUS(500, "HTTP/1.1 500 Internal Error\r\n",
+                "There was an unusual problem serving the request file.\n"),
+};
+static const int STATUS_NUM = sizeof(statuses) / sizeof(statuses[0]);
+
+//带内容的响应的头部只在启动时格式化一次
+static bool render_heads()
+{
+    for (int i = 0; i < STATUS_NUM; ++i)
+    {
+        if (statuses[i].body)
+            statuses[i].head_len = snprintf(statuses[i].head, sizeof(statuses[i].head),
+                                            "Content-Type:text/plain\r\nContent-Length:%d\r\n", statuses[i].body_len);
+    }
+    return true;
+}
+static bool heads_rendered = render_heads();
+
+const http_status *http_response::status(int code)
+{
+    switch (code)
+    {
+    case 200:
+        return &statuses[0];
+    case 201:
+        return &statuses[1];
+    case 206:
+        return &statuses[2];
+    case 304:
+        return &statuses[3];
+    case 400:
+        return &statuses[4];
+    case 403:
+        return &statuses[5];
+    case 404:
+        return &statuses[6];
+    case 411:
+        return &statuses[7];
+    case 413:
+        return &statuses[8];
+    case 416:
+        return &statuses[9];
+    default:
+        return &statuses[10];
+    }
+}
+
+const char *http_response::date()
+{
+    static thread_local time_t last = 0;
+    static thread_local char line[DATE_LEN + 1];
+    time_t now = time(NULL);
+    if (now != last)
+    {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        strftime(line, sizeof(line), "Date:%a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+        last = now;
+    }
+    return line;
+}
+
+//扩展名和Content-Type，文本类型都按UTF-8
+static constexpr const char *mime_types[][2] = {
+    {"html", "text/html; charset=utf-8"},
+    {"htm", "text/html; charset=utf-8"},
+    {"css", "text/css; charset=utf-8"},
+    {"js", "text/javascript; charset=utf-8"},
+    {"json", "application/json"},
+    {"txt", "text/plain; charset=utf-8"},
+    {"xml", "text/xml; charset=utf-8"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"png", "image/png"},
+    {"gif", "image/gif"},
+    {"ico", "image/x-icon"},
+    {"svg", "image/svg+xml"},
+    {"webp", "image/webp"},
+    {"bmp", "image/bmp"},
+    {"mp4", "video/mp4"},
+    {"webm", "video/webm"},
+    {"mp3", "audio/mpeg"},
+    {"wav", "audio/wav"},
+    {"pdf", "application/pdf"},
+    {"zip", "application/zip"},
+    {"gz", "application/gzip"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"ttf", "font/ttf"},
+    {"wasm", "application/wasm"},
+};
+
+struct mime_keys
+{
+    static const int num = sizeof(mime_types) / sizeof(mime_types[0]);
+    static const bool icase = true;
+    static constexpr const char *key(int i) { return mime_types[i][0]; }
+};
+
+static constexpr perfect_hash::table<mime_keys, 6> mime_table = perfect_hash::build<mime_keys, 6>();
+
+const char *http_response::content_type(const char *path)
+{
+    const char *name = strrchr(path, '/');
+    const char *ext = strrchr(name ? name : path, '.');
+    int i = ext ? mime_table.find(ext + 1, strlen(ext + 1)) : -1;
+    return i < 0 ? "application/octet-stream" : mime_types[i][1];
+}
+
+int http_response::itoa(unsigned long v, char *buf)
+{
+    char tmp[20];
+    int n = 0;
+    do
+    {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    for (int i = 0; i < n; ++i)
+        buf[i] = tmp[n - 1 - i];
+    return n;
+}
@@ -0,0 +1,39 @@
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+/*************************************************************
+*响应报文的固定片段
+*状态行、错误等响应的头部和内容都是静态的，响应时只拷贝，不格式化
+*Date头部每个线程每秒格式化一次，Content-Type按扩展名由编译期完美哈希表查找
+*长度等整数由itoa写入，生成响应时不调用vsnprintf
+**************************************************************/
+
+//一个状态码的状态行，错误状态和201另有text/plain的内容和对应的Content-Type、Content-Length头部
+struct http_status
+{
+    int code;
+    const char *line;   //含\r\n
+    int line_len;
+    const char *body;   //没有固定内容的状态为NULL
+    int body_len;
+    char head[64];      //启动时生成
+    int head_len;
+};
+
+class http_response
+{
+public:
+    //"Date:Sat, 17 Oct 2026 06:11:00 GMT\r\n"的长度
+    static const int DATE_LEN = 36;
+
+    //code的状态行等片段，不支持的状态码按500处理
+    static const http_status *status(int code);
+    //本线程缓存的Date头部，长度为DATE_LEN，秒数变化时重新格式化
+    static const char *date();
+    //path按扩展名的Content-Type，未知的扩展名为application/octet-stream
+    static const char *content_type(const char *path);
+    //v的十进制写入buf，返回写入的字节数，buf至少20字节
+    static int itoa(unsigned long v, char *buf);
+};
+
+#endif
@@ -0,0 +1,46 @@
+#include <stddef.h>
+#include <string.h>
+#include "http_router.h"
+#include "perfect_hash.h"
+
+//根路径显示判断页面；首页上各表单提交的地址：/2、/3由处理函数校验用户名和密码，表单很短，消息体限8KB，其余改写为对应的页面
+//PUT或POST到/upload/文件名的消息体保存为上传目录下的该文件
+static constexpr route routes[] = {
+    {"/", ROUTE_GET | ROUTE_POST, "/judge.html", ROUTE_STATIC, false, 0, false},
+    {"/0", ROUTE_GET | ROUTE_POST, "/register.html", ROUTE_STATIC, false, 0, false},
+    {"/1", ROUTE_GET | ROUTE_POST, "/log.html", ROUTE_STATIC, false, 0, false},
+    {"/2CGISQL.cgi", ROUTE_POST, NULL, ROUTE_LOGIN, true, 8 * 1024, false},
+    {"/3CGISQL.cgi", ROUTE_POST, NULL, ROUTE_REGISTER, true, 8 * 1024, false},
+    {"/5", ROUTE_GET | ROUTE_POST, "/picture.html", ROUTE_STATIC, false, 0, false},
+    {"/6", ROUTE_GET | ROUTE_POST, "/video.html", ROUTE_STATIC, false, 0, false},
+    {"/7", ROUTE_GET | ROUTE_POST, "/fans.html", ROUTE_STATIC, false, 0, false},
+    {"/upload/", ROUTE_PUT | ROUTE_POST, NULL, ROUTE_UPLOAD, false, 0, true},
+};
+
+struct route_keys
+{
+    static const int num = sizeof(routes) / sizeof(routes[0]);
+    static const bool icase = false;
+    static constexpr const char *key(int i) { return routes[i].path; }
+};
+
+static constexpr perfect_hash::table<route_keys, 4> route_table = perfect_hash::build<route_keys, 4>();
+
+const route *http_router::match(const char *path, int len, unsigned method)
+{
+    int i = route_table.find(path, len);
+    //精确匹配不到时按第一段路径(含其后的/)查找前缀路由，仍只查一次表
+    if (i < 0 && len > 1)
+    {
+        const char *slash = static_cast<const char *>(memchr(path + 1, '/', len - 1));
+        if (slash)
+        {
+            i = route_table.find(path, slash + 1 - path);
+            if (i >= 0 && !routes[i].prefix)
+                i = -1;
+        }
+    }
+    if (i < 0 || !(routes[i].methods & method))
+        return NULL;
+    return &routes[i];
+}
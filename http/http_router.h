@@ -0,0 +1,46 @@
+#ifndef HTTP_ROUTER_H
+#define HTTP_ROUTER_H
+
+/*************************************************************
+*路由表
+*按路径精确匹配，编译期生成完美哈希表，匹配时不分配内存；前缀路由按第一段路径匹配
+*一条路由或把请求改写为一个静态页面，或交给处理函数
+*请求方法不在路由允许的范围内时不匹配，按静态文件处理
+**************************************************************/
+
+//路由允许的请求方法，按位，与http_conn::METHOD的编号一致
+enum ROUTE_METHOD
+{
+    ROUTE_GET = 1 << 0,
+    ROUTE_POST = 1 << 1,
+    ROUTE_PUT = 1 << 3
+};
+
+//路由的处理函数，由http_conn映射到成员函数
+enum ROUTE_HANDLER
+{
+    ROUTE_STATIC = 0,   //只改写为rewrite
+    ROUTE_LOGIN,
+    ROUTE_REGISTER,
+    ROUTE_UPLOAD        //消息体写入上传目录，不进入读缓冲区
+};
+
+struct route
+{
+    const char *path;
+    unsigned methods;
+    const char *rewrite;    //改写后的静态页面，handler为ROUTE_STATIC时有效
+    ROUTE_HANDLER handler;
+    bool read_body;         //处理函数读取消息体，按段保存；否则只计数后丢弃
+    int body_limit;         //消息体上限(字节)，0为使用-B的设置
+    bool prefix;            //path以/结尾，匹配第一段路径与之相同的所有请求，如/upload/a.bin
+};
+
+class http_router
+{
+public:
+    //path的路由，method为ROUTE_METHOD中的一位，没有时返回NULL
+    static const route *match(const char *path, int len, unsigned method);
+};
+
+#endif
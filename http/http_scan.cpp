@@ -0,0 +1,102 @@
+#include "http_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SCAN_X86
+#endif
+
+//常量初始化先于动态初始化，select()覆盖时m_name已有初值
+const char *http_scan::m_name = "scalar";
+http_scan::find2_func http_scan::m_find2 = http_scan::select();
+
+http_scan::find2_func http_scan::select()
+{
+    if (has_avx2())
+    {
+        m_name = "avx2";
+        return find2_avx2;
+    }
+#ifdef HTTP_SCAN_X86
+    m_name = "sse2";
+    return find2_sse2;
+#else
+    return find2_scalar;
+#endif
+}
+
+bool http_scan::has_avx2()
+{
+#ifdef HTTP_SCAN_X86
+    //可能在其他静态对象构造前调用，先初始化CPU特性
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+const char *http_scan::find2_scalar(const char *p, const char *end, char a, char b)
+{
+    for (; p < end; ++p)
+    {
+        if (*p == a || *p == b)
+            return p;
+    }
+    return end;
+}
+
+#ifdef HTTP_SCAN_X86
+//每组字节分别与a、b比较，两个结果合并成位掩码，最低的置位即第一个匹配
+//SSE4.2的pcmpestri可一次匹配多达16个字符，但只找一两个字符时比cmpeq + movemask慢，且SSE2是x86-64的基线
+__attribute__((target("sse2")))
+const char *http_scan::find2_sse2(const char *p, const char *end, char a, char b)
+{
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return find2_scalar(p, end, a, b);
+}
+
+__attribute__((target("avx2")))
+const char *http_scan::find2_avx2(const char *p, const char *end, char a, char b)
+{
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    //剩余不足32字节，再按16字节一组；在本函数内用VEX编码的128位指令，
+    //不调用find2_sse2，混用传统SSE编码在部分CPU和虚拟机上有很大的切换开销
+    const __m128i va16 = _mm256_castsi256_si128(va);
+    const __m128i vb16 = _mm256_castsi256_si128(vb);
+    if (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va16), _mm_cmpeq_epi8(v, vb16)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return find2_scalar(p, end, a, b);
+}
+#else
+const char *http_scan::find2_sse2(const char *p, const char *end, char a, char b)
+{
+    return find2_scalar(p, end, a, b);
+}
+
+const char *http_scan::find2_avx2(const char *p, const char *end, char a, char b)
+{
+    return find2_scalar(p, end, a, b);
+}
+#endif
@@ -0,0 +1,35 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+/*************************************************************
+*请求报文扫描
+*查找行尾、请求行中的空白和头部名后的冒号，一次比较16或32字节
+*启动时按CPU选择AVX2或SSE2实现，其他平台逐字节查找
+*只读取[p,end)之内的字节，不足一组的尾部逐字节查找
+**************************************************************/
+
+class http_scan
+{
+public:
+    typedef const char *(*find2_func)(const char *p, const char *end, char a, char b);
+
+    //[p,end)中第一个a或b的位置，没有时返回end
+    static const char *find2(const char *p, const char *end, char a, char b) { return m_find2(p, end, a, b); }
+    static const char *find(const char *p, const char *end, char c) { return m_find2(p, end, c, c); }
+    //当前使用的实现
+    static const char *name() { return m_name; }
+
+    //各实现，供微基准测试比较；非x86平台上sse2和avx2即逐字节实现
+    static const char *find2_scalar(const char *p, const char *end, char a, char b);
+    static const char *find2_sse2(const char *p, const char *end, char a, char b);
+    static const char *find2_avx2(const char *p, const char *end, char a, char b);
+    static bool has_avx2();
+
+private:
+    static find2_func select();
+
+    static const char *m_name;
+    static find2_func m_find2;
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef PERFECT_HASH_H
+#define PERFECT_HASH_H
+
+/*************************************************************
+*编译期完美哈希表
+*对一组固定的键，编译期搜索哈希的种子，使每个键落在不同的槽中
+*查找时计算一次哈希、取一次槽、比较一次键，与键的个数和长度无关
+*哈希只取键的长度和四个字节，键之间须在这几处至少有一处不同，由build()检查
+*KEYS提供键的个数num、是否不区分大小写icase，以及取第i个键的key(i)
+**************************************************************/
+
+#include <string.h>
+#include <strings.h>
+
+namespace perfect_hash
+{
+constexpr int length(const char *s)
+{
+    int n = 0;
+    while (s[n])
+        ++n;
+    return n;
+}
+
+//长度和首、第二、中间、末尾四个字节拼成一个字，与键的长短无关
+//不区分大小写时每个字节或上0x20：大小写不同的同一名字取样相同，其余碰撞由查找时比较键排除
+constexpr unsigned long long sample(const char *s, int len, bool icase)
+{
+    if (len <= 0)
+        return 0;
+    unsigned long long w = (unsigned long long)(unsigned char)s[0] |
+                           (unsigned long long)(unsigned char)s[len > 1 ? 1 : 0] << 8 |
+                           (unsigned long long)(unsigned char)s[len / 2] << 16 |
+                           (unsigned long long)(unsigned char)s[len - 1] << 24;
+    if (icase)
+        w |= 0x20202020ull;
+    return w | (unsigned long long)len << 32;
+}
+
+//取样与种子相乘，一次乘法，高位作为哈希值
+constexpr unsigned hash(const char *s, int len, unsigned seed, bool icase)
+{
+    return ((sample(s, len, icase) ^ seed) * 0x9e3779b97f4a7c15ull) >> 32;
+}
+
+//取哈希值的高位作为槽号
+constexpr unsigned slot(unsigned h, int bits) { return h >> (32 - bits); }
+
+//有2^BITS个槽的表，BITS不超过8
+template <typename KEYS, int BITS>
+struct table
+{
+    static const int SIZE = 1 << BITS;
+
+    unsigned seed;
+    signed char id[SIZE];           //槽中的键编号，空槽为-1
+    unsigned char len[KEYS::num];   //各键的长度
+
+    //键s的编号，不在表中时返回-1
+    int find(const char *s, int n) const
+    {
+        int i = id[slot(hash(s, n, seed, KEYS::icase), BITS)];
+        if (i < 0 || n != len[i])
+            return -1;
+        if (KEYS::icase ? strncasecmp(s, KEYS::key(i), n) : memcmp(s, KEYS::key(i), n))
+            return -1;
+        return i;
+    }
+};
+
+//任意两个键的取样都不同，否则换种子也无法区分
+template <typename KEYS>
+constexpr bool distinct_samples()
+{
+    for (int i = 0; i < KEYS::num; ++i)
+    {
+        for (int j = i + 1; j < KEYS::num; ++j)
+        {
+            if (sample(KEYS::key(i), length(KEYS::key(i)), KEYS::icase) ==
+                sample(KEYS::key(j), length(KEYS::key(j)), KEYS::icase))
+                return false;
+        }
+    }
+    return true;
+}
+
+template <typename KEYS, int BITS>
+constexpr bool collision_free(unsigned seed)
+{
+    bool used[1 << BITS] = {};
+    for (int i = 0; i < KEYS::num; ++i)
+    {
+        unsigned s = slot(hash(KEYS::key(i), length(KEYS::key(i)), seed, KEYS::icase), BITS);
+        if (used[s])
+            return false;
+        used[s] = true;
+    }
+    return true;
+}
+
+//从第一个使所有键落在不同槽中的种子建表
+template <typename KEYS, int BITS>
+constexpr table<KEYS, BITS> build()
+{
+    static_assert(KEYS::num <= (1 << BITS) && BITS <= 8, "too many keys for the table");
+    static_assert(distinct_samples<KEYS>(), "keys differ only outside the sampled bytes");
+    table<KEYS, BITS> t = {};
+    while (!collision_free<KEYS, BITS>(t.seed))
+        ++t.seed;
+    for (int i = 0; i < (1 << BITS); ++i)
+        t.id[i] = -1;
+    for (int i = 0; i < KEYS::num; ++i)
+    {
+        int len = length(KEYS::key(i));
+        t.id[slot(hash(KEYS::key(i), len, t.seed, KEYS::icase), BITS)] = i;
+        t.len[i] = len;
+    }
+    return t;
+}
+}
+
+#endif
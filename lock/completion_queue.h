@@ -0,0 +1,158 @@
+#ifndef COMPLETION_QUEUE_H
+#define COMPLETION_QUEUE_H
+
+/*************************************************************
+*工作线程向反应堆回报处理结果的无锁队列
+*多生产者(工作线程)、单消费者(所属反应堆线程)的有界环形缓冲区
+*入队后通过eventfd唤醒阻塞在epoll_wait上的反应堆
+**************************************************************/
+
+#include <atomic>
+#include <exception>
+#include <unistd.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+class completion_queue
+{
+public:
+    //回报的事件类型
+    enum EVENT
+    {
+        CLOSE = 0, //工作线程读写失败，请求反应堆关闭连接
+        READ,      //io_uring模式：请求不完整，提交下一次接收
+        WRITE,     //io_uring模式：响应已生成，提交发送
+        STOP,      //0号反应堆收到SIGTERM，通知其余反应堆退出，sockfd为-1
+        DRAIN      //平滑升级：新进程已就绪，停止accept，sockfd为-1
+    };
+
+    completion_queue(int max_size = 65536)
+    {
+        //容量取不小于max_size的2的幂，下标用掩码取模
+        size_t size = 2;
+        while (size < (size_t)max_size)
+            size <<= 1;
+        m_mask = size - 1;
+        m_cells = new cell[size];
+        for (size_t i = 0; i < size; ++i)
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        m_enqueue_pos.store(0, std::memory_order_relaxed);
+        m_dequeue_pos = 0;
+        m_pending.store(false, std::memory_order_relaxed);
+
+        m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_eventfd < 0)
+        {
+            delete[] m_cells;
+            throw std::exception();
+        }
+    }
+
+    ~completion_queue()
+    {
+        close(m_eventfd);
+        delete[] m_cells;
+    }
+
+    //工作线程调用，队列满时让出CPU等待反应堆消费
+    //gen为连接序号(client_data::gen)，反应堆据此丢弃fd已被关闭或复用后才取出的事件
+    void push(int sockfd, unsigned int gen, int event)
+    {
+        while (!try_push(sockfd, gen, event))
+            sched_yield();
+
+        //只有第一个把m_pending置位的生产者写eventfd，合并多次唤醒
+        if (!m_pending.exchange(true, std::memory_order_seq_cst))
+        {
+            uint64_t one = 1;
+            ssize_t ret = write(m_eventfd, &one, sizeof(one));
+            (void)ret;
+        }
+    }
+
+    //反应堆线程调用，队列为空返回false
+    bool pop(int &sockfd, unsigned int &gen, int &event)
+    {
+        cell *c = &m_cells[m_dequeue_pos & m_mask];
+        size_t seq = c->seq.load(std::memory_order_acquire);
+        if ((intptr_t)seq - (intptr_t)(m_dequeue_pos + 1) < 0)
+            return false;
+
+        sockfd = c->sockfd;
+        gen = c->gen;
+        event = c->event;
+        c->seq.store(m_dequeue_pos + m_mask + 1, std::memory_order_release);
+        ++m_dequeue_pos;
+        return true;
+    }
+
+    //反应堆在eventfd可读时调用：先清除唤醒状态，再逐个pop
+    //顺序保证清除之后入队的完成事件一定会再次写eventfd
+    void clear()
+    {
+        uint64_t cnt;
+        ssize_t ret = read(m_eventfd, &cnt, sizeof(cnt));
+        (void)ret;
+        reset();
+    }
+
+    //eventfd已由调用者读出(如io_uring的READ)时，只清除唤醒状态
+    void reset()
+    {
+        m_pending.store(false, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    int get_eventfd()
+    {
+        return m_eventfd;
+    }
+
+private:
+    bool try_push(int sockfd, unsigned int gen, int event)
+    {
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        cell *c;
+        while (true)
+        {
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0)
+            {
+                //抢占该槽位
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+                return false;
+            else
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+        c->sockfd = sockfd;
+        c->gen = gen;
+        c->event = event;
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    struct cell
+    {
+        std::atomic<size_t> seq; //槽位序号，区分空闲/已写入
+        int sockfd;
+        unsigned int gen;
+        int event;
+    };
+
+    cell *m_cells;
+    size_t m_mask;
+    //生产者和消费者下标分开缓存行，避免伪共享
+    alignas(64) std::atomic<size_t> m_enqueue_pos;
+    alignas(64) size_t m_dequeue_pos;
+    alignas(64) std::atomic<bool> m_pending; //是否已有未处理的唤醒
+    int m_eventfd;
+};
+
+#endif
@@ -139,7 +139,10 @@ void Log::write_log(int level, const char *format, ...)
                      my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
                      
     //内容格式：时间+内容
-    int m = vsnprintf(m_buf + n, m_log_buf_size - 1, format, valst);
+    //超长内容截断，留出换行符和'\0'的位置
+    int m = vsnprintf(m_buf + n, m_log_buf_size - n - 1, format, valst);
+    if (m > m_log_buf_size - n - 2)
+        m = m_log_buf_size - n - 2;
     m_buf[n + m] = '\n';
     m_buf[n + m + 1] = '\0';
     log_str = m_buf;
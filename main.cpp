@@ -16,7 +16,12 @@ int main(int argc, char *argv[])
     //初始化
     server.init(config.PORT, user, passwd, databasename, config.LOGWrite, 
                 config.OPT_LINGER, config.TRIGMode,  config.sql_num,  config.thread_num, 
-                config.close_log, config.actor_model);
+                config.close_log, config.actor_model, config.reactor_num,
+                config.backlog, config.defer_accept, config.timeslot,
+                config.head_limit, config.body_limit, config.zero_copy, config.resp_cache,
+                config.cache_policy, config.keep_alive, config.keep_alive_max, config.autoindex,
+                config.upload_dir, config.upload_limit, config.http2,
+                config.tls_cert, config.tls_key, config.ktls, config.write_quantum);
     
 
     //日志
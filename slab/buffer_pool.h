@@ -0,0 +1,109 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+/*************************************************************
+*连接读写缓冲区的缓冲池
+*连接只在收到数据或生成响应时借出缓冲区，请求处理完转为空闲时归还，空闲长连接不占缓冲区
+*每个线程有一个本地缓存，借还不加锁；本地缓存满了或空了，才与全局仓库成批交换
+*缓冲区可能在一个线程借出、在另一个线程归还，由全局仓库在线程间平衡
+**************************************************************/
+
+#include <stdlib.h>
+#include <vector>
+#include <new>
+#include "../lock/locker.h"
+
+template <int SIZE>
+class buffer_pool
+{
+public:
+    //借出一块SIZE字节的缓冲区，内容未初始化
+    static char *get()
+    {
+        cache &c = t_cache;
+        if (0 == c.num)
+            refill(c);
+        if (0 == c.num)
+        {
+            char *buf = static_cast<char *>(malloc(SIZE));
+            if (!buf)
+                throw std::bad_alloc();
+            return buf;
+        }
+        return c.bufs[--c.num];
+    }
+
+    //归还缓冲区
+    static void put(char *buf)
+    {
+        cache &c = t_cache;
+        if (CACHE_SIZE == c.num)
+            flush(c, BATCH);
+        c.bufs[c.num++] = buf;
+    }
+
+private:
+    static const int CACHE_SIZE = 64;   //线程本地缓存上限
+    static const int BATCH = 32;        //与全局仓库每次交换的个数
+    static const int DEPOT_MAX = 4096;  //全局仓库上限，超出部分还给系统
+
+    struct cache
+    {
+        int num;
+        char *bufs[CACHE_SIZE];
+
+        cache() : num(0) {}
+        //线程退出时把本地缓存交给全局仓库
+        ~cache() { flush(*this, num); }
+    };
+
+    struct depot
+    {
+        locker lock;
+        std::vector<char *> bufs;
+
+        ~depot()
+        {
+            for (size_t i = 0; i < bufs.size(); ++i)
+                ::free(bufs[i]);
+        }
+    };
+
+    //从全局仓库取一批到本地缓存
+    static void refill(cache &c)
+    {
+        s_depot.lock.lock();
+        while (c.num < BATCH && !s_depot.bufs.empty())
+        {
+            c.bufs[c.num++] = s_depot.bufs.back();
+            s_depot.bufs.pop_back();
+        }
+        s_depot.lock.unlock();
+    }
+
+    //把本地缓存末尾的n个交给全局仓库
+    static void flush(cache &c, int n)
+    {
+        s_depot.lock.lock();
+        while (n-- > 0)
+        {
+            char *buf = c.bufs[--c.num];
+            if ((int)s_depot.bufs.size() < DEPOT_MAX)
+                s_depot.bufs.push_back(buf);
+            else
+                ::free(buf);
+        }
+        s_depot.lock.unlock();
+    }
+
+    static thread_local cache t_cache;
+    static depot s_depot;
+};
+
+template <int SIZE>
+thread_local typename buffer_pool<SIZE>::cache buffer_pool<SIZE>::t_cache;
+
+template <int SIZE>
+typename buffer_pool<SIZE>::depot buffer_pool<SIZE>::s_depot;
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+/*************************************************************
+*连接对象的slab分配器
+*按块向系统申请对象，accept时取出，关闭时归还并复用，不再按MAX_FD预先分配
+*每个反应堆独占一个，只在本反应堆线程内使用，不加锁
+**************************************************************/
+
+#include <stdlib.h>
+#include <vector>
+#include <new>
+
+template <typename T>
+class slab
+{
+public:
+    //chunk为每次向系统申请的对象个数
+    slab(int chunk = 64) : m_chunk(chunk), m_carve(0), m_used(0), m_high_water(0) {}
+
+    ~slab()
+    {
+        //只析构构造过的对象：最后一块可能未分完
+        for (size_t i = 0; i < m_blocks.size(); ++i)
+        {
+            int num = (i + 1 == m_blocks.size()) ? m_carve : m_chunk;
+            for (int j = 0; j < num; ++j)
+                m_blocks[i][j].~T();
+            ::free(m_blocks[i]);
+        }
+    }
+
+    //优先复用归还的对象，否则从当前块切出一个新对象
+    T *alloc()
+    {
+        T *obj;
+        if (!m_free.empty())
+        {
+            obj = m_free.back();
+            m_free.pop_back();
+        }
+        else
+        {
+            if (m_blocks.empty() || m_carve == m_chunk)
+            {
+                //按T的对齐要求申请，缓存行对齐的对象在块内依次排列仍保持对齐
+                void *block;
+                size_t align = alignof(T) < sizeof(void *) ? sizeof(void *) : alignof(T);
+                if (posix_memalign(&block, align, sizeof(T) * m_chunk) != 0)
+                    throw std::bad_alloc();
+                m_blocks.push_back(static_cast<T *>(block));
+                m_carve = 0;
+            }
+            //对象只构造一次，之后反复复用，由调用者在使用前初始化
+            obj = new (m_blocks.back() + m_carve) T();
+            ++m_carve;
+        }
+        if (++m_used > m_high_water)
+            m_high_water = m_used;
+        return obj;
+    }
+
+    //归还对象，内存不还给系统
+    void free(T *obj)
+    {
+        m_free.push_back(obj);
+        --m_used;
+    }
+
+    //正在使用的对象数
+    int used() const { return m_used; }
+    //使用数的历史最大值
+    int high_water() const { return m_high_water; }
+    //已申请的对象总数
+    int capacity() const { return m_blocks.empty() ? 0 : (int)(m_blocks.size() - 1) * m_chunk + m_carve; }
+
+private:
+    slab(const slab &);
+    slab &operator=(const slab &);
+
+private:
+    int m_chunk;                //每块对象个数
+    std::vector<T *> m_blocks;  //已申请的块
+    int m_carve;                //最后一块已切出的对象个数
+    std::vector<T *> m_free;    //归还的对象
+    int m_used;
+    int m_high_water;
+};
+
+#endif
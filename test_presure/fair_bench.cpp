@@ -0,0 +1,200 @@
+/*************************************************************
+*写公平性基准
+*若干个下载连接在长连接上反复下载大文件，同时若干个探测连接逐个请求小页面，
+*统计小页面的延迟分布(p50、p99、最大值)和大文件的总吞吐量
+*服务器以-a 1 -t 2等少量工作线程启动，分别以-w 0和默认配额各测一次比较
+*用法：fair_bench [-h 地址] [-p 端口] [-b 下载连接数] [-f 大文件] [-c 探测连接数] [-s 小页面] [-n 请求数]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+static const char *host = "127.0.0.1";
+static int port = 9006;
+static const char *big = "/xxx.mp4";
+static const char *small = "/";
+static int per_probe = 500;
+
+static std::atomic<bool> stop(false);
+static std::atomic<long> bulk_bytes(0);
+static std::vector<double> latencies;
+static pthread_mutex_t lat_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_to()
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host, &addr.sin_addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("connect");
+        exit(1);
+    }
+    return fd;
+}
+
+//在长连接上发出一个GET并读完响应，返回内容长度，出错返回-1；响应头须在第一次读取中收全
+static long get(int fd, const char *path, char *buf, int size)
+{
+    char req[512];
+    int len = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n", path, host);
+    if (send(fd, req, len, MSG_NOSIGNAL) != len)
+        return -1;
+    long have = 0, body = -1, head = 0;
+    while (body < 0 || have < head + body)
+    {
+        int n = recv(fd, buf + (body < 0 ? have : 0), body < 0 ? size - 1 - have : size, 0);
+        if (n <= 0)
+            return -1;
+        if (body < 0)
+        {
+            have += n;
+            buf[have] = '\0';
+            char *end = strstr(buf, "\r\n\r\n");
+            char *cl = strcasestr(buf, "Content-Length:");
+            if (!end || !cl)
+                continue;
+            head = end + 4 - buf;
+            body = atol(cl + 15);
+        }
+        else
+            have += n;
+    }
+    return body;
+}
+
+//反复下载大文件直到探测结束
+static void *bulk(void *)
+{
+    static const int SIZE = 256 * 1024;
+    char *buf = new char[SIZE];
+    int fd = connect_to();
+    while (!stop)
+    {
+        long n = get(fd, big, buf, SIZE);
+        if (n < 0)
+        {
+            fprintf(stderr, "download %s failed\n", big);
+            exit(1);
+        }
+        bulk_bytes += n;
+    }
+    close(fd);
+    delete[] buf;
+    return NULL;
+}
+
+//逐个请求小页面，记录每个请求从发出到读完响应的时间
+static void *probe(void *)
+{
+    static const int SIZE = 64 * 1024;
+    char *buf = new char[SIZE];
+    std::vector<double> mine;
+    int fd = connect_to();
+    for (int i = 0; i < per_probe; ++i)
+    {
+        double start = now();
+        if (get(fd, small, buf, SIZE) < 0)
+        {
+            fprintf(stderr, "request %s failed\n", small);
+            exit(1);
+        }
+        mine.push_back(now() - start);
+    }
+    close(fd);
+    delete[] buf;
+    pthread_mutex_lock(&lat_lock);
+    latencies.insert(latencies.end(), mine.begin(), mine.end());
+    pthread_mutex_unlock(&lat_lock);
+    return NULL;
+}
+
+static double percentile(double p)
+{
+    size_t i = (size_t)(p * (latencies.size() - 1));
+    return latencies[i] * 1e3;
+}
+
+int main(int argc, char *argv[])
+{
+    int nbulk = 8, nprobe = 4, total = 2000;
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:b:f:c:s:n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h':
+            host = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'b':
+            nbulk = atoi(optarg);
+            break;
+        case 'f':
+            big = optarg;
+            break;
+        case 'c':
+            nprobe = atoi(optarg);
+            break;
+        case 's':
+            small = optarg;
+            break;
+        case 'n':
+            total = atoi(optarg);
+            break;
+        default:
+            break;
+        }
+    }
+    if (nprobe < 1)
+        nprobe = 1;
+    per_probe = total / nprobe > 0 ? total / nprobe : 1;
+
+    std::vector<pthread_t> bulks(nbulk), probes(nprobe);
+    for (int i = 0; i < nbulk; ++i)
+        pthread_create(&bulks[i], NULL, bulk, NULL);
+    //下载连接先把服务器的发送跑满
+    usleep(200 * 1000);
+    long base = bulk_bytes;
+    double start = now();
+    for (int i = 0; i < nprobe; ++i)
+        pthread_create(&probes[i], NULL, probe, NULL);
+    for (int i = 0; i < nprobe; ++i)
+        pthread_join(probes[i], NULL);
+    double t = now() - start;
+    long bytes = bulk_bytes - base;
+    stop = true;
+    for (int i = 0; i < nbulk; ++i)
+        pthread_join(bulks[i], NULL);
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("small %s x %zu: p50 %.3f ms  p90 %.3f ms  p99 %.3f ms  max %.3f ms\n", small, latencies.size(),
+           percentile(0.5), percentile(0.9), percentile(0.99), latencies.back() * 1e3);
+    printf("bulk  %s x %d conns: %.1f MB/s\n", big, nbulk, bytes / t / 1e6);
+    return 0;
+}
@@ -0,0 +1,268 @@
+/*************************************************************
+*连接对象布局微基准
+*模拟反应堆在大量连接上分发事件时对连接对象的访问：按fd取连接、延长定时器、
+*读取注册事件所需的字段和解析状态，比较原来的布局(缓冲区夹在字段之间的大对象，
+*定时器和client_data另有两张表)与冷热分离后的布局(384字节、按缓存行对齐，定时器嵌在其中)
+*两种布局按源码中的成员顺序复现，不依赖http_conn，可单独编译
+*内核允许时用perf_event_open统计L1数据缓存和末级缓存的未命中次数，否则只输出耗时
+*用法：layout_bench [-c 连接数] [-n 事件数]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/perf_event.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/*原来的布局：http_conn数组按fd索引，读写缓冲区、文件名和数据库配置都在对象内*/
+struct old_client_data;
+struct old_timer
+{
+    time_t expire;
+    void (*cb_func)(old_client_data *);
+    old_client_data *user_data;
+    old_timer *prev;
+    old_timer *next;
+};
+struct old_client_data
+{
+    sockaddr_in address;
+    int sockfd;
+    old_timer *timer;
+};
+struct old_conn
+{
+    void *mysql;
+    int m_state;
+    int m_sockfd;
+    sockaddr_in m_address;
+    char m_read_buf[2048];
+    int m_read_idx;
+    int m_checked_idx;
+    int m_start_line;
+    char m_write_buf[1024];
+    int m_write_idx;
+    int m_check_state;
+    int m_method;
+    char m_real_file[200];
+    char *m_url;
+    char *m_version;
+    char *m_host;
+    int m_content_length;
+    bool m_linger;
+    char *m_file_address;
+    struct stat m_file_stat;
+    struct iovec m_iv[2];
+    int m_iv_count;
+    int cgi;
+    char *m_string;
+    int bytes_to_send;
+    int bytes_have_send;
+    char *doc_root;
+    std::map<std::string, std::string> m_users;
+    int m_TRIGMode;
+    int m_close_log;
+    char sql_user[100];
+    char sql_passwd[100];
+    char sql_name[100];
+};
+
+/*冷热分离后的布局：第一条缓存行是每次分发都要访问的字段，其后是定时器节点和client_data，
+其余冷数据在后，读写缓冲区从缓冲池借用不在对象内*/
+struct new_conn;
+struct new_client_data
+{
+    int sockfd;
+    int epollfd;
+    unsigned int gen;
+    int inflight;
+    void *timer;
+    void *owner;
+};
+struct new_timer
+{
+    time_t expire;
+    void (*cb_func)(new_client_data *);
+    new_client_data *user_data;
+    new_timer *prev;
+    new_timer *next;
+};
+struct alignas(64) new_conn
+{
+    int m_state;
+    int m_sockfd;
+    int m_epollfd;
+    int m_TRIGMode;
+    int m_close_log;
+    int m_read_idx;
+    int m_checked_idx;
+    int m_start_line;
+    int m_write_idx;
+    int m_check_state;
+    int m_method;
+    bool m_linger;
+    bool m_resp_linger;
+    bool m_http11;
+    bool m_stream;
+    int bytes_to_send;
+    int bytes_have_send;
+    void *m_cq;
+    new_timer m_timer;
+    new_client_data m_timer_data;
+    char cold[384 - 136];
+};
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//L1数据缓存读未命中和末级缓存未命中，不可用时fd为-1
+struct counters
+{
+    int l1, llc;
+
+    static int open_counter(unsigned type, unsigned long long config)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    counters()
+    {
+        l1 = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+        llc = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    }
+    void start()
+    {
+        for (int fd : {l1, llc})
+            if (fd >= 0)
+            {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+    }
+    void stop(long events)
+    {
+        const char *names[] = {"L1D miss", "LLC miss"};
+        int fds[] = {l1, llc};
+        for (int i = 0; i < 2; ++i)
+        {
+            long long v;
+            if (fds[i] < 0 || read(fds[i], &v, sizeof(v)) != sizeof(v))
+            {
+                printf("  %s n/a", names[i]);
+                continue;
+            }
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            printf("  %s %.2f/event", names[i], (double)v / events);
+        }
+        printf("\n");
+    }
+};
+
+//一次事件分发：取连接和定时器，延长定时器，读出重新注册事件和继续解析所需的字段
+template <typename F>
+static void run(const char *name, const std::vector<int> &order, int n, F dispatch)
+{
+    counters c;
+    long sum = 0;
+    //先走一遍预热
+    for (size_t i = 0; i < order.size(); ++i)
+        sum += dispatch(order[i], 0);
+    c.start();
+    double start = now();
+    for (int i = 0; i < n; ++i)
+        sum += dispatch(order[i % order.size()], i);
+    double t = now() - start;
+    printf("%-4s %7.1f ns/event", name, t * 1e9 / n);
+    c.stop(n);
+    if (sum == 42)
+        printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int conns = 50000, n = 5000000;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            conns = atoi(optarg);
+            break;
+        case 'n':
+            n = atoi(optarg);
+            break;
+        default:
+            break;
+        }
+    }
+
+    //就绪事件在连接间随机分布
+    std::vector<int> order(conns);
+    for (int i = 0; i < conns; ++i)
+        order[i] = i;
+    srand(1);
+    for (int i = conns - 1; i > 0; --i)
+        std::swap(order[i], order[rand() % (i + 1)]);
+
+    //原来：http_conn数组、client_data数组，定时器逐个new
+    old_conn *users = new old_conn[conns];
+    old_client_data *users_timer = new old_client_data[conns];
+    for (int i = 0; i < conns; ++i)
+    {
+        users[i].m_sockfd = i;
+        users_timer[i].sockfd = i;
+        users_timer[i].timer = new old_timer;
+        users_timer[i].timer->user_data = &users_timer[i];
+    }
+    printf("%d connections, %d events; old object %zu bytes, new %zu bytes\n", conns, n, sizeof(old_conn),
+           sizeof(new_conn));
+    run("old", order, n, [&](int fd, int i) -> long {
+        old_timer *timer = users_timer[fd].timer;
+        timer->expire = i;
+        old_conn *c = &users[fd];
+        return (long)timer->prev + c->m_sockfd + c->m_TRIGMode + c->m_read_idx + c->m_checked_idx +
+               c->m_check_state + c->bytes_to_send + c->m_state;
+    });
+
+    //现在：连接对象由slab分配，users只存指针，定时器嵌在对象内
+    new_conn *slab = new new_conn[conns];
+    new_conn **ptrs = new new_conn *[conns];
+    for (int i = 0; i < conns; ++i)
+    {
+        ptrs[i] = &slab[i];
+        slab[i].m_sockfd = i;
+        slab[i].m_timer_data.timer = &slab[i].m_timer;
+        slab[i].m_timer.prev = slab[i].m_timer.next = NULL;
+    }
+    run("new", order, n, [&](int fd, int i) -> long {
+        new_conn *c = ptrs[fd];
+        new_timer *timer = &c->m_timer;
+        timer->expire = i;
+        return (long)timer->prev + c->m_sockfd + c->m_TRIGMode + c->m_epollfd + c->m_read_idx + c->m_checked_idx +
+               c->m_check_state + c->bytes_to_send + c->m_state;
+    });
+    return 0;
+}
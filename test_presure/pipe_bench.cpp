@@ -0,0 +1,186 @@
+/*************************************************************
+*流水线基准
+*若干个长连接各自一次发出depth个请求，再依次读完depth个响应，重复到时间结束，
+*统计每秒完成的请求数；-d 1即逐个请求，作为没有流水线时的对照
+*用法：pipe_bench [-h 地址] [-p 端口] [-c 连接数] [-d 深度] [-f 页面] [-t 秒数]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+static const char *host = "127.0.0.1";
+static int port = 9006;
+static const char *path = "/";
+static int depth = 16;
+
+static std::atomic<bool> stop(false);
+static std::atomic<long> done(0);
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_to()
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host, &addr.sin_addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("connect");
+        exit(1);
+    }
+    return fd;
+}
+
+//连接上收到的数据，响应可能跨越多次recv，也可能一次recv中有多个响应
+struct reader
+{
+    int fd;
+    char buf[256 * 1024];
+    int have;
+    int pos;
+
+    //读完一个响应，返回状态码，出错返回-1；服务器将关闭连接时closing为true
+    int next(bool &closing)
+    {
+        while (true)
+        {
+            buf[have] = '\0';
+            char *start = buf + pos;
+            char *end = strstr(start, "\r\n\r\n");
+            if (end)
+            {
+                char *cl = strcasestr(start, "Content-Length:");
+                if (!cl || cl > end)
+                    return -1;
+                long len = end + 4 - start + atol(cl + 15);
+                if (pos + len <= have)
+                {
+                    char *conn = strcasestr(start, "Connection:");
+                    closing = conn && conn < end && 0 == strncasecmp(conn + 11 + strspn(conn + 11, " "), "close", 5);
+                    int status = atoi(start + 9);
+                    pos += len;
+                    return status;
+                }
+            }
+            //未读完的响应移到开头
+            memmove(buf, start, have - pos);
+            have -= pos;
+            pos = 0;
+            if (have >= (int)sizeof(buf) - 1)
+                return -1;
+            int n = recv(fd, buf + have, sizeof(buf) - 1 - have, 0);
+            if (n <= 0)
+                return -1;
+            have += n;
+        }
+    }
+};
+
+static void *client(void *)
+{
+    std::string reqs;
+    for (int i = 0; i < depth; ++i)
+        reqs += std::string("GET ") + path + " HTTP/1.1\r\nHost: " + host + "\r\n\r\n";
+    reader *r = new reader;
+    r->fd = connect_to();
+    r->have = r->pos = 0;
+    while (!stop)
+    {
+        if (send(r->fd, reqs.data(), reqs.size(), MSG_NOSIGNAL) != (ssize_t)reqs.size())
+        {
+            fprintf(stderr, "send failed\n");
+            exit(1);
+        }
+        bool closing = false;
+        for (int i = 0; i < depth; ++i)
+        {
+            bool last;
+            if (r->next(last) != 200)
+            {
+                fprintf(stderr, "response %d of %d failed\n", i, depth);
+                exit(1);
+            }
+            ++done;
+            //长连接处理的请求数达到上限(-K)时，其后的请求被丢弃
+            if (last)
+            {
+                closing = true;
+                break;
+            }
+        }
+        if (closing)
+        {
+            close(r->fd);
+            r->fd = connect_to();
+            r->have = r->pos = 0;
+        }
+    }
+    close(r->fd);
+    delete r;
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int conns = 16, seconds = 5;
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:c:d:f:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h':
+            host = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'c':
+            conns = atoi(optarg);
+            break;
+        case 'd':
+            depth = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 'f':
+            path = optarg;
+            break;
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        default:
+            break;
+        }
+    }
+
+    std::vector<pthread_t> threads(conns);
+    double start = now();
+    for (int i = 0; i < conns; ++i)
+        pthread_create(&threads[i], NULL, client, NULL);
+    sleep(seconds);
+    stop = true;
+    for (int i = 0; i < conns; ++i)
+        pthread_join(threads[i], NULL);
+    double t = now() - start;
+    printf("GET %s, %d conns, depth %d: %.0f req/s\n", path, conns, depth, done / t);
+    return 0;
+}
@@ -0,0 +1,143 @@
+/*************************************************************
+*路由微基准
+*按站点页面间跳转的请求组合，比较do_request原来按url最后一段首字符逐个判断、
+*malloc改写路径的分发方式与编译期路由表，两者都生成完整的目标文件路径
+*用法：route_bench [-n 轮数]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../http/http_router.h"
+
+static const int FILENAME_LEN = 200;
+static const char *doc_root = "/root/repo/root";
+
+static const struct
+{
+    const char *url;
+    unsigned method;
+} reqs[] = {
+    {"/", ROUTE_GET},
+    {"/0", ROUTE_POST},
+    {"/1", ROUTE_POST},
+    {"/2CGISQL.cgi", ROUTE_POST},
+    {"/3CGISQL.cgi", ROUTE_POST},
+    {"/5", ROUTE_POST},
+    {"/6", ROUTE_POST},
+    {"/7", ROUTE_POST},
+    {"/judge.html", ROUTE_GET},
+    {"/test1.jpg", ROUTE_GET},
+    {"/xxx.mp4", ROUTE_GET},
+    {"/favicon.ico", ROUTE_GET},
+};
+static const int NUM = sizeof(reqs) / sizeof(reqs[0]);
+
+//原来的分发：处理函数的结果只以固定页面代替
+static void old_dispatch(const char *url, unsigned method, char *real_file)
+{
+    char m_url[64];
+    strcpy(m_url, url);
+    if (strlen(m_url) == 1)
+        strcat(m_url, "judge.html");
+    strcpy(real_file, doc_root);
+    int len = strlen(doc_root);
+    const char *p = strrchr(m_url, '/');
+    if (ROUTE_POST == method && (*(p + 1) == '2' || *(p + 1) == '3'))
+    {
+        char *m_url_real = (char *)malloc(sizeof(char) * 200);
+        strcpy(m_url_real, "/");
+        strcat(m_url_real, m_url + 2);
+        strncpy(real_file + len, m_url_real, FILENAME_LEN - len - 1);
+        free(m_url_real);
+        strcpy(m_url, *(p + 1) == '2' ? "/welcome.html" : "/log.html");
+    }
+    const char *page = NULL;
+    if (*(p + 1) == '0')
+        page = "/register.html";
+    else if (*(p + 1) == '1')
+        page = "/log.html";
+    else if (*(p + 1) == '5')
+        page = "/picture.html";
+    else if (*(p + 1) == '6')
+        page = "/video.html";
+    else if (*(p + 1) == '7')
+        page = "/fans.html";
+    if (page)
+    {
+        char *m_url_real = (char *)malloc(sizeof(char) * 200);
+        strcpy(m_url_real, page);
+        strncpy(real_file + len, m_url_real, FILENAME_LEN - len - 1);
+        free(m_url_real);
+    }
+    else
+        strncpy(real_file + len, m_url, FILENAME_LEN - len - 1);
+    real_file[FILENAME_LEN - 1] = '\0';
+}
+
+static void new_dispatch(const char *url, unsigned method, char *real_file)
+{
+    const char *page = url;
+    const route *r = http_router::match(url, strlen(url), method);
+    if (r)
+    {
+        if (ROUTE_LOGIN == r->handler)
+            page = "/welcome.html";
+        else if (ROUTE_REGISTER == r->handler)
+            page = "/log.html";
+        else
+            page = r->rewrite;
+    }
+    if (strlen(doc_root) + strlen(page) >= (size_t)FILENAME_LEN)
+        return;
+    strcpy(stpcpy(real_file, doc_root), page);
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = 1000000;
+    if (argc > 2 && 0 == strcmp(argv[1], "-n"))
+        rounds = atoi(argv[2]);
+
+    char a[FILENAME_LEN], b[FILENAME_LEN];
+    for (int i = 0; i < NUM; ++i)
+    {
+        old_dispatch(reqs[i].url, reqs[i].method, a);
+        new_dispatch(reqs[i].url, reqs[i].method, b);
+        if (strcmp(a, b))
+            printf("%s: %s != %s\n", reqs[i].url, a, b);
+    }
+
+    struct
+    {
+        const char *name;
+        void (*dispatch)(const char *, unsigned, char *);
+    } impls[] = {
+        {"if-chain", old_dispatch},
+        {"router", new_dispatch},
+    };
+    for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); ++k)
+    {
+        long sum = 0;
+        double start = now();
+        for (int r = 0; r < rounds; ++r)
+        {
+            for (int i = 0; i < NUM; ++i)
+            {
+                impls[k].dispatch(reqs[i].url, reqs[i].method, a);
+                sum += a[strlen(doc_root) + 1];
+            }
+        }
+        double sec = now() - start;
+        printf("%-10s %8.1f ns/request (%ld)\n", impls[k].name, sec * 1e9 / rounds / NUM, sum);
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+/*************************************************************
+*请求报文扫描微基准
+*从服务器日志中取出浏览器的真实请求，还原成\r\n分隔的报文，
+*按parse_line和parse_headers的方式逐行查找行尾和头部名后的冒号，比较各实现的耗时
+*用法：scan_bench [日志文件...] [-n 轮数]，默认读取仓库中的两份日志
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "../http/http_scan.h"
+
+using namespace std;
+
+//日志中"[info]: "之后是请求行或头部，空行结束一个请求，跳过服务器自己的"oop!unknow header"
+static void load_requests(const char *path, vector<string> &reqs)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        perror(path);
+        return;
+    }
+    char line[8192];
+    string req;
+    bool in_req = false;
+    while (fgets(line, sizeof(line), fp))
+    {
+        char *text = strstr(line, "[info]: ");
+        if (!text)
+            continue;
+        text += 8;
+        text[strcspn(text, "\r\n")] = '\0';
+        if (!in_req)
+        {
+            const char *sp = strchr(text, ' ');
+            if ((0 == strncmp(text, "GET ", 4) || 0 == strncmp(text, "POST ", 5)) && sp && strstr(sp, " HTTP/1."))
+            {
+                in_req = true;
+                req = string(text) + "\r\n";
+            }
+            continue;
+        }
+        if (0 == strncmp(text, "oop!unknow header", 17))
+            continue;
+        req += string(text) + "\r\n";
+        if ('\0' == text[0])
+        {
+            reqs.push_back(req);
+            in_req = false;
+        }
+    }
+    fclose(fp);
+}
+
+//与parse_line、parse_headers相同的查找顺序，返回找到的冒号位置之和作为校验
+static long scan(http_scan::find2_func find2, const vector<string> &reqs)
+{
+    long sum = 0;
+    for (size_t i = 0; i < reqs.size(); ++i)
+    {
+        const char *p = reqs[i].data(), *end = p + reqs[i].size();
+        bool first = true;
+        while (p < end)
+        {
+            const char *eol = find2(p, end, '\r', '\n');
+            if (!first && eol > p)
+                sum += find2(p, eol, ':', ':') - p;
+            first = false;
+            p = eol + 2;
+        }
+    }
+    return sum;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    vector<string> reqs;
+    int rounds = 200000;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (0 == strcmp(argv[i], "-n") && i + 1 < argc)
+            rounds = atoi(argv[++i]);
+        else
+            load_requests(argv[i], reqs);
+    }
+    if (reqs.empty())
+    {
+        load_requests("2021_04_13_ServerLog", reqs);
+        load_requests("2021_05_03_ServerLog", reqs);
+    }
+    if (reqs.empty())
+    {
+        printf("no requests found\n");
+        return 1;
+    }
+    size_t bytes = 0;
+    for (size_t i = 0; i < reqs.size(); ++i)
+        bytes += reqs[i].size();
+    printf("%zu requests, %zu bytes, %.0f bytes/request, dispatch: %s\n", reqs.size(), bytes,
+           (double)bytes / reqs.size(), http_scan::name());
+
+    struct
+    {
+        const char *name;
+        http_scan::find2_func find2;
+    } impls[] = {
+        {"scalar", http_scan::find2_scalar},
+        {"sse2", http_scan::find2_sse2},
+        {"avx2", http_scan::find2_avx2},
+    };
+    long expect = scan(http_scan::find2_scalar, reqs);
+    for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); ++k)
+    {
+        if (0 == strcmp(impls[k].name, "avx2") && !http_scan::has_avx2())
+            continue;
+        long sum = 0;
+        double start = now();
+        for (int r = 0; r < rounds; ++r)
+            sum += scan(impls[k].find2, reqs);
+        double sec = now() - start;
+        if (sum != expect * rounds)
+            printf("%s: checksum mismatch\n", impls[k].name);
+        printf("%-8s %8.1f ns/request %8.2f GB/s\n", impls[k].name, sec * 1e9 / rounds / reqs.size(),
+               (double)bytes * rounds / sec / 1e9);
+    }
+    return 0;
+}
@@ -0,0 +1,197 @@
+/*************************************************************
+*拖动播放基准
+*若干个长连接模拟播放器拖动进度条：每次在文件中随机取一个窗口，带Range请求，
+*只读回这个窗口，统计每秒完成的拖动次数和吞吐量；-w时每次拖动都下载整个文件，作为不支持Range时的对照
+*用法：seek_bench [-h 地址] [-p 端口] [-c 连接数] [-f 文件] [-s 窗口KB] [-t 秒数] [-w]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <vector>
+
+static const char *host = "127.0.0.1";
+static int port = 9006;
+static const char *path = "/xxx.mp4";
+static long window = 256 * 1024;
+static bool whole = false;
+static long file_size = 0;
+
+static std::atomic<bool> stop(false);
+static std::atomic<long> seeks(0);
+static std::atomic<long> bytes(0);
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_to()
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host, &addr.sin_addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("connect");
+        exit(1);
+    }
+    return fd;
+}
+
+//发出一个请求并读完响应，返回状态码，body为内容长度，服务器将关闭连接时closing为true；range为空时请求整个文件
+//响应头须在第一次读取中收全
+static int request(int fd, const char *range, char *buf, int size, long &body, bool &closing)
+{
+    char req[512];
+    int len = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: %s\r\n%s%s%s\r\n", path, host,
+                       range ? "Range: bytes=" : "", range ? range : "", range ? "\r\n" : "");
+    if (send(fd, req, len, MSG_NOSIGNAL) != len)
+        return -1;
+    long have = 0, head = 0;
+    int status = 0;
+    body = -1;
+    while (body < 0 || have < head + body)
+    {
+        int n = recv(fd, buf + (body < 0 ? have : 0), body < 0 ? size - 1 - have : size, 0);
+        if (n <= 0)
+            return -1;
+        if (body < 0)
+        {
+            have += n;
+            buf[have] = '\0';
+            char *end = strstr(buf, "\r\n\r\n");
+            char *cl = strcasestr(buf, "Content-Length:");
+            if (!end || !cl)
+                continue;
+            status = atoi(buf + 9);
+            char *conn = strcasestr(buf, "Connection:");
+            closing = conn && 0 == strncasecmp(conn + 11 + strspn(conn + 11, " "), "close", 5);
+            head = end + 4 - buf;
+            body = atol(cl + 15);
+            //文件总长取自Content-Range: bytes a-b/总长
+            char *cr = strcasestr(buf, "Content-Range:");
+            if (cr && strchr(cr, '/') && 0 == file_size)
+                file_size = atol(strchr(cr, '/') + 1);
+        }
+        else
+            have += n;
+    }
+    return status;
+}
+
+static void *client(void *arg)
+{
+    static const int SIZE = 256 * 1024;
+    char *buf = new char[SIZE];
+    unsigned int seed = (unsigned long)arg;
+    int fd = connect_to();
+    while (!stop)
+    {
+        long body;
+        int status;
+        bool closing;
+        if (whole)
+            status = request(fd, NULL, buf, SIZE, body, closing);
+        else
+        {
+            char range[64];
+            long start = file_size > window ? rand_r(&seed) % (file_size - window) : 0;
+            snprintf(range, sizeof(range), "%ld-%ld", start, start + window - 1);
+            status = request(fd, range, buf, SIZE, body, closing);
+        }
+        if ((whole ? 200 : 206) != status)
+        {
+            fprintf(stderr, "seek failed: status %d\n", status);
+            exit(1);
+        }
+        ++seeks;
+        bytes += body;
+        //长连接处理的请求数达到上限(-K)，重新连接
+        if (closing)
+        {
+            close(fd);
+            fd = connect_to();
+        }
+    }
+    close(fd);
+    delete[] buf;
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int conns = 8, seconds = 5;
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:c:f:s:t:w")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h':
+            host = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'c':
+            conns = atoi(optarg);
+            break;
+        case 'f':
+            path = optarg;
+            break;
+        case 's':
+            window = atol(optarg) * 1024;
+            break;
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        case 'w':
+            whole = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    //先请求第一个字节，从Content-Range得到文件长度
+    {
+        char buf[4096];
+        long body;
+        bool closing;
+        int fd = connect_to();
+        if (request(fd, "0-0", buf, sizeof(buf), body, closing) != 206 || file_size <= 0)
+        {
+            fprintf(stderr, "%s: no 206 for Range: bytes=0-0\n", path);
+            return 1;
+        }
+        close(fd);
+    }
+
+    std::vector<pthread_t> threads(conns);
+    double start = now();
+    for (int i = 0; i < conns; ++i)
+        pthread_create(&threads[i], NULL, client, (void *)(unsigned long)(i + 1));
+    sleep(seconds);
+    stop = true;
+    for (int i = 0; i < conns; ++i)
+        pthread_join(threads[i], NULL);
+    double t = now() - start;
+    printf("%s (%ld bytes), %d conns, %s: %.0f seeks/s  %.1f MB/s\n", path, file_size, conns,
+           whole ? "whole file per seek" : "range", seeks / t, bytes / t / 1e6);
+    return 0;
+}
@@ -0,0 +1,211 @@
+/*************************************************************
+*TLS基准
+*对运行中的服务器依次测量：完整握手和会话恢复握手每秒完成的短连接数(每个连接请求一个小页面)，
+*以及一个长连接上反复下载同一文件的吞吐量；-c时同样的下载走明文，作为对照
+*服务器分别以-x 1和-x 0启动各测一次，比较内核TLS和用户态加密
+*用法：tls_bench [-h 地址] [-p 端口] [-n 连接数] [-f 文件] [-r 下载次数] [-c 明文端口]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+
+static const char *host = "127.0.0.1";
+static int port = 9006;
+static char buf[256 * 1024];
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_to(int p)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(p);
+    inet_pton(AF_INET, host, &addr.sin_addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("connect");
+        exit(1);
+    }
+    return fd;
+}
+
+//TLS或明文连接上的收发
+struct conn
+{
+    int fd;
+    SSL *ssl;
+
+    int send_all(const char *p, int len)
+    {
+        return ssl ? SSL_write(ssl, p, len) : send(fd, p, len, 0);
+    }
+    int recv_some(char *p, int len)
+    {
+        return ssl ? SSL_read(ssl, p, len) : recv(fd, p, len, 0);
+    }
+};
+
+//发出一个GET并读完响应，返回内容长度，出错返回-1；响应头须在第一次读取中收全
+static long get(conn &c, const char *path, bool close)
+{
+    char req[512];
+    int len = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n", path, host,
+                       close ? "Connection: close\r\n" : "");
+    if (c.send_all(req, len) != len)
+        return -1;
+    long have = 0, body = -1, head = 0;
+    while (body < 0 || have < head + body)
+    {
+        int n = c.recv_some(buf + (body < 0 ? have : 0), body < 0 ? sizeof(buf) - have : sizeof(buf));
+        if (n <= 0)
+            return -1;
+        if (body < 0)
+        {
+            have += n;
+            buf[have < (long)sizeof(buf) ? have : sizeof(buf) - 1] = '\0';
+            char *end = strstr(buf, "\r\n\r\n");
+            char *cl = strcasestr(buf, "Content-Length:");
+            if (!end || !cl)
+                continue;
+            head = end + 4 - buf;
+            body = atol(cl + 15);
+        }
+        else
+            have += n;
+    }
+    return body;
+}
+
+//n个短连接，每个完成握手后请求一个小页面；resume为true时复用上一个连接的会话
+static void handshakes(SSL_CTX *ctx, int n, bool resume)
+{
+    SSL_SESSION *sess = NULL;
+    int reused = 0;
+    double start = now();
+    for (int i = 0; i < n; ++i)
+    {
+        conn c = {connect_to(port), SSL_new(ctx)};
+        SSL_set_fd(c.ssl, c.fd);
+        if (sess)
+            SSL_set_session(c.ssl, sess);
+        if (SSL_connect(c.ssl) != 1 || get(c, "/5", true) < 0)
+        {
+            fprintf(stderr, "handshake %d failed\n", i);
+            exit(1);
+        }
+        reused += SSL_session_reused(c.ssl);
+        //TLS 1.3的票据在握手之后才到，读完响应时已收到
+        if (resume)
+        {
+            SSL_SESSION_free(sess);
+            sess = SSL_get1_session(c.ssl);
+        }
+        SSL_shutdown(c.ssl);
+        SSL_free(c.ssl);
+        close(c.fd);
+    }
+    double t = now() - start;
+    printf("%-8s handshakes: %6.0f conn/s  %7.1f us/conn  (%d/%d resumed)\n", resume ? "resumed" : "full", n / t,
+           t * 1e6 / n, reused, n);
+    SSL_SESSION_free(sess);
+}
+
+//一个长连接上下载rounds次
+static void bulk(SSL_CTX *ctx, int p, const char *path, int rounds)
+{
+    conn c = {connect_to(p), NULL};
+    if (ctx)
+    {
+        c.ssl = SSL_new(ctx);
+        SSL_set_fd(c.ssl, c.fd);
+        if (SSL_connect(c.ssl) != 1)
+        {
+            fprintf(stderr, "handshake failed\n");
+            exit(1);
+        }
+    }
+    double start = now();
+    long total = 0;
+    for (int i = 0; i < rounds; ++i)
+    {
+        long n = get(c, path, false);
+        if (n < 0)
+        {
+            fprintf(stderr, "download %s failed\n", path);
+            exit(1);
+        }
+        total += n;
+    }
+    double t = now() - start;
+    printf("%-8s bulk %s: %8.1f MB/s  (%ld bytes in %.3f s)\n", ctx ? SSL_get_version(c.ssl) : "plain", path,
+           total / t / 1e6, total, t);
+    if (c.ssl)
+    {
+        SSL_shutdown(c.ssl);
+        SSL_free(c.ssl);
+    }
+    close(c.fd);
+}
+
+int main(int argc, char *argv[])
+{
+    int n = 500, rounds = 20, plain = 0;
+    const char *path = "/test1.jpg";
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:n:f:r:c:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h':
+            host = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'n':
+            n = atoi(optarg);
+            break;
+        case 'f':
+            path = optarg;
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 'c':
+            plain = atoi(optarg);
+            break;
+        default:
+            break;
+        }
+    }
+
+    //只测服务器的握手和加密开销，不校验证书
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+
+    handshakes(ctx, n, false);
+    handshakes(ctx, n, true);
+    bulk(ctx, port, path, rounds);
+    if (plain)
+        bulk(NULL, plain, path, rounds);
+    SSL_CTX_free(ctx);
+    return 0;
+}
@@ -0,0 +1,227 @@
+/*************************************************************
+*平滑升级测试
+*若干个长连接不停地逐个请求页面，运行中向服务器发送SIGUSR2，
+*统计升级前后失败的请求(连接被拒绝、被重置、响应不完整或状态码不是200)，并等待旧进程退出
+*有失败的请求或旧进程没有退出时返回1
+*用法：upgrade_test -P 服务器pid [-h 地址] [-p 端口] [-c 连接数] [-f 页面] [-s 发送信号前的秒数] [-t 秒数]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <vector>
+
+static const char *host = "127.0.0.1";
+static int port = 9006;
+static const char *path = "/";
+
+static std::atomic<bool> stop(false);
+static std::atomic<long> done(0);
+static std::atomic<long> reconnects(0);
+//按失败原因分别计数
+static std::atomic<long> refused(0);
+static std::atomic<long> reset(0);
+static std::atomic<long> bad_status(0);
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//连接失败返回-1
+static int connect_to()
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host, &addr.sin_addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//发出一个GET并读完响应，返回状态码，连接出错或响应不完整返回-1；服务器将关闭连接时closing为true
+//响应头须在第一次读取中收全
+static int get(int fd, char *buf, int size, bool &closing)
+{
+    char req[512];
+    int len = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n", path, host);
+    if (send(fd, req, len, MSG_NOSIGNAL) != len)
+        return -1;
+    long have = 0, body = -1, head = 0;
+    int status = 0;
+    while (body < 0 || have < head + body)
+    {
+        int n = recv(fd, buf + (body < 0 ? have : 0), body < 0 ? size - 1 - have : size, 0);
+        if (n <= 0)
+            return -1;
+        if (body < 0)
+        {
+            have += n;
+            buf[have] = '\0';
+            char *end = strstr(buf, "\r\n\r\n");
+            char *cl = strcasestr(buf, "Content-Length:");
+            if (!end || !cl)
+                continue;
+            status = atoi(buf + 9);
+            char *conn = strcasestr(buf, "Connection:");
+            closing = conn && conn < end && 0 == strncasecmp(conn + 11 + strspn(conn + 11, " "), "close", 5);
+            head = end + 4 - buf;
+            body = atol(cl + 15);
+        }
+        else
+            have += n;
+    }
+    return status;
+}
+
+static void *client(void *)
+{
+    static const int SIZE = 64 * 1024;
+    char *buf = new char[SIZE];
+    int fd = -1;
+    while (!stop)
+    {
+        if (fd < 0)
+        {
+            fd = connect_to();
+            if (fd < 0)
+            {
+                ++refused;
+                usleep(1000);
+                continue;
+            }
+        }
+        bool closing = false;
+        int status = get(fd, buf, SIZE, closing);
+        if (status < 0)
+            ++reset;
+        else if (200 != status)
+            ++bad_status;
+        else
+            ++done;
+        //排空中的旧进程在响应中带Connection:close，之后的请求由新进程接受的连接处理
+        if (status < 0 || closing)
+        {
+            close(fd);
+            fd = -1;
+            if (status > 0)
+                ++reconnects;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+    delete[] buf;
+    return NULL;
+}
+
+//旧进程是否已退出，父进程尚未回收的僵尸进程也算退出
+static bool exited(pid_t pid)
+{
+    if (kill(pid, 0) < 0)
+        return ESRCH == errno;
+    char file[64], stat[256];
+    snprintf(file, sizeof(file), "/proc/%d/stat", (int)pid);
+    FILE *fp = fopen(file, "r");
+    if (!fp)
+        return true;
+    bool zombie = fgets(stat, sizeof(stat), fp) && strstr(stat, ") Z ");
+    fclose(fp);
+    return zombie;
+}
+
+int main(int argc, char *argv[])
+{
+    int conns = 16, delay = 1, seconds = 10;
+    pid_t pid = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "P:h:p:c:f:s:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'P':
+            pid = atoi(optarg);
+            break;
+        case 'h':
+            host = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'c':
+            conns = atoi(optarg);
+            break;
+        case 'f':
+            path = optarg;
+            break;
+        case 's':
+            delay = atoi(optarg);
+            break;
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        default:
+            break;
+        }
+    }
+    if (pid <= 0 || exited(pid))
+    {
+        fprintf(stderr, "usage: upgrade_test -P <server pid> [-h host] [-p port] [-c conns] [-f path] [-s delay] [-t seconds]\n");
+        return 1;
+    }
+
+    std::vector<pthread_t> threads(conns);
+    double start = now();
+    for (int i = 0; i < conns; ++i)
+        pthread_create(&threads[i], NULL, client, NULL);
+    sleep(delay);
+    long before = done;
+    if (kill(pid, SIGUSR2) < 0)
+    {
+        perror("kill");
+        return 1;
+    }
+    double signaled = now();
+
+    //流量不停，等待旧进程排空后退出
+    double gone = 0;
+    while (now() - start < seconds)
+    {
+        if (!gone && exited(pid))
+            gone = now();
+        usleep(10 * 1000);
+    }
+    stop = true;
+    for (int i = 0; i < conns; ++i)
+        pthread_join(threads[i], NULL);
+    double t = now() - start;
+
+    long failed = refused + reset + bad_status;
+    printf("GET %s, %d conns, %.1fs: %ld requests (%ld before SIGUSR2), %.0f req/s, %ld reconnects\n", path, conns, t,
+           (long)done, before, done / t, (long)reconnects);
+    printf("failed: %ld (refused %ld, reset %ld, non-200 %ld)\n", failed, (long)refused, (long)reset, (long)bad_status);
+    if (gone)
+        printf("old process %d exited %.0fms after SIGUSR2\n", (int)pid, (gone - signaled) * 1e3);
+    else
+        printf("old process %d still running\n", (int)pid);
+    return failed || !gone ? 1 : 0;
+}
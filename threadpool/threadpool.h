@@ -6,6 +6,7 @@
 #include <exception>
 #include <pthread.h>
 #include "../lock/locker.h"
+#include "../lock/completion_queue.h"
 #include "../CGImysql/sql_connection_pool.h"
 
 template <typename T>
@@ -32,19 +33,21 @@ private:
     sem m_queuestat;            //是否有任务需要处理
     connection_pool *m_connPool;  //数据库
     int m_actor_model;          //模型切换
+    bool m_stop;                //是否结束线程
 };
 
 //线程池构造函数，初始化：事件处理模型、线程总数、最大请求数、线程描述符数组、数据库连接池
 template <typename T>
 threadpool<T>::threadpool( int actor_model, connection_pool *connPool, int thread_number, int max_requests) : m_actor_model(actor_model),
-m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL),m_connPool(connPool)
+m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL),m_connPool(connPool), m_stop(false)
 {
     if (thread_number <= 0 || max_requests <= 0)
         throw std::exception();
     m_threads = new pthread_t[m_thread_number];
     if (!m_threads)
         throw std::exception();
-    //创建thread_number个线程，每个线程运行worker,分离线程，并把标识符存入m_threads数组中
+    //创建thread_number个线程，每个线程运行worker，并把标识符存入m_threads数组中
+    //不分离线程：析构时要等工作线程退出，它们会访问连接对象和反应堆的完成队列
     for (int i = 0; i < thread_number; ++i)
     {
         if (pthread_create(m_threads + i, NULL, worker, this) != 0)
@@ -52,18 +55,20 @@ m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL),m_
             delete[] m_threads;
             throw std::exception();
         }
-        //脱离线程退出时，会自动释放占用的系统资源
-        if (pthread_detach(m_threads[i]))
-        {
-            delete[] m_threads;
-            throw std::exception();
-        }
     }
 }
 
 template <typename T>
 threadpool<T>::~threadpool()
 {
+    //唤醒所有工作线程，处理完手头的请求后退出
+    m_queuelocker.lock();
+    m_stop = true;
+    m_queuelocker.unlock();
+    for (int i = 0; i < m_thread_number; ++i)
+        m_queuestat.post();
+    for (int i = 0; i < m_thread_number; ++i)
+        pthread_join(m_threads[i], NULL);
     delete[] m_threads;
 }
 
@@ -79,6 +84,7 @@ bool threadpool<T>::append(T *request, int state)
         return false;
     }
     request->m_state = state;
+    request->enter_worker();
     m_workqueue.push_back(request);
     m_queuelocker.unlock();
     //V操作
@@ -96,6 +102,7 @@ bool threadpool<T>::append_p(T *request)
         m_queuelocker.unlock();
         return false;
     }
+    request->enter_worker();
     m_workqueue.push_back(request);
     m_queuelocker.unlock();
     m_queuestat.post();
@@ -120,6 +127,11 @@ void threadpool<T>::run()
         //P操作
         m_queuestat.wait();
         m_queuelocker.lock();
+        if (m_stop)
+        {
+            m_queuelocker.unlock();
+            break;
+        }
         if (m_workqueue.empty())
         {
             m_queuelocker.unlock();
@@ -139,28 +151,28 @@ void threadpool<T>::run()
             {
                 if (request->read_once())//
                 {
-                    request->improv = 1;
-                    //创建一个连接RALL,指定一个数据库连接
+                    //创建一个连接RALL,指定一个数据库连接，process()内部重新注册EPOLLONESHOT
                     connectionRAII mysqlcon(&request->mysql, m_connPool);
                     request->process();
                 }
-                else//对方关闭连接
+                else//对方关闭连接，经完成队列通知反应堆关闭连接、移除定时器
                 {
-                    
-                    request->improv = 1;
-                    request->timer_flag = 1;
+                    request->notify(completion_queue::CLOSE);
                 }
             }
             else//写事件
             {
-                if (request->write())//write()成功或socket缓冲区满了，等待下一次epoll触发
+                //write()成功或socket缓冲区满了，write()内部已重新注册事件，等待下一次epoll触发
+                int ret = request->write();
+                if (!ret)//write(出错
                 {
-                    request->improv = 1;
+                    request->notify(completion_queue::CLOSE);
                 }
-                else//write(出错
+                //读缓冲区中还有流水线上的请求，在本线程接着处理
+                else if (2 == ret)
                 {
-                    request->improv = 1;
-                    request->timer_flag = 1;
+                    connectionRAII mysqlcon(&request->mysql, m_connPool);
+                    request->process();
                 }
             }
         }
@@ -169,6 +181,8 @@ void threadpool<T>::run()
             connectionRAII mysqlcon(&request->mysql, m_connPool);
             request->process();
         }
+        //处理期间连接可能已被反应堆关闭，由最后一个处理完的工作线程通知释放
+        request->leave_worker();
     }
 }
 #endif
@@ -6,16 +6,9 @@ sort_timer_lst::sort_timer_lst()
     head = NULL;
     tail = NULL;
 }
-//链表被销毁时，删除所有定时器
+//定时器随连接对象由slab释放，链表销毁时无需逐个删除
 sort_timer_lst::~sort_timer_lst()
 {
-    util_timer *tmp = head;
-    while (tmp)
-    {
-        head = tmp->next;
-        delete tmp;
-        tmp = head;
-    }
 }
 //将目标定时器timer添加到链表中
 void sort_timer_lst::add_timer(util_timer *timer)
@@ -69,7 +62,7 @@ void sort_timer_lst::adjust_timer(util_timer *timer)
         add_timer(timer, timer->next);
     }
 }
-//从链表删除目标定时器
+//从链表摘下目标定时器，并清空前后指针以便节点被复用
 void sort_timer_lst::del_timer(util_timer *timer)
 {
     if (!timer)
@@ -79,31 +72,29 @@ void sort_timer_lst::del_timer(util_timer *timer)
     //只有一个定时器
     if ((timer == head) && (timer == tail))
     {
-        delete timer;
         head = NULL;
         tail = NULL;
-        return;
     }
     //被删除的定时器在链表头部
-    if (timer == head)
+    else if (timer == head)
     {
         head = head->next;
         head->prev = NULL;
-        delete timer;
-        return;
     }
     //被删除的定时器在链表尾部
-    if (timer == tail)
+    else if (timer == tail)
     {
         tail = tail->prev;
         tail->next = NULL;
-        delete timer;
-        return;
     }
     //被删除的定时器在链表中间
-    timer->prev->next = timer->next;
-    timer->next->prev = timer->prev;
-    delete timer;
+    else
+    {
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+    }
+    timer->prev = NULL;
+    timer->next = NULL;
 }
 
 //定时任务处理函数
@@ -114,7 +105,7 @@ void sort_timer_lst::tick()
         return;
     }
     //获取当前时间
-    time_t cur = time(NULL);
+    time_t cur = Utils::get_ms();
     util_timer *tmp = head;
     //遍历链表
     while (tmp)
@@ -124,15 +115,9 @@ void sort_timer_lst::tick()
         {
             break;
         }
-        //到期，则调用回调函数，执行定时任务
+        //到期，先从链表摘下，再调用回调函数执行定时任务，回调会归还定时器所在的连接对象
+        del_timer(tmp);
         tmp->cb_func(tmp->user_data);
-         //将处理后的定时器从链表容器删除，重置链表头节点
-        head = tmp->next;
-        if (head)
-        {
-            head->prev = NULL;
-        }
-        delete tmp;
         tmp = head;
     }
 }
@@ -199,17 +184,6 @@ void Utils::addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
     setnonblocking(fd);
 }
 
-//信号处理函数，管道加入到epoll事件表表，被监听
-void Utils::sig_handler(int sig)
-{
-    //为保证函数的可重入性，保留原来的errno
-    int save_errno = errno;
-    int msg = sig;
-    //将信号写入管道，通知主循环
-    send(u_pipefd[1], (char *)&msg, 1, 0);
-    errno = save_errno;
-}
-
 //设置信号函数：
 void Utils::addsig(int sig, void(handler)(int), bool restart)
 {
@@ -223,13 +197,48 @@ void Utils::addsig(int sig, void(handler)(int), bool restart)
     assert(sigaction(sig, &sa, NULL) != -1);
 }
 
-//定时处理任务，重新定时以不断触发SIGALRM信号
+//屏蔽信号：信号不再打断任何线程的系统调用，也不必在信号处理函数里转发
+//线程继承创建者的信号掩码，因此要在日志、线程池等线程创建之前调用
+void Utils::block_signals()
+{
+    sigemptyset(&u_sigmask);
+    sigaddset(&u_sigmask, SIGTERM);
+    sigaddset(&u_sigmask, SIGHUP);
+    sigaddset(&u_sigmask, SIGUSR2);
+    assert(pthread_sigmask(SIG_BLOCK, &u_sigmask, NULL) == 0);
+}
+
+int Utils::create_signalfd()
+{
+    return signalfd(-1, &u_sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+//周期性timerfd替代alarm，分辨率可低于1秒，每个反应堆各有一个
+int Utils::create_timerfd()
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+        return fd;
+    struct itimerspec its;
+    its.it_interval.tv_sec = m_TIMESLOT / 1000;
+    its.it_interval.tv_nsec = (long)(m_TIMESLOT % 1000) * 1000000;
+    its.it_value = its.it_interval;
+    timerfd_settime(fd, 0, &its, NULL);
+    return fd;
+}
+
+time_t Utils::get_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (time_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//定时处理任务
 void Utils::timer_handler()
 {
     //调用滴答函数，遍历链表，检查所有定时任务
     m_timer_lst.tick();
-    //因为一次alarm函数只会引起一次SIGALRM信号，需要重新定时，不断触发
-    alarm(m_TIMESLOT);
 }
 
 //向客户端发送错误，并关闭该连接
@@ -239,15 +248,19 @@ void Utils::show_error(int connfd, const char *info)
     close(connfd);
 }
 
-int *Utils::u_pipefd = 0;
-int Utils::u_epollfd = 0;
+sigset_t Utils::u_sigmask;
 
 //定时器回调函数，执行定时任务，删除非活动连接socket上注册事件，并关闭之
 class Utils;
 void cb_func(client_data *user_data)
 {
-    epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
+    if (user_data->epollfd >= 0)
+        epoll_ctl(user_data->epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
+    else//io_uring模式：先shutdown让内核中未完成的收发立即返回并释放socket
+        shutdown(user_data->sockfd, SHUT_RDWR);
     close(user_data->sockfd);
+    //定时器随后被链表删除，置空防止重复关闭
+    user_data->timer = NULL;
     http_conn::m_user_count--;
 }
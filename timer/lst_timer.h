@@ -20,20 +20,30 @@
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <atomic>
 
 #include <time.h>
 #include "../log/log.h"
 /*******************************************************参考《高性能服务器编程》p195*****************************************************/
 class util_timer;
+struct reactor;
 //用户数据结构
 struct client_data
 {
-    //客户端socket地址
-    sockaddr_in address;
     //socket描述符
     int sockfd;
+    //所属反应堆的epoll内核事件表，io_uring模式下为-1
+    int epollfd;
+    //连接序号，accept时分配，使fd被复用前未完成的io_uring请求失效
+    unsigned int gen;
+    //在线程池中排队或正在处理的次数，最高位表示期间已被反应堆关闭，见http_conn::defer_close
+    std::atomic<int> inflight;
     //定时器
     util_timer *timer;
+    //所属反应堆，关闭时把连接对象归还给它的slab
+    reactor *owner;
 };
 
 //定时器类
@@ -43,7 +53,7 @@ public:
     util_timer() : prev(NULL), next(NULL) {}
 
 public:
-    //超时时间
+    //超时时间，单调时钟毫秒
     time_t expire;
     //任务回调函数
     void (* cb_func)(client_data *);
@@ -53,7 +63,7 @@ public:
     util_timer *next;
 };
 
-//升序定时器链表
+//升序定时器链表，节点嵌在连接对象中，链表只负责串联，不负责释放
 class sort_timer_lst
 {
 public:
@@ -63,7 +73,7 @@ public:
     void add_timer(util_timer *timer);
     //当定时任务发生变化，调整定时器在链表的位置
     void adjust_timer(util_timer *timer);
-    //从链表中删除一个定时器
+    //从链表中摘下一个定时器
     void del_timer(util_timer *timer);
     //滴答
     void tick();
@@ -83,6 +93,7 @@ public:
     Utils() {}
     ~Utils() {}
 
+    //timeslot为定时周期，单位毫秒
     void init(int timeslot);
 
     //对文件描述符设置非阻塞
@@ -91,23 +102,28 @@ public:
     //将内核事件表注册读事件，ET模式：当事件发生，必须处理，同一事件不重复触发，选择开启EPOLLONESHOT：同一个连接由同一个线程处理
     void addfd(int epollfd, int fd, bool one_shot, int TRIGMode);
 
-    //信号处理函数
-    static void sig_handler(int sig);
-
     //设置信号函数
     void addsig(int sig, void(handler)(int), bool restart = true);
 
-    //定时处理任务，重新定时以不断触发SIGALRM信号
+    //在所有线程中屏蔽SIGTERM、SIGHUP、SIGUSR2，须在创建任何线程之前调用，之后统一由signalfd读取
+    static void block_signals();
+    //创建接收被屏蔽信号的signalfd
+    static int create_signalfd();
+    //创建周期为m_TIMESLOT毫秒的timerfd
+    int create_timerfd();
+
+    //单调时钟的当前毫秒数，不受系统时间调整影响
+    static time_t get_ms();
+
+    //定时处理任务，timerfd周期触发，无需重新定时
     void timer_handler();
 
     void show_error(int connfd, const char *info);
 
 public:
-    //
-    static int *u_pipefd;//管道
-    sort_timer_lst m_timer_lst;//定时器升序链表
-    static int u_epollfd;//epoll描述符
-    int m_TIMESLOT;//定时周期，每隔m_TIMESLOT就会触发定时信号
+    static sigset_t u_sigmask;//由signalfd接收的信号集合
+    sort_timer_lst m_timer_lst;//定时器升序链表，每个反应堆一个
+    int m_TIMESLOT;//定时周期(毫秒)，每隔m_TIMESLOT timerfd触发一次
 };
 
 void cb_func(client_data *user_data);
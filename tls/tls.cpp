@@ -0,0 +1,171 @@
+#include "tls.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <openssl/err.h>
+#include "../log/log.h"
+
+tls_context *tls_context::get_instance()
+{
+    static tls_context instance;
+    return &instance;
+}
+
+tls_context::tls_context() : m_ctx(NULL), m_close_log(0), m_full(0), m_resumed(0), m_ktls(0)
+{
+}
+
+tls_context::~tls_context()
+{
+    if (m_ctx)
+        SSL_CTX_free(m_ctx);
+}
+
+bool tls_context::init(const char *cert, const char *key, bool ktls, int close_log)
+{
+    m_close_log = close_log;
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx)
+        return false;
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+    //关闭重协商，SSL_read只会等待可读；对方不发close_notify直接关闭时按正常关闭处理
+    long options = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_IGNORE_UNEXPECTED_EOF;
+    if (ktls)
+    {
+        //握手完成时OpenSSL设置TCP_ULP并把密钥交给内核，内核不支持时仍在用户态加密
+        //TLS 1.2只选内核支持的AEAD套件，TLS 1.3的默认套件都是AEAD
+        options |= SSL_OP_ENABLE_KTLS;
+        SSL_CTX_set_cipher_list(ctx, "ECDHE+AESGCM:ECDHE+CHACHA20");
+    }
+    SSL_CTX_set_options(ctx, options);
+    //部分写：大的iovec按记录陆续发出；空闲连接的读写缓冲区归还，不常驻34KB
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+
+    //会话缓存供TLS 1.2按会话ID恢复，票据密钥在进程内随机生成，平滑升级后的新进程不认旧票据
+    static const unsigned char sid_ctx[] = "TinyWebServer";
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, SESSION_CACHE_SIZE);
+    SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(ctx) != 1)
+    {
+        LOG_ERROR("tls: %s", ERR_error_string(ERR_get_error(), NULL));
+        ERR_clear_error();
+        SSL_CTX_free(ctx);
+        return false;
+    }
+    m_ctx = ctx;
+    LOG_INFO("tls: %s, ktls %s", cert, ktls ? "on" : "off");
+    return true;
+}
+
+SSL *tls_context::accept(int fd)
+{
+    SSL *ssl = SSL_new(m_ctx);
+    if (!ssl)
+        return NULL;
+    SSL_set_fd(ssl, fd);
+    SSL_set_accept_state(ssl);
+    return ssl;
+}
+
+int tls_context::handshake(SSL *ssl)
+{
+    ERR_clear_error();
+    int ret = SSL_do_handshake(ssl);
+    if (1 == ret)
+    {
+        bool resumed = SSL_session_reused(ssl);
+        bool ktls = ktls_send(ssl);
+        if (resumed)
+            ++m_resumed;
+        else
+            ++m_full;
+        if (ktls)
+            ++m_ktls;
+        LOG_INFO("tls: %s %s%s, ktls send %d recv %d", SSL_get_version(ssl), SSL_get_cipher_name(ssl),
+                 resumed ? " resumed" : "", ktls, ktls_recv(ssl));
+        return 1;
+    }
+    int err = SSL_get_error(ssl, ret);
+    if (SSL_ERROR_WANT_READ == err || SSL_ERROR_WANT_WRITE == err)
+        return 0;
+    //扫描器和不信任证书的客户端都会中止握手，只记警告
+    LOG_WARN("tls: handshake failed: %s", ERR_error_string(ERR_get_error(), NULL));
+    ERR_clear_error();
+    return -1;
+}
+
+void tls_context::release(SSL *ssl)
+{
+    //未正常关闭的会话会被移出缓存，这里视为已关闭
+    SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    SSL_free(ssl);
+}
+
+ssize_t tls_context::read(SSL *ssl, void *buf, int len)
+{
+    ERR_clear_error();
+    int n = SSL_read(ssl, buf, len);
+    if (n > 0)
+        return n;
+    switch (SSL_get_error(ssl, n))
+    {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    default:
+        ERR_clear_error();
+        errno = ECONNRESET;
+        return -1;
+    }
+}
+
+//小的iovec(响应头、预生成的响应)连同其后的内容拼成一个记录，大的直接交给SSL_write，不拷贝
+ssize_t tls_context::writev(SSL *ssl, const struct iovec *iov, int cnt)
+{
+    char gather[GATHER_SIZE];
+    ssize_t total = 0;
+    ERR_clear_error();
+    for (int i = 0; i < cnt; ++i)
+    {
+        if (0 == iov[i].iov_len)
+            continue;
+        const char *base = (const char *)iov[i].iov_base;
+        int len = iov[i].iov_len > INT_MAX ? INT_MAX : iov[i].iov_len;
+        if (len < GATHER_SIZE)
+        {
+            len = 0;
+            for (int k = i; k < cnt && len < GATHER_SIZE; ++k)
+            {
+                int n = iov[k].iov_len < (size_t)(GATHER_SIZE - len) ? iov[k].iov_len : GATHER_SIZE - len;
+                memcpy(gather + len, iov[k].iov_base, n);
+                len += n;
+            }
+            base = gather;
+        }
+        int n = SSL_write(ssl, base, len);
+        if (n > 0)
+        {
+            total += n;
+            //拼成的记录可能只取了某个iovec的一部分，先返回，由调用者推进iovec后再来
+            if (n < len || base == gather)
+                break;
+            continue;
+        }
+        //已发出的部分先返回，下次从同一位置重试
+        if (total > 0)
+            break;
+        int err = SSL_get_error(ssl, n);
+        ERR_clear_error();
+        errno = SSL_ERROR_WANT_WRITE == err || SSL_ERROR_WANT_READ == err ? EAGAIN : ECONNRESET;
+        return -1;
+    }
+    return total;
+}
@@ -0,0 +1,61 @@
+#ifndef TLS_H
+#define TLS_H
+
+/*************************************************************
+*TLS终止
+*OpenSSL完成握手后把会话密钥交给内核TLS(kTLS)：发送方向由内核加密，
+*writev和sendfile仍直接作用于socket，文件内容不经用户态加密和拷贝
+*内核不支持kTLS时由SSL_write在用户态加密，sendfile退回mmap + writev
+*会话恢复：TLS 1.2按会话ID查服务器端会话缓存，TLS 1.3和支持票据的客户端用会话票据
+**************************************************************/
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <openssl/ssl.h>
+
+class tls_context
+{
+public:
+    //单例模式
+    static tls_context *get_instance();
+
+    //加载证书链和私钥，ktls为握手后是否尝试把密钥交给内核；失败返回false
+    bool init(const char *cert, const char *key, bool ktls, int close_log);
+    bool enabled() const { return m_ctx != NULL; }
+
+    //为新接受的连接创建服务器端的SSL对象，握手在第一次可读时由工作线程进行
+    SSL *accept(int fd);
+    //非阻塞握手：1完成，0需等待可读或可写(见SSL_want_write)，-1失败
+    int handshake(SSL *ssl);
+    //连接关闭时释放，socket可能已关闭，不再发送close_notify，会话仍可恢复
+    static void release(SSL *ssl);
+
+    /*以下两个函数与recv、writev的返回值相同：对方关闭返回0，需等待时返回-1且errno为EAGAIN*/
+    static ssize_t read(SSL *ssl, void *buf, int len);
+    //iovec逐个交给SSL_write；WANT_WRITE后须以相同的数据重试，调用者只按返回值推进iovec即可
+    static ssize_t writev(SSL *ssl, const struct iovec *iov, int cnt);
+
+    //发送、接收方向是否已由内核加解密
+    static bool ktls_send(SSL *ssl) { return BIO_get_ktls_send(SSL_get_wbio(ssl)); }
+    static bool ktls_recv(SSL *ssl) { return BIO_get_ktls_recv(SSL_get_rbio(ssl)); }
+
+    long full_handshakes() { return m_full; }
+    long resumed_handshakes() { return m_resumed; }
+    long ktls_conns() { return m_ktls; }
+
+private:
+    tls_context();
+    ~tls_context();
+
+    static const int SESSION_CACHE_SIZE = 20480;
+    static const int GATHER_SIZE = 16384;   //一个TLS记录的最大明文长度
+
+    SSL_CTX *m_ctx;
+    int m_close_log;
+    std::atomic<long> m_full;
+    std::atomic<long> m_resumed;
+    std::atomic<long> m_ktls;   //发送方向交给内核的连接数
+};
+
+#endif
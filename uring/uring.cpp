@@ -0,0 +1,217 @@
+#include "uring.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+//内核与用户态共享的环形队列下标，需要acquire/release语义
+static inline unsigned load_acquire(unsigned *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+static inline void store_release(unsigned *p, unsigned v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+uring::uring()
+{
+    m_ringfd = -1;
+    m_sq_ptr = MAP_FAILED;
+    m_cq_ptr = MAP_FAILED;
+    m_sqes = (struct io_uring_sqe *)MAP_FAILED;
+    m_bufs = NULL;
+    m_sq_size = m_cq_size = m_sqes_size = 0;
+}
+
+uring::~uring()
+{
+    delete[] m_bufs;
+    if (m_sqes != MAP_FAILED)
+        munmap(m_sqes, m_sqes_size);
+    if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr)
+        munmap(m_cq_ptr, m_cq_size);
+    if (m_sq_ptr != MAP_FAILED)
+        munmap(m_sq_ptr, m_sq_size);
+    if (m_ringfd >= 0)
+        close(m_ringfd);
+}
+
+bool uring::init(unsigned entries, int buf_num, int buf_size)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    m_ringfd = syscall(__NR_io_uring_setup, entries, &p);
+    if (m_ringfd < 0)
+        return false;
+    //需要单次mmap映射两个环，以及保证完成事件不丢失
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP))
+        return false;
+
+    m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (m_cq_size > m_sq_size)
+        m_sq_size = m_cq_size;
+    m_sq_ptr = mmap(0, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQ_RING);
+    if (m_sq_ptr == MAP_FAILED)
+        return false;
+    m_cq_ptr = m_sq_ptr;
+
+    m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    m_sqes = (struct io_uring_sqe *)mmap(0, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED)
+        return false;
+
+    char *sq = (char *)m_sq_ptr;
+    m_sq_head = (unsigned *)(sq + p.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    m_sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    m_sq_array = (unsigned *)(sq + p.sq_off.array);
+    m_sqe_tail = *m_sq_tail;
+
+    char *cq = (char *)m_cq_ptr;
+    m_cq_head = (unsigned *)(cq + p.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    m_cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    //一次性把全部接收缓冲区交给内核，并同步等待结果
+    m_buf_num = buf_num;
+    m_buf_size = buf_size;
+    m_bufs = new char[(size_t)buf_num * buf_size];
+    provide_bufs(0, buf_num, 0);
+    if (submit_and_wait(1) < 0)
+        return false;
+    struct io_uring_cqe *cqe = peek_cqe();
+    if (!cqe || cqe->res < 0)
+        return false;
+    cqe_seen();
+    return true;
+}
+
+struct io_uring_sqe *uring::provide_bufs(int bid, int nr, unsigned char flags)
+{
+    struct io_uring_sqe *sqe = prep(IORING_OP_PROVIDE_BUFFERS, nr, 0);
+    if (!sqe)
+        return NULL;
+    sqe->addr = (uint64_t)(uintptr_t)get_buf(bid);
+    sqe->len = m_buf_size;
+    sqe->off = bid;
+    sqe->buf_group = BUF_GROUP;
+    sqe->flags |= flags;
+    return sqe;
+}
+
+//归还用完的接收缓冲区：只填充提交项，随下一次io_uring_enter一起提交
+//成功时不产生完成事件，失败的完成事件user_data为0，由调用者忽略
+void uring::recycle_buf(int bid)
+{
+    provide_bufs(bid, 1, IOSQE_CQE_SKIP_SUCCESS);
+}
+
+struct io_uring_sqe *uring::get_sqe()
+{
+    unsigned head = load_acquire(m_sq_head);
+    //提交队列已满，先把已填充的提交给内核
+    if (m_sqe_tail - head >= *m_sq_mask + 1)
+    {
+        submit_and_wait(0);
+        head = load_acquire(m_sq_head);
+        if (m_sqe_tail - head >= *m_sq_mask + 1)
+            return NULL;
+    }
+    struct io_uring_sqe *sqe = &m_sqes[m_sqe_tail & *m_sq_mask];
+    m_sq_array[m_sqe_tail & *m_sq_mask] = m_sqe_tail & *m_sq_mask;
+    ++m_sqe_tail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring::submit_and_wait(unsigned wait_nr)
+{
+    unsigned submitted = m_sqe_tail - *m_sq_tail;
+    store_release(m_sq_tail, m_sqe_tail);
+
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    int ret;
+    do
+    {
+        ret = syscall(__NR_io_uring_enter, m_ringfd, submitted, wait_nr, flags, NULL, 0);
+    } while (ret < 0 && errno == EINTR && wait_nr == 0);
+    return ret;
+}
+
+struct io_uring_cqe *uring::peek_cqe()
+{
+    unsigned head = *m_cq_head;
+    if (head == load_acquire(m_cq_tail))
+        return NULL;
+    return &m_cqes[head & *m_cq_mask];
+}
+
+void uring::cqe_seen()
+{
+    store_release(m_cq_head, *m_cq_head + 1);
+}
+
+struct io_uring_sqe *uring::prep(int op, int fd, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return NULL;
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->user_data = user_data;
+    return sqe;
+}
+
+//一次提交，持续接受新连接，直到完成事件不再带IORING_CQE_F_MORE
+void uring::prep_multishot_accept(int listenfd, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = prep(IORING_OP_ACCEPT, listenfd, user_data);
+    if (!sqe)
+        return;
+    sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+}
+
+//数据到达时内核才从缓冲区组中选取接收缓冲区，空闲连接不占用缓冲区
+void uring::prep_recv(int fd, unsigned len, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = prep(IORING_OP_RECV, fd, user_data);
+    if (!sqe)
+        return;
+    sqe->len = len < (unsigned)m_buf_size ? len : m_buf_size;
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+}
+
+void uring::prep_sendmsg(int fd, struct msghdr *msg, unsigned flags, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = prep(IORING_OP_SENDMSG, fd, user_data);
+    if (!sqe)
+        return;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = flags;
+}
+
+void uring::prep_read(int fd, void *buf, unsigned len, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = prep(IORING_OP_READ, fd, user_data);
+    if (!sqe)
+        return;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = (uint64_t)-1;
+}
+
+//取消请求本身的完成事件user_data为0，由调用者忽略
+void uring::prep_cancel(uint64_t target)
+{
+    struct io_uring_sqe *sqe = prep(IORING_OP_ASYNC_CANCEL, -1, 0);
+    if (!sqe)
+        return;
+    sqe->addr = target;
+}
@@ -0,0 +1,81 @@
+#ifndef URING_H
+#define URING_H
+
+/*************************************************************
+*io_uring的轻量封装，直接使用系统调用，不依赖liburing
+*一个反应堆线程独占一个实例：提交队列、完成队列和一组内核选取的接收缓冲区
+**************************************************************/
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <stdint.h>
+#include <string.h>
+
+class uring
+{
+public:
+    uring();
+    ~uring();
+
+    //创建entries大小的环，并注册buf_num个buf_size字节的接收缓冲区，失败返回false
+    bool init(unsigned entries, int buf_num, int buf_size);
+
+    //取一个空闲的提交项，提交队列满时先提交已有的
+    struct io_uring_sqe *get_sqe();
+    //提交所有待提交项，并至少等待wait_nr个完成事件
+    int submit_and_wait(unsigned wait_nr);
+
+    //遍历已完成事件：取出队头，处理后调用cqe_seen
+    struct io_uring_cqe *peek_cqe();
+    void cqe_seen();
+
+    //以下一组函数填充提交项
+    void prep_multishot_accept(int listenfd, uint64_t user_data);
+    void prep_recv(int fd, unsigned len, uint64_t user_data);
+    void prep_sendmsg(int fd, struct msghdr *msg, unsigned flags, uint64_t user_data);
+    void prep_read(int fd, void *buf, unsigned len, uint64_t user_data);
+    //取消user_data为target的请求，如multishot accept
+    void prep_cancel(uint64_t target);
+
+    //内核选中的接收缓冲区地址，用完后归还
+    char *get_buf(int bid) { return m_bufs + (size_t)bid * m_buf_size; }
+    void recycle_buf(int bid);
+
+private:
+    struct io_uring_sqe *prep(int op, int fd, uint64_t user_data);
+    struct io_uring_sqe *provide_bufs(int bid, int nr, unsigned char flags);
+
+private:
+    int m_ringfd;
+
+    //提交队列
+    void *m_sq_ptr;
+    size_t m_sq_size;
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_mask;
+    unsigned *m_sq_array;
+    unsigned m_sqe_tail;    //本地已填充但未发布的尾部
+    struct io_uring_sqe *m_sqes;
+    size_t m_sqes_size;
+
+    //完成队列
+    void *m_cq_ptr;
+    size_t m_cq_size;
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned *m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+
+    //provided buffers：内核在数据到达时才从组中选取缓冲区
+    char *m_bufs;
+    int m_buf_num;
+    int m_buf_size;
+
+public:
+    //接收缓冲区组号
+    static const int BUF_GROUP = 0;
+};
+
+#endif
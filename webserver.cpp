@@ -2,8 +2,9 @@
 
 WebServer::WebServer()
 {
-    //http_conn类对象数组
-    users = new http_conn[MAX_FD];
+    //http_conn指针表，连接对象在accept时才分配
+    users = new http_conn *[MAX_FD]();
+    m_conn_seq = 0;
 
     //root文件夹路径,存放各类资源
     char server_path[200];
@@ -13,25 +14,44 @@ WebServer::WebServer()
     strcpy(m_root, server_path);
     strcat(m_root, root);
 
-    //定时器数组
-    users_timer = new client_data[MAX_FD];
+    //定时器用户数据指针表
+
+    m_reactor_num = 0;
+    m_reactors = NULL;
+    m_pool = NULL;
+
+    m_inherit_num = 0;
+    m_upgrade_fd = -1;
+    m_upgrade_pid = -1;
 }
 
 //析沟函数释放资源
 WebServer::~WebServer()
 {
-    close(m_epollfd);
-    close(m_listenfd);
-    close(m_pipefd[1]);
-    close(m_pipefd[0]);
-    delete[] users;
-    delete[] users_timer;
+    //先结束工作线程，再释放它们会访问的连接和完成队列
     delete m_pool;
+    for (int i = 0; i < m_reactor_num; ++i)
+    {
+        close(m_reactors[i].m_epollfd);
+        close(m_reactors[i].m_listenfd);
+        close(m_reactors[i].m_timerfd);
+        if (m_reactors[i].m_sigfd >= 0)
+            close(m_reactors[i].m_sigfd);
+        delete[] m_reactors[i].events;
+        delete m_reactors[i].m_cq;
+        delete m_reactors[i].m_ring;
+    }
+    delete[] m_reactors;
+    delete[] users;
 }
 
 //服务器初始化
 void WebServer::init(int port, string user, string passWord, string databaseName, int log_write, 
-                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model)
+                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model, int reactor_num,
+                     int backlog, int defer_accept, int timeslot, int head_limit, int body_limit, int zero_copy,
+                     int resp_cache, string cache_policy, int keep_alive, int keep_alive_max, int autoindex,
+                     string upload_dir, int upload_limit, int http2, string tls_cert,
+                     string tls_key, int ktls, int write_quantum)
 {
     m_port = port;//端口号，默认9006
     m_user = user;//数据库登陆名
@@ -44,6 +64,48 @@ void WebServer::init(int port, string user, string passWord, string databaseName
     m_TRIGMode = trigmode;//listen connfd 触发方式，默认0，LT+LT
     m_close_log = close_log;//是否开启日志，默认开启
     m_actormodel = actor_model;//事件处理模式reactor 、模拟proactor,    默认是模拟proactor 
+
+    //事件循环线程数量，默认1
+    m_reactor_num = reactor_num;
+    if (m_reactor_num < 1)
+        m_reactor_num = 1;
+    if (m_reactor_num > MAX_REACTOR)
+        m_reactor_num = MAX_REACTOR;
+
+    m_backlog = backlog > 0 ? backlog : SOMAXCONN;//监听队列长度，默认1024
+    m_defer_accept = defer_accept;//TCP_DEFER_ACCEPT，默认0，关闭
+    m_timeslot = timeslot > 0 ? timeslot : 5000;//定时周期，默认5000毫秒
+
+    //请求头上限至少一个读缓冲段，默认8KB；消息体上限默认1MB
+    if (head_limit > 0)
+        http_conn::m_max_head = head_limit * 1024 > http_conn::READ_BUFFER_SIZE ? head_limit * 1024 : http_conn::READ_BUFFER_SIZE;
+    if (body_limit > 0)
+        http_conn::m_max_body = body_limit * 1024;
+    //静态文件发送方式，默认0，mmap + writev
+    http_conn::m_sendfile = (1 == zero_copy);
+    //小文件预生成响应的内存预算，默认8MB，0为关闭
+    m_resp_cache = resp_cache > 0 ? (long)resp_cache * 1024 : 0;
+    //按扩展名的Cache-Control，预生成响应前设置
+    http_conn::set_cache_policy(cache_policy.c_str());
+    //空闲连接的超时，默认3个定时周期；与每个连接的请求数上限一起在Keep-Alive头部中告知客户端
+    m_idle_timeout = keep_alive > 0 ? keep_alive * 1000 : 3 * m_timeslot;
+    http_conn::set_keep_alive(m_idle_timeout / 1000, keep_alive_max);
+    //目录索引，默认0，关闭
+    http_conn::m_autoindex = (1 == autoindex);
+    //上传目录，默认为空，不接受上传；日志初始化后在eventListen中设置
+    m_upload_dir = upload_dir;
+    m_upload_limit = upload_limit;
+    //HTTP/2(h2c)，默认0，关闭
+    http_conn::m_http2 = (1 == http2);
+    //TLS，证书为空时不启用；内核TLS默认1，开启
+    m_tls_cert = tls_cert;
+    m_tls_key = tls_key;
+    m_ktls = ktls;
+    //一次写事件最多发送的字节数，默认256KB，0为不限
+    http_conn::m_write_quantum = write_quantum > 0 ? write_quantum * 1024 : 0;
+
+    //之后创建的日志、数据库、线程池和反应堆线程都继承该信号掩码
+    Utils::block_signals();
 }
 
 void WebServer::trig_mode()
@@ -94,7 +156,7 @@ void WebServer::sql_pool()
     m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
 
     //初始化数据库读取表
-    users->initmysql_result(m_connPool);
+    http_conn::initmysql_result(m_connPool, m_close_log);
 }
 
 void WebServer::thread_pool()
@@ -104,23 +166,87 @@ void WebServer::thread_pool()
 }
 
 void WebServer::eventListen()
+{
+    //上传目录不存在时创建，失败时退出
+    if (!http_conn::set_upload(m_upload_dir.c_str(), m_upload_limit, m_close_log))
+        exit(1);
+
+    //TLS由OpenSSL在socket上收发，io_uring模式的收发由内核完成，无法经过OpenSSL，退回模拟proactor
+    if (!m_tls_cert.empty())
+    {
+        if (!tls_context::get_instance()->init(m_tls_cert.c_str(), m_tls_key.c_str(), 1 == m_ktls, m_close_log))
+        {
+            LOG_ERROR("%s", "tls init failure");
+            exit(1);
+        }
+        if (2 == m_actormodel)
+        {
+            LOG_ERROR("%s", "tls over io_uring unsupported, fall back to epoll proactor");
+            m_actormodel = 0;
+        }
+    }
+
+    //io_uring模式需要内核支持io_uring及provided buffers，不支持时退回模拟proactor
+    if (2 == m_actormodel)
+    {
+        uring probe;
+        if (!probe.init(8, 1, 64))
+        {
+            LOG_ERROR("%s:errno is:%d", "io_uring unavailable, fall back to epoll proactor", errno);
+            m_actormodel = 0;
+        }
+    }
+
+    //由旧进程平滑升级启动时，先取得旧进程的监听socket
+    inherit_listenfds();
+
+    LOG_INFO("request scanner: %s", http_scan::name());
+
+    //静态文件缓存，网站根目录下的文件变化由0号反应堆的inotify事件失效
+    if (!file_cache::get_instance()->init(m_root, FILE_CACHE_SIZE, m_resp_cache, http_conn::render_head, m_close_log))
+        LOG_ERROR("%s:errno is:%d", "inotify unavailable, file cache disabled", errno);
+
+    m_reactors = new reactor[m_reactor_num];
+    for (int i = 0; i < m_reactor_num; ++i)
+    {
+        m_reactors[i].m_id = i;
+        m_reactors[i].m_server = this;
+        listen_reactor(&m_reactors[i]);
+    }
+
+    //SIGTERM、SIGHUP、SIGUSR2已被屏蔽，由0号反应堆的signalfd读取，统一事件源
+    m_reactors[0].utils.addsig(SIGPIPE, SIG_IGN);
+
+    //平滑升级：监听socket已就绪，通知旧进程停止accept
+    if (m_upgrade_fd >= 0)
+    {
+        char ack = 1;
+        if (write(m_upgrade_fd, &ack, 1) != 1)
+            LOG_ERROR("%s:errno is:%d", "upgrade ack failure", errno);
+        close(m_upgrade_fd);
+        m_upgrade_fd = -1;
+    }
+}
+
+//创建监听socket
+void WebServer::open_listenfd(reactor *r)
 {
     //网络编程基础步骤：
 
     //ip4、TCP、默认阻塞
-    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(m_listenfd >= 0);
+    r->m_listenfd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    assert(r->m_listenfd >= 0);
 
     //优雅关闭连接:若socket为阻塞，有数据待发送，延迟关闭，等待1s
     if (0 == m_OPT_LINGER)
     {
         struct linger tmp = {0, 1};
-        setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        setsockopt(r->m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
     }
     else if (1 == m_OPT_LINGER)
     {
         struct linger tmp = {1, 1};
-        setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        setsockopt(r->m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
     }
 
     int ret = 0;
@@ -135,280 +261,432 @@ void WebServer::eventListen()
     int flag = 1;
     
     //SO_REUSEEADDR强制使用被处于TIME_WAIT的连接socket地址
-    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    setsockopt(r->m_listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    //多反应堆：每个事件循环绑定同一端口，由内核在各监听socket间分发新连接
+    if (m_reactor_num > 1)
+        setsockopt(r->m_listenfd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag));
     //将socket和address绑定
-    ret = bind(m_listenfd, (struct sockaddr *)&address, sizeof(address));
+    ret = bind(r->m_listenfd, (struct sockaddr *)&address, sizeof(address));
     assert(ret >= 0);
-    //监听
-    ret = listen(m_listenfd, 20);
+    //数据到达后才完成accept，只连不发的连接不会唤醒事件循环，超时后内核回退为普通accept
+    if (m_defer_accept > 0)
+        setsockopt(r->m_listenfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &m_defer_accept, sizeof(m_defer_accept));
+    //监听，连接突发时过短的队列会让客户端SYN重传，等待1s以上
+    ret = listen(r->m_listenfd, m_backlog);
     assert(ret >= 0);
+}
 
-    //设置util工具类
-    utils.init(TIMESLOT);
+//为一个反应堆创建监听socket、epoll内核事件表、timerfd，0号反应堆另有signalfd
+void WebServer::listen_reactor(reactor *r)
+{
+    int ret = 0;
+
+    //平滑升级：直接使用旧进程传来的监听socket，其上未accept的连接不会丢失
+    if (r->m_id < m_inherit_num)
+        r->m_listenfd = m_inherit_fds[r->m_id];
+    else
+        open_listenfd(r);
+    r->m_accepting = true;
+
+    //设置util工具类，创建定时器和信号描述符
+    r->utils.init(m_timeslot);
+    r->m_timerfd = r->utils.create_timerfd();
+    assert(r->m_timerfd >= 0);
+    //signalfd上的信号只会被读取一次，只由0号反应堆接收，再经完成队列通知其余反应堆
+    r->m_sigfd = -1;
+    if (0 == r->m_id)
+    {
+        r->m_sigfd = Utils::create_signalfd();
+        assert(r->m_sigfd >= 0);
+    }
+
+    //io_uring模式：监听socket、timerfd、signalfd、完成队列都通过提交队列异步读取，不创建epoll
+    if (2 == m_actormodel)
+    {
+        r->m_epollfd = -1;
+        r->events = NULL;
+        r->m_ring = new uring;
+        ret = r->m_ring->init(URING_ENTRIES, URING_BUF_NUM, http_conn::READ_BUFFER_SIZE);
+        assert(ret);
+
+        r->utils.setnonblocking(r->m_listenfd);
+        r->m_cq = new completion_queue(MAX_EVENT_NUMBER);
+        return;
+    }
+    r->m_ring = NULL;
 
     //epoll创建内核事件表
-    epoll_event events[MAX_EVENT_NUMBER];
-    m_epollfd = epoll_create(5);
-    assert(m_epollfd != -1);
+    r->events = new epoll_event[MAX_EVENT_NUMBER];
+    r->m_epollfd = epoll_create1(EPOLL_CLOEXEC);
+    assert(r->m_epollfd != -1);
 
     //把m_listenfd添加到监听表中，且为m_LISTENTrigmode模式，默认LT
-    utils.addfd(m_epollfd, m_listenfd, false, m_LISTENTrigmode);
-    http_conn::m_epollfd = m_epollfd;
-
-    //创建一个双向管道，设置为非阻塞，添加到监听表中
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_pipefd);
-    assert(ret != -1);
-    utils.setnonblocking(m_pipefd[1]);
-    utils.addfd(m_epollfd, m_pipefd[0], false, 0);
+    r->utils.addfd(r->m_epollfd, r->m_listenfd, false, m_LISTENTrigmode);
 
-    //设置信号，其中SIGALRM、SIGTERM处理函数向管道m_pipefd[1]发送数据，统一事件源
-    utils.addsig(SIGPIPE, SIG_IGN);
-    utils.addsig(SIGALRM, utils.sig_handler, false);
-    utils.addsig(SIGTERM, utils.sig_handler, false);
-    //设置定时器，定时时间是TIMESLOT
-    alarm(TIMESLOT);
+    //timerfd和signalfd直接加入监听表，LT模式
+    r->utils.addfd(r->m_epollfd, r->m_timerfd, false, 0);
+    if (r->m_sigfd >= 0)
+        r->utils.addfd(r->m_epollfd, r->m_sigfd, false, 0);
+    //文件缓存的inotify描述符同样由0号反应堆监听
+    if (0 == r->m_id && file_cache::get_instance()->get_inotify_fd() >= 0)
+        r->utils.addfd(r->m_epollfd, file_cache::get_instance()->get_inotify_fd(), false, 0);
 
-    //工具类,信号和描述符基础操作
-    Utils::u_pipefd = m_pipefd;
-    Utils::u_epollfd = m_epollfd;
+    //创建完成队列，工作线程处理完毕后经eventfd唤醒本反应堆
+    r->m_cq = new completion_queue(MAX_EVENT_NUMBER);
+    r->utils.addfd(r->m_epollfd, r->m_cq->get_eventfd(), false, 0);
 }
 
-void WebServer::timer(int connfd, struct sockaddr_in client_address)
+void WebServer::timer(reactor *r, int connfd, struct sockaddr_in client_address)
 {
-    //初始化这个连接下的http_conn
-    users[connfd].init(connfd, client_address, m_root, m_CONNTrigmode, m_close_log, m_user, m_passWord, m_databaseName);
+    //从本反应堆的slab取出连接对象，定时器节点和用户数据嵌在其中
+    http_conn *conn = r->m_conns.alloc();
+    users[connfd] = conn;
+
+    //初始化这个连接下的http_conn，注册到所属反应堆的epoll内核事件表
+    conn->init(connfd, client_address, r->m_epollfd, r->m_cq, m_root, m_CONNTrigmode, m_close_log);
 
     //初始化client_data数据
-    //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
-    users_timer[connfd].address = client_address;
-    users_timer[connfd].sockfd = connfd;
-    //创建一个定时器链表节点
-    util_timer *timer = new util_timer;
-    timer->user_data = &users_timer[connfd];
-    timer->cb_func = cb_func;
-    time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT;
-    users_timer[connfd].timer = timer;
-    //把该节点添加到升序链表中
-    utils.m_timer_lst.add_timer(timer);
-}
-
-//若有数据传输，则将定时器往后延迟3个单位
+    //设置定时器回调函数和超时时间，绑定用户数据，将定时器添加到链表中
+    client_data *data = &conn->m_timer_data;
+    data->sockfd = connfd;
+    data->epollfd = r->m_epollfd;
+    data->gen = m_conn_seq++;
+    data->inflight.store(0);
+    data->owner = r;
+    util_timer *timer = &conn->m_timer;
+    timer->user_data = data;
+    timer->cb_func = close_cb;
+    time_t cur = Utils::get_ms();
+    timer->expire = cur + m_idle_timeout;
+    data->timer = timer;
+    //把该节点添加到本反应堆的升序链表中
+    r->utils.m_timer_lst.add_timer(timer);
+}
+
+//若有数据传输，则将定时器往后延迟一个空闲超时
 //并对新的定时器在链表上的位置进行调整
-void WebServer::adjust_timer(util_timer *timer)
+void WebServer::adjust_timer(reactor *r, util_timer *timer)
 {
-    time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT;
-    utils.m_timer_lst.adjust_timer(timer);
+    time_t cur = Utils::get_ms();
+    timer->expire = cur + m_idle_timeout;
+    r->utils.m_timer_lst.adjust_timer(timer);
 
     LOG_INFO("%s", "adjust timer once");
 }
 
-void WebServer::deal_timer(util_timer *timer, int sockfd)
+void WebServer::deal_timer(reactor *r, util_timer *timer, int sockfd)
 {
-    timer->cb_func(&users_timer[sockfd]);
-    if (timer)
+    //定时器已被移除说明连接已关闭，忽略重复的关闭请求
+    if (!timer)
+        return;
+
+    //先从链表摘下再回调，回调会把连接对象连同定时器节点归还slab
+    r->utils.m_timer_lst.del_timer(timer);
+    timer->cb_func(timer->user_data);
+
+    LOG_INFO("close fd %d", sockfd);
+}
+
+//定时器回调：关闭连接，并把连接对象归还给所属反应堆的slab
+//工作线程仍持有连接时只摘下定时器并做标记，socket不关闭以免fd被复用，工作线程处理完后经完成队列再次关闭
+void WebServer::close_cb(client_data *user_data)
+{
+    reactor *r = user_data->owner;
+    WebServer *server = r->m_server;
+    int sockfd = user_data->sockfd;
+    http_conn *conn = server->users[sockfd];
+    if (conn->defer_close())
     {
-        utils.m_timer_lst.del_timer(timer);
+        user_data->timer = NULL;
+        return;
     }
 
-    LOG_INFO("close fd %d", users_timer[sockfd].sockfd);
+    //先清空指针表再close：close之后fd可能立即被其他反应堆accept复用
+    server->users[sockfd] = NULL;
+    cb_func(user_data);
+
+    conn->unmap();
+    conn->release_buffers();
+    r->m_conns.free(conn);
 }
 
 //处理一个新连接事件
-bool WebServer::dealclinetdata()
+//LT和ET都批量accept，每次就绪最多接受MAX_ACCEPT_BATCH个连接，避免突发连接饿死已有连接
+//accept4直接得到非阻塞、close-on-exec的连接，省去之后的fcntl
+bool WebServer::dealclinetdata(reactor *r)
 {
     struct sockaddr_in client_address;
-    socklen_t client_addrlength = sizeof(client_address);
+    socklen_t client_addrlength;
+    int accepted = 0;
 
-    //listen 为LT
-    if (0 == m_LISTENTrigmode)
+    while (accepted < MAX_ACCEPT_BATCH)
     {
-        int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
+        client_addrlength = sizeof(client_address);
+        int connfd = accept4(r->m_listenfd, (struct sockaddr *)&client_address, &client_addrlength, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (connfd < 0)
         {
+            //监听队列已取空
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return accepted > 0;
+            //对方在accept前已重置连接，继续取下一个
+            if (errno == ECONNABORTED || errno == EINTR)
+                continue;
             LOG_ERROR("%s:errno is:%d", "accept error", errno);
-            return false;
+            return accepted > 0;
         }
+        ++accepted;
         if (http_conn::m_user_count >= MAX_FD)
         {
-            utils.show_error(connfd, "Internal server busy");
+            r->utils.show_error(connfd, "Internal server busy");
             LOG_ERROR("%s", "Internal server busy");
-            return false;
+            continue;
         }
-        //加入定时器、初始化user[connfd]的http_conn并设为非阻塞
-        timer(connfd, client_address);
+        //加入定时器、初始化user[connfd]的http_conn
+        timer(r, connfd, client_address);
     }
 
-    else
+    //用完配额时队列中可能还有连接：LT会再次触发，ET需重新注册以补发一次就绪事件
+    if (1 == m_LISTENTrigmode)
     {
-        // //listen 为ET
-        while (1)
-        {
-            int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
-            if (connfd < 0)
-            {
-                LOG_ERROR("%s:errno is:%d", "accept error", errno);
-                break;
-            }
-            if (http_conn::m_user_count >= MAX_FD)
-            {
-                utils.show_error(connfd, "Internal server busy");
-                LOG_ERROR("%s", "Internal server busy");
-                break;
-            }
-            timer(connfd, client_address);
-        }
-        return false;
+        epoll_event event;
+        event.data.fd = r->m_listenfd;
+        event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+        epoll_ctl(r->m_epollfd, EPOLL_CTL_MOD, r->m_listenfd, &event);
     }
     return true;
 }
-//处理信号事件
-bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
+//处理信号事件，一次读出signalfd上所有待处理的信号
+bool WebServer::dealwithsignal(reactor *r, bool &stop_server)
 {
-    int ret = 0;
-    int sig;
-    char signals[1024];
-    ret = recv(m_pipefd[0], signals, sizeof(signals), 0);
-    if (ret == -1)
+    struct signalfd_siginfo info[8];
+    ssize_t ret = read(r->m_sigfd, info, sizeof(info));
+    if (ret <= 0)
     {
         return false;
     }
-    else if (ret == 0)
+    for (int i = 0; i < ret / (ssize_t)sizeof(info[0]); ++i)
+        on_signal(r, info[i].ssi_signo, stop_server);
+    return true;
+}
+void WebServer::on_signal(reactor *r, int sig, bool &stop_server)
+{
+    switch (sig)
     {
-        return false;
+    case SIGTERM:
+    {
+        stop_server = true;
+        //唤醒并通知其余反应堆退出
+        for (int i = 1; i < m_reactor_num; ++i)
+            m_reactors[i].m_cq->push(-1, 0, completion_queue::STOP);
+        break;
     }
-    else
+    case SIGHUP:
+    {
+        //没有可重新加载的配置，只是不再因终端断开而退出
+        LOG_INFO("%s", "SIGHUP ignored");
+        break;
+    }
+    case SIGUSR2:
+    {
+        upgrade(r);
+        break;
+    }
+    }
+}
+//定时任务，排空期间连接全部关闭后退出
+void WebServer::tick(reactor *r, bool &stop_server)
+{
+    r->utils.timer_handler();
+
+    LOG_INFO("timer tick: %d connections, high water %d, %d allocated",
+             r->m_conns.used(), r->m_conns.high_water(), r->m_conns.capacity());
+    if (0 == r->m_id)
+    {
+        file_cache *cache = file_cache::get_instance();
+        LOG_INFO("file cache: %ld hits, %ld misses, %d files, %ld response bytes",
+                 cache->hits(), cache->misses(), cache->size(), cache->resp_bytes());
+        tls_context *tls = tls_context::get_instance();
+        if (tls->enabled())
+            LOG_INFO("tls: %ld full handshakes, %ld resumed, %ld ktls", tls->full_handshakes(),
+                     tls->resumed_handshakes(), tls->ktls_conns());
+    }
+
+    if (0 == r->m_id && m_upgrade_pid > 0 && waitpid(m_upgrade_pid, NULL, WNOHANG) == m_upgrade_pid)
+        m_upgrade_pid = -1;
+    if (http_conn::m_draining && 0 == http_conn::m_user_count)
+        stop_server = true;
+}
+//处理定时事件，读出timerfd的到期次数
+bool WebServer::dealwithtimer(reactor *r, bool &timeout)
+{
+    uint64_t expirations;
+    if (read(r->m_timerfd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return false;
+    timeout = true;
+    return true;
+}
+//处理工作线程经完成队列回报的事件
+void WebServer::dealwithcompletion(reactor *r, bool &stop_server)
+{
+    //先清除eventfd唤醒状态，再取空队列
+    r->m_cq->clear();
+
+    int sockfd, event;
+    unsigned int gen;
+    while (r->m_cq->pop(sockfd, gen, event))
     {
-        for (int i = 0; i < ret; ++i)
+        //工作线程读写失败，关闭连接并移除定时器
+        //连接可能已被定时器关闭，fd又被本反应堆或其他反应堆接受的新连接复用，这时丢弃
+        //推迟关闭的连接定时器已摘下，直接关闭
+        if (completion_queue::CLOSE == event)
         {
-            switch (signals[i])
-            {
-            case SIGALRM:
-            {
-                timeout = true;
-                break;
-            }
-            case SIGTERM:
-            {
-                stop_server = true;
-                break;
-            }
-            }
+            http_conn *conn = completed_conn(r, sockfd, gen);
+            if (conn && conn->closing())
+                close_cb(&conn->m_timer_data);
+            else if (conn)
+                deal_timer(r, conn_timer(sockfd), sockfd);
+        }
+        else if (completion_queue::STOP == event)
+        {
+            stop_server = true;
+        }
+        else if (completion_queue::DRAIN == event)
+        {
+            stop_accept(r);
         }
     }
-    return true;
+}
+//完成队列中的事件仍属于本反应堆上的同一个连接时返回该连接，否则返回NULL
+http_conn *WebServer::completed_conn(reactor *r, int sockfd, unsigned int gen)
+{
+    http_conn *conn = users[sockfd];
+    if (!conn || conn->m_timer_data.gen != gen || conn->m_timer_data.owner != r)
+        return NULL;
+    return conn;
 }
 //处理可读事件
-void WebServer::dealwithread(int sockfd)
+void WebServer::dealwithread(reactor *r, int sockfd)
 {
-    util_timer *timer = users_timer[sockfd].timer;
+    //连接已在本轮事件中关闭，或已推迟关闭，等待工作线程处理完
+    if (!users[sockfd] || users[sockfd]->closing())
+        return;
+    util_timer *timer = conn_timer(sockfd);
 
     //reactor
     if (1 == m_actormodel)
     {
         if (timer)
         {
-            adjust_timer(timer);
+            adjust_timer(r, timer);
         }
 
         //若监测到读事件，将该事件放入请求队列，由工作线程完成
-        m_pool->append(users + sockfd, 0);
-
-        while (true)
-        {
-            
-            if (1 == users[sockfd].improv)
-            {
-                //上一次未读到一点数据，则直接先处理定时任务：关闭连接
-                if (1 == users[sockfd].timer_flag)
-                {
-                    deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
-                }
-                users[sockfd].improv = 0;
-                break;
-            }
-        }
+        //主线程不等待工作线程，读失败时由工作线程经完成队列通知关闭
+        m_pool->append(users[sockfd], 0);
     }
     else
     {
         //模拟proactor,由主线程完成读
-        if (users[sockfd].read_once())
+        if (users[sockfd]->read_once())
         {
-            LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd]->get_address()->sin_addr));
 
             //把事件加入队列中，工作线程只需要i处理逻辑
-            m_pool->append_p(users + sockfd);
+            m_pool->append_p(users[sockfd]);
 
             if (timer)
             {
-                adjust_timer(timer);
+                adjust_timer(r, timer);
             }
         }
         else
         {
-            deal_timer(timer, sockfd);
+            deal_timer(r, timer, sockfd);
         }
     }
 }
 //处理可写事件
-void WebServer::dealwithwrite(int sockfd)
+void WebServer::dealwithwrite(reactor *r, int sockfd)
 {
+    if (!users[sockfd] || users[sockfd]->closing())
+        return;
     //获取该socket的定时器
-    util_timer *timer = users_timer[sockfd].timer;
+    util_timer *timer = conn_timer(sockfd);
     //reactor
     if (1 == m_actormodel)
     {
         if (timer)
         {
-            adjust_timer(timer);
+            adjust_timer(r, timer);
         }
         //users是http_conn *数组，将该socket指针是添加到请求队列，I/O、逻辑处理由工作线程完成
-        m_pool->append(users + sockfd, 1);
-
-        while (true)
-        {
-            if (1 == users[sockfd].improv)
-            {
-                //若上一次未写入一点数据，册直接处理定时任务：关闭连接
-                if (1 == users[sockfd].timer_flag)
-                {
-                    deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
-                }
-                users[sockfd].improv = 0;
-                break;
-            }
-        }
+        m_pool->append(users[sockfd], 1);
     }
     else
     {
         //模拟proactor，I/O由主线程完成
-        if (users[sockfd].write())
+        int ret = users[sockfd]->write();
+        if (ret)
         {
-            LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd]->get_address()->sin_addr));
+            //读缓冲区中还有流水线上的请求，交给工作线程接着处理
+            if (2 == ret)
+                m_pool->append_p(users[sockfd]);
             if (timer)
             {
-                adjust_timer(timer);
+                adjust_timer(r, timer);
             }
         }
         else
         {
-            deal_timer(timer, sockfd);
+            deal_timer(r, timer, sockfd);
         }
     }
 }
 
-//运行
+//事件循环线程入口
+void *WebServer::reactor_worker(void *arg)
+{
+    reactor *r = (reactor *)arg;
+    r->m_server->reactorLoop(r);
+    return r;
+}
+
+//运行：主线程运行0号反应堆，其余反应堆各自在独立线程中运行
 void WebServer::eventLoop()
 {
+    for (int i = 1; i < m_reactor_num; ++i)
+    {
+        if (pthread_create(&m_reactors[i].m_tid, NULL, reactor_worker, &m_reactors[i]) != 0)
+        {
+            LOG_ERROR("%s", "create reactor thread failure");
+            throw std::exception();
+        }
+    }
+
+    reactorLoop(&m_reactors[0]);
+
+    //0号反应堆收到SIGTERM后会通知其余反应堆，等待其余事件循环退出
+    for (int i = 1; i < m_reactor_num; ++i)
+        pthread_join(m_reactors[i].m_tid, NULL);
+}
+
+//单个反应堆的事件循环
+void WebServer::reactorLoop(reactor *r)
+{
+    if (2 == m_actormodel)
+    {
+        uringLoop(r);
+        return;
+    }
+
     bool timeout = false;
     bool stop_server = false;
+    epoll_event *events = r->events;
 
     while (!stop_server)
     {
-        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+        int number = epoll_wait(r->m_epollfd, events, MAX_EVENT_NUMBER, -1);
         if (number < 0 && errno != EINTR)
         {
             LOG_ERROR("%s", "epoll failure");
@@ -420,43 +698,537 @@ void WebServer::eventLoop()
             int sockfd = events[i].data.fd;
 
             //处理新到的客户连接
-            if (sockfd == m_listenfd)
+            if (sockfd == r->m_listenfd)
             {
-                bool flag = dealclinetdata();
+                bool flag = dealclinetdata(r);
                 if (false == flag)
                     continue;
             }
+            //新进程就绪或启动失败
+            else if (0 == r->m_id && sockfd == m_upgrade_fd)
+            {
+                char ack;
+                int ret = read(m_upgrade_fd, &ack, 1);
+                if (ret >= 0 || errno != EAGAIN)
+                    dealwithupgrade(r, ret);
+            }
             //连接被对方关闭、事件挂起、出现错误、
             else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
             {
                 //服务器端关闭连接，移除对应的定时器
-                util_timer *timer = users_timer[sockfd].timer;
-                deal_timer(timer, sockfd);
+                util_timer *timer = conn_timer(sockfd);
+                deal_timer(r, timer, sockfd);
+            }
+            //处理定时
+            else if ((sockfd == r->m_timerfd) && (events[i].events & EPOLLIN))
+            {
+                bool flag = dealwithtimer(r, timeout);
+                if (false == flag)
+                    LOG_ERROR("%s", "dealwithtimer failure");
             }
             //处理信号
-            else if ((sockfd == m_pipefd[0]) && (events[i].events & EPOLLIN))
+            else if ((sockfd == r->m_sigfd) && (events[i].events & EPOLLIN))
             {
-                bool flag = dealwithsignal(timeout, stop_server);
+                bool flag = dealwithsignal(r, stop_server);
                 if (false == flag)
-                    LOG_ERROR("%s", "dealclientdata failure");
+                    LOG_ERROR("%s", "dealwithsignal failure");
+            }
+            //网站根目录下的文件有变化
+            else if ((sockfd == file_cache::get_instance()->get_inotify_fd()) && (events[i].events & EPOLLIN))
+            {
+                file_cache::get_instance()->handle_events();
+            }
+            //处理工作线程的完成通知
+            else if ((sockfd == r->m_cq->get_eventfd()) && (events[i].events & EPOLLIN))
+            {
+                dealwithcompletion(r, stop_server);
             }
             //处理客户连接上接收到的数据
             else if (events[i].events & EPOLLIN)
             {
-                dealwithread(sockfd);
+                dealwithread(r, sockfd);
             }
             else if (events[i].events & EPOLLOUT)
             {
-                dealwithwrite(sockfd);
+                dealwithwrite(r, sockfd);
             }
         }
         if (timeout)
         {
-            utils.timer_handler();
+            tick(r, stop_server);
+            timeout = false;
+        }
+    }
+}
+
+/*************************************************************
+*io_uring事件循环
+*提交项的user_data高8位为操作类型，中间24位为连接代数，低32位为fd
+**************************************************************/
+enum URING_OP
+{
+    URING_ACCEPT = 1,
+    URING_RECV,
+    URING_SEND,
+    URING_SIGNAL,
+    URING_TIMER,
+    URING_NOTIFY,
+    URING_UPGRADE,
+    URING_INOTIFY
+};
+
+static inline uint64_t uring_data(int op, unsigned int gen, int fd)
+{
+    return ((uint64_t)op << 56) | ((uint64_t)(gen & 0xffffff) << 32) | (uint32_t)fd;
+}
+
+//连接已关闭，或fd已被新连接复用
+static inline bool uring_stale(http_conn *conn, unsigned int gen)
+{
+    return !conn || gen != (conn->m_timer_data.gen & 0xffffff);
+}
+
+//为连接提交一次接收，数据到达时才由内核选取缓冲区
+void WebServer::uring_recv(reactor *r, int sockfd)
+{
+    int room = users[sockfd]->prepare_read();
+    //报文长度超过请求头或消息体上限
+    if (room <= 0)
+    {
+        deal_timer(r, conn_timer(sockfd), sockfd);
+        return;
+    }
+    r->m_ring->prep_recv(sockfd, room, uring_data(URING_RECV, users[sockfd]->m_timer_data.gen, sockfd));
+}
+
+//为连接提交一次SENDMSG，报文头和文件映射区在同一个提交项中发送
+//MSG_WAITALL让内核自行重试部分发送，不必每次回到用户态
+void WebServer::uring_send(reactor *r, int sockfd)
+{
+    r->m_ring->prep_sendmsg(sockfd, users[sockfd]->get_msghdr(), MSG_NOSIGNAL | MSG_WAITALL,
+                            uring_data(URING_SEND, users[sockfd]->m_timer_data.gen, sockfd));
+}
+
+//处理一个完成事件
+void WebServer::dealwithuring(reactor *r, uint64_t data, int res, unsigned flags, bool &timeout, bool &stop_server)
+{
+    int op = data >> 56;
+    unsigned int gen = (data >> 32) & 0xffffff;
+    int sockfd = (int)(uint32_t)data;
+
+    switch (op)
+    {
+    //处理新到的客户连接
+    case URING_ACCEPT:
+    {
+        //multishot accept被内核终止时重新提交，排空期间已被主动取消
+        if (-ECANCELED == res)
+            break;
+        if (!(flags & IORING_CQE_F_MORE) && r->m_accepting)
+            r->m_ring->prep_multishot_accept(r->m_listenfd, uring_data(URING_ACCEPT, 0, r->m_listenfd));
+        if (res < 0)
+        {
+            LOG_ERROR("%s:errno is:%d", "accept error", -res);
+            break;
+        }
+        int connfd = res;
+        if (http_conn::m_user_count >= MAX_FD)
+        {
+            r->utils.show_error(connfd, "Internal server busy");
+            LOG_ERROR("%s", "Internal server busy");
+            break;
+        }
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof(client_address);
+        getpeername(connfd, (struct sockaddr *)&client_address, &client_addrlength);
+        timer(r, connfd, client_address);
+        uring_recv(r, connfd);
+        break;
+    }
+    //接收完成，数据已在内核选取的缓冲区中
+    case URING_RECV:
+    {
+        //推迟关闭的连接也不再处理收到的数据
+        bool stale = uring_stale(users[sockfd], gen) || users[sockfd]->closing();
+        bool ok = false;
+        if (res > 0 && (flags & IORING_CQE_F_BUFFER))
+        {
+            int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            if (!stale)
+                ok = users[sockfd]->read_data(r->m_ring->get_buf(bid), res);
+            r->m_ring->recycle_buf(bid);
+        }
+        //连接已关闭，fd可能已被复用，丢弃
+        if (stale)
+            break;
+        //接收缓冲区暂时耗尽，稍后重试
+        if (-ENOBUFS == res)
+        {
+            uring_recv(r, sockfd);
+            break;
+        }
+        util_timer *timer = conn_timer(sockfd);
+        if (ok)
+        {
+            LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd]->get_address()->sin_addr));
+            //工作线程只需处理逻辑，结果经完成队列回报
+            m_pool->append_p(users[sockfd]);
+            if (timer)
+                adjust_timer(r, timer);
+        }
+        else
+        {
+            deal_timer(r, timer, sockfd);
+        }
+        break;
+    }
+    //发送完成
+    case URING_SEND:
+    {
+        if (uring_stale(users[sockfd], gen) || users[sockfd]->closing())
+            break;
+        util_timer *timer = conn_timer(sockfd);
+        if (-EAGAIN == res || -EINTR == res)
+        {
+            uring_send(r, sockfd);
+            break;
+        }
+        int status = res < 0 ? -1 : users[sockfd]->after_send(res);
+        if (1 == status)
+        {
+            uring_send(r, sockfd);
+        }
+        else if (0 == status || 2 == status)
+        {
+            LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd]->get_address()->sin_addr));
+            if (timer)
+                adjust_timer(r, timer);
+            //读缓冲区中还有流水线上的请求时先处理，否则接着接收
+            if (2 == status)
+                m_pool->append_p(users[sockfd]);
+            else
+                uring_recv(r, sockfd);
+        }
+        else
+        {
+            deal_timer(r, timer, sockfd);
+        }
+        break;
+    }
+    //处理信号
+    case URING_SIGNAL:
+    {
+        if (res == sizeof(r->m_siginfo))
+            on_signal(r, r->m_siginfo.ssi_signo, stop_server);
+        else if (-EAGAIN != res && -EINTR != res)
+            LOG_ERROR("%s", "dealwithsignal failure");
+        r->m_ring->prep_read(r->m_sigfd, &r->m_siginfo, sizeof(r->m_siginfo), uring_data(URING_SIGNAL, 0, r->m_sigfd));
+        break;
+    }
+    //处理定时
+    case URING_TIMER:
+    {
+        if (res == sizeof(r->m_timer_val))
+            timeout = true;
+        else if (-EAGAIN != res && -EINTR != res)
+            LOG_ERROR("%s", "dealwithtimer failure");
+        r->m_ring->prep_read(r->m_timerfd, &r->m_timer_val, sizeof(r->m_timer_val), uring_data(URING_TIMER, 0, r->m_timerfd));
+        break;
+    }
+    //处理工作线程经完成队列回报的事件
+    case URING_NOTIFY:
+    {
+        r->m_cq->reset();
+        int fd, event;
+        unsigned int gen;
+        while (r->m_cq->pop(fd, gen, event))
+        {
+            //工作线程处理期间连接可能已被定时器关闭，fd又被新连接复用，与完成事件一样按序号丢弃
+            //否则同一连接上会有两个未完成的接收
+            bool stale = fd < 0 || uring_stale(users[fd], gen & 0xffffff) || users[fd]->m_timer_data.owner != r;
+            //推迟关闭的连接不再收发，等工作线程处理完后的CLOSE
+            if (completion_queue::CLOSE == event && !stale && users[fd]->closing())
+                close_cb(&users[fd]->m_timer_data);
+            else if (completion_queue::CLOSE == event && !stale)
+                deal_timer(r, conn_timer(fd), fd);
+            else if (!stale && users[fd]->closing())
+                continue;
+            else if (completion_queue::READ == event && !stale)
+                uring_recv(r, fd);
+            else if (completion_queue::WRITE == event && !stale)
+                uring_send(r, fd);
+            else if (completion_queue::STOP == event)
+                stop_server = true;
+            else if (completion_queue::DRAIN == event)
+                stop_accept(r);
+        }
+        r->m_ring->prep_read(r->m_cq->get_eventfd(), &r->m_cq_val, sizeof(r->m_cq_val), uring_data(URING_NOTIFY, 0, r->m_cq->get_eventfd()));
+        break;
+    }
+    //新进程就绪或启动失败
+    case URING_UPGRADE:
+    {
+        dealwithupgrade(r, res);
+        break;
+    }
+    //网站根目录下的文件有变化，处理后继续读取
+    case URING_INOTIFY:
+    {
+        file_cache *cache = file_cache::get_instance();
+        if (res > 0)
+            cache->handle_events(res);
+        else if (res != -EINTR && res != -EAGAIN)
+        {
+            LOG_ERROR("inotify read failure: %d", res);
+            break;
+        }
+        r->m_ring->prep_read(cache->get_inotify_fd(), cache->event_buf(), cache->event_buf_size(), uring_data(URING_INOTIFY, 0, cache->get_inotify_fd()));
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+//io_uring事件循环：一次io_uring_enter既提交本轮所有收发，又等待下一批完成事件
+void WebServer::uringLoop(reactor *r)
+{
+    bool timeout = false;
+    bool stop_server = false;
+    uring *ring = r->m_ring;
 
-            LOG_INFO("%s", "timer tick");
+    ring->prep_multishot_accept(r->m_listenfd, uring_data(URING_ACCEPT, 0, r->m_listenfd));
+    ring->prep_read(r->m_timerfd, &r->m_timer_val, sizeof(r->m_timer_val), uring_data(URING_TIMER, 0, r->m_timerfd));
+    if (r->m_sigfd >= 0)
+        ring->prep_read(r->m_sigfd, &r->m_siginfo, sizeof(r->m_siginfo), uring_data(URING_SIGNAL, 0, r->m_sigfd));
+    ring->prep_read(r->m_cq->get_eventfd(), &r->m_cq_val, sizeof(r->m_cq_val), uring_data(URING_NOTIFY, 0, r->m_cq->get_eventfd()));
+    file_cache *cache = file_cache::get_instance();
+    if (0 == r->m_id && cache->get_inotify_fd() >= 0)
+        ring->prep_read(cache->get_inotify_fd(), cache->event_buf(), cache->event_buf_size(), uring_data(URING_INOTIFY, 0, cache->get_inotify_fd()));
 
+    while (!stop_server)
+    {
+        int ret = ring->submit_and_wait(1);
+        if (ret < 0 && errno != EINTR)
+        {
+            LOG_ERROR("%s", "io_uring failure");
+            break;
+        }
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = ring->peek_cqe()) != NULL)
+        {
+            uint64_t data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            ring->cqe_seen();
+            dealwithuring(r, data, res, flags, timeout, stop_server);
+        }
+        if (timeout)
+        {
+            tick(r, stop_server);
             timeout = false;
         }
     }
-}
\ No newline at end of file
+}
+
+/*************************************************************
+*平滑升级
+*旧进程收到SIGUSR2后fork+exec同一程序，经SCM_RIGHTS把各反应堆的监听socket交给新进程
+*新进程就绪后回写一个字节，旧进程随即停止accept；已有连接发完当前响应后关闭，
+*空闲的长连接由定时器关闭，连接全部关闭后旧进程退出
+**************************************************************/
+void WebServer::upgrade(reactor *r)
+{
+    if (m_upgrade_fd >= 0 || http_conn::m_draining)
+    {
+        LOG_ERROR("%s", "upgrade already in progress");
+        return;
+    }
+
+    //fork之后子进程只调用异步信号安全的函数，程序路径、参数和环境变量都预先准备好
+    char exe[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (len <= 0)
+    {
+        LOG_ERROR("%s:errno is:%d", "upgrade readlink failure", errno);
+        return;
+    }
+    exe[len] = '\0';
+
+    //沿用当前进程的命令行参数
+    std::string cmdline;
+    FILE *fp = fopen("/proc/self/cmdline", "r");
+    if (!fp)
+    {
+        LOG_ERROR("%s:errno is:%d", "upgrade cmdline failure", errno);
+        return;
+    }
+    char buf[1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        cmdline.append(buf, n);
+    fclose(fp);
+    std::vector<char *> argv;
+    for (size_t i = 0; i < cmdline.size(); i += strlen(&cmdline[i]) + 1)
+        argv.push_back(&cmdline[i]);
+    argv.push_back(NULL);
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+    {
+        LOG_ERROR("%s:errno is:%d", "upgrade socketpair failure", errno);
+        return;
+    }
+    char env_fd[64];
+    snprintf(env_fd, sizeof(env_fd), "%s=%d", UPGRADE_ENV, sv[1]);
+    std::vector<char *> envp;
+    for (char **e = environ; *e; ++e)
+    {
+        if (strncmp(*e, UPGRADE_ENV "=", strlen(UPGRADE_ENV) + 1) != 0)
+            envp.push_back(*e);
+    }
+    envp.push_back(env_fd);
+    envp.push_back(NULL);
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        LOG_ERROR("%s:errno is:%d", "upgrade fork failure", errno);
+        close(sv[0]);
+        close(sv[1]);
+        return;
+    }
+    if (0 == pid)
+    {
+        //只有通信socket需要跨过exec
+        fcntl(sv[1], F_SETFD, 0);
+        execve(exe, &argv[0], &envp[0]);
+        _exit(127);
+    }
+    close(sv[1]);
+
+    //各反应堆的监听socket在一条消息中发送
+    int fds[MAX_REACTOR];
+    for (int i = 0; i < m_reactor_num; ++i)
+        fds[i] = m_reactors[i].m_listenfd;
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+    char tag = 0;
+    struct iovec iov = {&tag, 1};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * m_reactor_num);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * m_reactor_num);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * m_reactor_num);
+    if (sendmsg(sv[0], &msg, MSG_NOSIGNAL) < 0)
+    {
+        //关闭通信socket，新进程读到EOF后自行退出，由定时任务回收
+        LOG_ERROR("%s:errno is:%d", "upgrade sendmsg failure", errno);
+        close(sv[0]);
+        m_upgrade_pid = pid;
+        return;
+    }
+
+    //等待新进程就绪：读到一个字节表示就绪，读到EOF表示新进程启动失败
+    m_upgrade_fd = sv[0];
+    m_upgrade_pid = pid;
+    if (r->m_ring)
+        r->m_ring->prep_read(m_upgrade_fd, &m_upgrade_ack, 1, uring_data(URING_UPGRADE, 0, m_upgrade_fd));
+    else
+        r->utils.addfd(r->m_epollfd, m_upgrade_fd, false, 0);
+    LOG_INFO("upgrade: started new process %d", pid);
+}
+
+//0号反应堆处理新进程的回应，ret为读取结果
+void WebServer::dealwithupgrade(reactor *r, int ret)
+{
+    if (!r->m_ring)
+        epoll_ctl(r->m_epollfd, EPOLL_CTL_DEL, m_upgrade_fd, 0);
+    close(m_upgrade_fd);
+    m_upgrade_fd = -1;
+
+    //新进程启动失败，旧进程继续服务
+    if (ret != 1)
+    {
+        LOG_ERROR("upgrade: new process %d failed", m_upgrade_pid);
+        return;
+    }
+
+    LOG_INFO("upgrade: new process %d ready, draining", m_upgrade_pid);
+    http_conn::m_draining = true;
+    stop_accept(r);
+    for (int i = 1; i < m_reactor_num; ++i)
+        m_reactors[i].m_cq->push(-1, 0, completion_queue::DRAIN);
+}
+
+//停止accept：监听socket与新进程共享，不能关闭内核中的队列，只是本进程不再接受
+//描述符保留到析构时关闭，避免其编号在排空期间被新连接复用
+void WebServer::stop_accept(reactor *r)
+{
+    if (!r->m_accepting)
+        return;
+    r->m_accepting = false;
+    if (r->m_ring)
+        r->m_ring->prep_cancel(uring_data(URING_ACCEPT, 0, r->m_listenfd));
+    else
+        epoll_ctl(r->m_epollfd, EPOLL_CTL_DEL, r->m_listenfd, 0);
+}
+
+//新进程：从环境变量得到通信socket，接收旧进程的监听socket
+void WebServer::inherit_listenfds()
+{
+    const char *env = getenv(UPGRADE_ENV);
+    if (!env)
+        return;
+    m_upgrade_fd = atoi(env);
+    unsetenv(UPGRADE_ENV);
+
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int) * MAX_REACTOR)];
+        struct cmsghdr align;
+    } ctrl;
+    char tag;
+    struct iovec iov = {&tag, 1};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    if (recvmsg(m_upgrade_fd, &msg, MSG_CMSG_CLOEXEC) <= 0)
+    {
+        LOG_ERROR("%s:errno is:%d", "upgrade recvmsg failure", errno);
+        close(m_upgrade_fd);
+        m_upgrade_fd = -1;
+        return;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        int num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int *fds = (int *)CMSG_DATA(cmsg);
+        for (int i = 0; i < num; ++i)
+        {
+            //反应堆数量变少时多余的监听socket直接关闭
+            if (m_inherit_num < m_reactor_num)
+                m_inherit_fds[m_inherit_num++] = fds[i];
+            else
+                close(fds[i]);
+        }
+    }
+    LOG_INFO("upgrade: inherited %d listen sockets", m_inherit_num);
+}
@@ -3,6 +3,7 @@
 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -11,13 +12,57 @@
 #include <stdlib.h>
 #include <cassert>
 #include <sys/epoll.h>
+#include <pthread.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <vector>
+#include <string>
 
 #include "./threadpool/threadpool.h"
 #include "./http/http_conn.h"
+#include "./uring/uring.h"
+#include "./slab/slab.h"
 
 const int MAX_FD =165536;           //最大文件描述符
 const int MAX_EVENT_NUMBER = 10000; //最大事件数
-const int TIMESLOT = 5;             //最小超时单位
+const int MAX_REACTOR = 256;        //最大事件循环线程数
+const int MAX_ACCEPT_BATCH = 64;    //每次监听socket就绪时最多接受的连接数
+const int URING_ENTRIES = 4096;     //io_uring提交队列大小
+const int URING_BUF_NUM = 1024;     //io_uring接收缓冲区数量
+const int FILE_CACHE_SIZE = 1024;   //文件缓存最多缓存的文件数
+#define UPGRADE_ENV "WEBSERVER_UPGRADE_FD" //平滑升级时新进程从该环境变量得到与旧进程通信的socket
+
+class WebServer;
+
+//反应堆：每个事件循环线程独占一个监听socket、epoll内核事件表、timerfd和定时器链表
+struct reactor
+{
+    int m_id;
+    pthread_t m_tid;
+    WebServer *m_server;
+
+    int m_listenfd;
+    bool m_accepting; //平滑升级排空期间为false，监听socket已交给新进程
+    int m_epollfd;
+    int m_timerfd;  //周期定时
+    int m_sigfd;    //信号，只有0号反应堆持有，其余为-1
+    epoll_event *events;
+
+    //reactor模式下工作线程回报事件的完成队列，其eventfd注册在本反应堆的epoll中
+    completion_queue *m_cq;
+
+    //io_uring模式：替代epoll的提交/完成队列，以及signalfd、timerfd和完成队列eventfd的读缓冲
+    uring *m_ring;
+    struct signalfd_siginfo m_siginfo;
+    uint64_t m_timer_val;
+    uint64_t m_cq_val;
+
+    //定时器链表等工具类，只在本反应堆线程内访问
+    Utils utils;
+
+    //本反应堆接受的连接对象，accept时取出，关闭时归还
+    slab<http_conn> m_conns;
+};
 
 class WebServer
 {
@@ -27,7 +72,11 @@ public:
 
     void init(int port , string user, string passWord, string databaseName,
               int log_write , int opt_linger, int trigmode, int sql_num,
-              int thread_num, int close_log, int actor_model);
+              int thread_num, int close_log, int actor_model, int reactor_num,
+              int backlog, int defer_accept, int timeslot, int head_limit, int body_limit, int zero_copy,
+              int resp_cache, string cache_policy, int keep_alive, int keep_alive_max, int autoindex,
+              string upload_dir, int upload_limit, int http2, string tls_cert, string tls_key, int ktls,
+              int write_quantum);
 
     void thread_pool();
     void sql_pool();
@@ -35,13 +84,39 @@ public:
     void trig_mode();
     void eventListen();
     void eventLoop();
-    void timer(int connfd, struct sockaddr_in client_address);
-    void adjust_timer(util_timer *timer);
-    void deal_timer(util_timer *timer, int sockfd);
-    bool dealclinetdata();
-    bool dealwithsignal(bool& timeout, bool& stop_server);
-    void dealwithread(int sockfd);
-    void dealwithwrite(int sockfd);
+    void reactorLoop(reactor *r);
+    void timer(reactor *r, int connfd, struct sockaddr_in client_address);
+    void adjust_timer(reactor *r, util_timer *timer);
+    void deal_timer(reactor *r, util_timer *timer, int sockfd);
+    //连接已关闭时返回NULL
+    util_timer *conn_timer(int sockfd) { return users[sockfd] ? users[sockfd]->m_timer_data.timer : NULL; }
+    bool dealclinetdata(reactor *r);
+    bool dealwithsignal(reactor *r, bool& stop_server);
+    bool dealwithtimer(reactor *r, bool& timeout);
+    void dealwithupgrade(reactor *r, int ret);
+    void dealwithcompletion(reactor *r, bool& stop_server);
+    http_conn *completed_conn(reactor *r, int sockfd, unsigned int gen);
+    void dealwithread(reactor *r, int sockfd);
+    void dealwithwrite(reactor *r, int sockfd);
+
+    //io_uring模式(actor_model为2)：真正的proactor，收发均由内核异步完成
+    void uringLoop(reactor *r);
+    void dealwithuring(reactor *r, uint64_t data, int res, unsigned flags, bool &timeout, bool &stop_server);
+    void uring_recv(reactor *r, int sockfd);
+    void uring_send(reactor *r, int sockfd);
+
+private:
+    void listen_reactor(reactor *r);
+    void open_listenfd(reactor *r);
+    void on_signal(reactor *r, int sig, bool &stop_server);
+    void tick(reactor *r, bool &stop_server);
+    static void close_cb(client_data *user_data);
+
+    //平滑升级：旧进程fork+exec新进程，经SCM_RIGHTS传递监听socket
+    void upgrade(reactor *r);
+    void inherit_listenfds();
+    void stop_accept(reactor *r);
+    static void *reactor_worker(void *arg);
 
 public:
     //基础
@@ -50,11 +125,11 @@ public:
     int m_log_write;
     int m_close_log;
     int m_actormodel;
-
-    int m_pipefd[2];
     
-    //http连接处理
-    http_conn *users;
+    //http连接处理，按connfd索引，连接对象由各反应堆的slab按需分配，未使用的为NULL
+    http_conn **users;
+    //连接序号，用于client_data::gen
+    std::atomic<unsigned int> m_conn_seq;
 
     //数据库相关
     connection_pool *m_connPool;
@@ -67,11 +142,35 @@ public:
     threadpool<http_conn> *m_pool;
     int m_thread_num;
 
-    //epoll_event相关
-    int m_epollfd;
-    epoll_event events[MAX_EVENT_NUMBER];
+    //反应堆相关，m_reactor_num个事件循环，各自持有SO_REUSEPORT监听socket
+    int m_reactor_num;
+    reactor *m_reactors;
+
+    //监听队列长度，以及TCP_DEFER_ACCEPT秒数(0为关闭)
+    int m_backlog;
+    int m_defer_accept;
+
+    //定时周期(毫秒)，空闲连接3个周期后关闭
+    int m_timeslot;
+    int m_idle_timeout; //长连接空闲超时(毫秒)
+    long m_resp_cache;  //预生成响应的内存预算(字节)
+
+    //上传目录和单个上传的长度上限(MB)
+    string m_upload_dir;
+    int m_upload_limit;
+
+    //TLS证书链和私钥，空为不启用；握手后是否尝试内核TLS
+    string m_tls_cert;
+    string m_tls_key;
+    int m_ktls;
+
+    //平滑升级：新进程中为从旧进程继承的监听socket，旧进程中为等待新进程就绪的通信socket
+    int m_inherit_fds[MAX_REACTOR];
+    int m_inherit_num;
+    int m_upgrade_fd;
+    pid_t m_upgrade_pid;
+    char m_upgrade_ack;
 
-    int m_listenfd;
     //是否优雅关闭
     int m_OPT_LINGER;
     
@@ -80,9 +179,5 @@ public:
     int m_LISTENTrigmode;
     //accept() LT / ET
     int m_CONNTrigmode;
-
-    //定时器相关
-    client_data *users_timer;
-    Utils utils;
 };
 #endif